@@ -6,9 +6,18 @@
 #include <stdbool.h>
 #include <stddef.h>
 #include <limits.h>
+#include <math.h>
 #include "dsp_regs.h"
 #include "dsp.h"
 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define DSP_SIMD_SSE2 1
+#elif defined(__ARM_NEON) || defined(_M_ARM64)
+#include <arm_neon.h>
+#define DSP_SIMD_NEON 1
+#endif
+
 #define MY_CHANGES 1
 
 static const int rateValues[32] = {
@@ -53,20 +62,49 @@ static const int gaussValues[512] = {
   0x513, 0x514, 0x514, 0x515, 0x516, 0x516, 0x517, 0x517, 0x517, 0x518, 0x518, 0x518, 0x518, 0x518, 0x519, 0x519
 };
 
-static void dsp_cycleChannel(Dsp* dsp, int ch);
-static void dsp_handleEcho(Dsp* dsp, int* outputL, int* outputR);
+enum {
+  kDspBlockSize = 64,
+  kDspBrrCache_Bits = 13,
+  kDspBrrCache_Size = 1 << kDspBrrCache_Bits,
+  kDspBrrCache_MaxRun = 2048,
+};
+
+// Decoded brr blocks of the samples in the sample directory, keyed by their
+// address in apu ram.
+typedef struct DspBrrBlock {
+  bool used;
+  uint16_t adr;
+  uint8_t raw[9];  // to detect if the ram was changed since
+  int16_t old, older;  // filter state it was decoded with
+  int16_t samples[16];
+} DspBrrBlock;
+
+struct DspBrrCache {
+  int count;
+  DspBrrBlock blocks[kDspBrrCache_Size];
+};
+
+static DspBrrBlock *dsp_findBrrBlock(DspBrrCache *cache, uint16_t adr);
+
+static int16_t dsp_cycleChannel(Dsp* dsp, int ch, int16_t modSample, int16_t noiseSample);
+static void dsp_handleEcho(Dsp* dsp, int* outputL, int* outputR, int inL, int inR);
 static void dsp_handleGain(Dsp* dsp, int ch);
 static void dsp_decodeBrr(Dsp* dsp, int ch);
+static void dsp_decodeBrrBlock(const uint8_t *src, int *old, int *older, int16_t *out);
 static int16_t dsp_getSample(Dsp* dsp, int ch, int sampleNum, int offset);
 static void dsp_handleNoise(Dsp* dsp);
 
 Dsp* dsp_init(uint8_t *apu_ram) {
   Dsp* dsp = (Dsp*)malloc(sizeof(Dsp));
   dsp->apu_ram = apu_ram;
+  dsp->resampler = NULL;
+  dsp->brrCache = NULL;
   return dsp;
 }
 
 void dsp_free(Dsp* dsp) {
+  free(dsp->resampler);
+  free(dsp->brrCache);
   free(dsp);
 }
 
@@ -132,18 +170,26 @@ void dsp_saveload(Dsp *dsp, SaveLoadFunc *func, void *ctx) {
 void dsp_cycle(Dsp* dsp) {
   int totalL = 0;
   int totalR = 0;
+  int inL = 0, inR = 0;
   for(int i = 0; i < 8; i++) {
-    dsp_cycleChannel(dsp, i);
+    dsp_cycleChannel(dsp, i, i > 0 ? dsp->channel[i - 1].sampleOut : 0, dsp->noiseSample);
     totalL += (dsp->channel[i].sampleOut * dsp->channel[i].volumeL) >> 6;
     totalR += (dsp->channel[i].sampleOut * dsp->channel[i].volumeR) >> 6;
     totalL = totalL < -0x8000 ? -0x8000 : (totalL > 0x7fff ? 0x7fff : totalL); // clamp 16-bit
     totalR = totalR < -0x8000 ? -0x8000 : (totalR > 0x7fff ? 0x7fff : totalR); // clamp 16-bit
+    // get echo input
+    if(dsp->channel[i].echoEnable) {
+      inL += (dsp->channel[i].sampleOut * dsp->channel[i].volumeL) >> 6;
+      inR += (dsp->channel[i].sampleOut * dsp->channel[i].volumeR) >> 6;
+      inL = inL < -0x8000 ? -0x8000 : (inL > 0x7fff ? 0x7fff : inL); // clamp 16-bit
+      inR = inR < -0x8000 ? -0x8000 : (inR > 0x7fff ? 0x7fff : inR); // clamp 16-bit
+    }
   }
   totalL = (totalL * dsp->masterVolumeL) >> 7;
   totalR = (totalR * dsp->masterVolumeR) >> 7;
   totalL = totalL < -0x8000 ? -0x8000 : (totalL > 0x7fff ? 0x7fff : totalL); // clamp 16-bit
   totalR = totalR < -0x8000 ? -0x8000 : (totalR > 0x7fff ? 0x7fff : totalR); // clamp 16-bit
-  dsp_handleEcho(dsp, &totalL, &totalR);
+  dsp_handleEcho(dsp, &totalL, &totalR, inL, inR);
   if(dsp->mute) {
     totalL = 0;
     totalR = 0;
@@ -158,7 +204,125 @@ void dsp_cycle(Dsp* dsp) {
   dsp->evenCycle = !dsp->evenCycle;
 }
 
-static void dsp_handleEcho(Dsp* dsp, int* outputL, int* outputR) {
+// acc = clamp(acc + clamp((src * volume) >> shift)), 16-bit
+static void dsp_mulAdd(int16_t *acc, const int16_t *src, int volume, int shift, int n) {
+  int i = 0;
+#if DSP_SIMD_SSE2
+  __m128i vol = _mm_set1_epi16((int16_t)volume), sh = _mm_cvtsi32_si128(shift);
+  for (; i + 8 <= n; i += 8) {
+    __m128i v = _mm_loadu_si128((const __m128i *)&src[i]);
+    __m128i lo = _mm_mullo_epi16(v, vol), hi = _mm_mulhi_epi16(v, vol);
+    __m128i p = _mm_packs_epi32(_mm_sra_epi32(_mm_unpacklo_epi16(lo, hi), sh),
+                                _mm_sra_epi32(_mm_unpackhi_epi16(lo, hi), sh));
+    _mm_storeu_si128((__m128i *)&acc[i], _mm_adds_epi16(_mm_loadu_si128((const __m128i *)&acc[i]), p));
+  }
+#elif DSP_SIMD_NEON
+  int16x4_t vol = vdup_n_s16((int16_t)volume);
+  int32x4_t sh = vdupq_n_s32(-shift);
+  for (; i + 8 <= n; i += 8) {
+    int16x8_t v = vld1q_s16(&src[i]);
+    int32x4_t lo = vshlq_s32(vmull_s16(vget_low_s16(v), vol), sh);
+    int32x4_t hi = vshlq_s32(vmull_s16(vget_high_s16(v), vol), sh);
+    vst1q_s16(&acc[i], vqaddq_s16(vld1q_s16(&acc[i]), vcombine_s16(vqmovn_s32(lo), vqmovn_s32(hi))));
+  }
+#endif
+  for (; i < n; i++) {
+    int t = (src[i] * volume) >> shift;
+    t = acc[i] + (t < -0x8000 ? -0x8000 : (t > 0x7fff ? 0x7fff : t));
+    acc[i] = t < -0x8000 ? -0x8000 : (t > 0x7fff ? 0x7fff : t); // clamp 16-bit
+  }
+}
+
+static bool dsp_rangeInEcho(uint16_t adr, int len, uint16_t echoStart, uint32_t echoSize) {
+  for (int i = 0; i < len; i++) {
+    if ((uint16_t)(adr + i - echoStart) < echoSize)
+      return true;
+  }
+  return false;
+}
+
+// The block path runs each voice over the whole block before the echo is
+// written, so it can't be used if a voice may read brr data from the part
+// of ram that the echo writes to. A voice decodes at most one brr block for
+// every 16 samples, starting at the current offset or at the loop point.
+static bool dsp_voicesReadEcho(Dsp* dsp, int n) {
+  uint32_t echoSize = (dsp->echoBufferIndex + dsp->echoRemain) * 4;
+  if (echoSize < dsp->echoDelay * 4u)
+    echoSize = dsp->echoDelay * 4u;
+  if (echoSize >= 0x10000)
+    return true;
+  int len = ((n * 0x3fff) >> 16) + 2;
+  len *= 9;
+  for (int ch = 0; ch < 8; ch++) {
+    DspChannel *c = &dsp->channel[ch];
+    uint16_t samplePointer = dsp->dirPage + 4 * c->srcn;
+    uint16_t loop = dsp->apu_ram[(samplePointer + 2) & 0xffff] | dsp->apu_ram[(samplePointer + 3) & 0xffff] << 8;
+    if (dsp_rangeInEcho(samplePointer, 4, dsp->echoBufferAdr, echoSize) ||
+        dsp_rangeInEcho(c->decodeOffset, len, dsp->echoBufferAdr, echoSize) ||
+        dsp_rangeInEcho(loop, len, dsp->echoBufferAdr, echoSize))
+      return true;
+  }
+  return false;
+}
+
+// Same as calling dsp_cycle |n| times, but renders each voice over the whole
+// block at once and then mixes the voices for all samples together.
+void dsp_cycleBlock(Dsp* dsp, int n) {
+  if (n > kDspBlockSize || dsp->echoWrites && dsp_voicesReadEcho(dsp, n)) {
+    for (int i = 0; i < n; i++)
+      dsp_cycle(dsp);
+    return;
+  }
+  int16_t voices[8][kDspBlockSize], noise[kDspBlockSize];
+  int16_t mixL[kDspBlockSize], mixR[kDspBlockSize];
+  int16_t echoL[kDspBlockSize], echoR[kDspBlockSize];
+  int16_t outL[kDspBlockSize], outR[kDspBlockSize];
+  // the noise doesn't depend on the voices, so it can all be generated first
+  for (int s = 0; s < n; s++) {
+    noise[s] = dsp->noiseSample;
+    dsp_handleNoise(dsp);
+  }
+  for (int ch = 0; ch < 8; ch++) {
+    const int16_t *mod = voices[ch > 0 ? ch - 1 : 0];
+    for (int s = 0; s < n; s++)
+      voices[ch][s] = dsp_cycleChannel(dsp, ch, ch > 0 ? mod[s] : 0, noise[s]);
+  }
+  memset(mixL, 0, sizeof(mixL));
+  memset(mixR, 0, sizeof(mixR));
+  memset(echoL, 0, sizeof(echoL));
+  memset(echoR, 0, sizeof(echoR));
+  memset(outL, 0, sizeof(outL));
+  memset(outR, 0, sizeof(outR));
+  for (int ch = 0; ch < 8; ch++) {
+    DspChannel *c = &dsp->channel[ch];
+    dsp_mulAdd(mixL, voices[ch], c->volumeL, 6, n);
+    dsp_mulAdd(mixR, voices[ch], c->volumeR, 6, n);
+    if (c->echoEnable) {
+      dsp_mulAdd(echoL, voices[ch], c->volumeL, 6, n);
+      dsp_mulAdd(echoR, voices[ch], c->volumeR, 6, n);
+    }
+  }
+  dsp_mulAdd(outL, mixL, dsp->masterVolumeL, 7, n);
+  dsp_mulAdd(outR, mixR, dsp->masterVolumeR, 7, n);
+  // the echo reads back what it wrote echoDelay samples ago, so it stays serial
+  for (int s = 0; s < n; s++) {
+    int totalL = outL[s], totalR = outR[s];
+    dsp_handleEcho(dsp, &totalL, &totalR, echoL[s], echoR[s]);
+    if(dsp->mute) {
+      totalL = 0;
+      totalR = 0;
+    }
+    if (dsp->sampleOffset < 534) {
+      dsp->sampleBuffer[dsp->sampleOffset * 2] = totalL;
+      dsp->sampleBuffer[dsp->sampleOffset * 2 + 1] = totalR;
+      dsp->sampleOffset++;
+    }
+  }
+  if (n & 1)
+    dsp->evenCycle = !dsp->evenCycle;
+}
+
+static void dsp_handleEcho(Dsp* dsp, int* outputL, int* outputR, int inL, int inR) {
   // get value out of ram
   uint16_t adr = dsp->echoBufferAdr + dsp->echoBufferIndex * 4;
   dsp->firBufferL[dsp->firBufferIndex] = (
@@ -187,16 +351,6 @@ static void dsp_handleEcho(Dsp* dsp, int* outputL, int* outputR) {
   int outR = *outputR + ((sumR * dsp->echoVolumeR) >> 7);
   *outputL = outL < -0x8000 ? -0x8000 : (outL > 0x7fff ? 0x7fff : outL); // clamp 16-bit
   *outputR = outR < -0x8000 ? -0x8000 : (outR > 0x7fff ? 0x7fff : outR); // clamp 16-bit
-  // get echo input
-  int inL = 0, inR = 0;
-  for(int i = 0; i < 8; i++) {
-    if(dsp->channel[i].echoEnable) {
-      inL += (dsp->channel[i].sampleOut * dsp->channel[i].volumeL) >> 6;
-      inR += (dsp->channel[i].sampleOut * dsp->channel[i].volumeR) >> 6;
-      inL = inL < -0x8000 ? -0x8000 : (inL > 0x7fff ? 0x7fff : inL); // clamp 16-bit
-      inR = inR < -0x8000 ? -0x8000 : (inR > 0x7fff ? 0x7fff : inR); // clamp 16-bit
-    }
-  }
   // write this to ram
   inL += (sumL * dsp->feedbackVolume) >> 7;
   inR += (sumR * dsp->feedbackVolume) >> 7;
@@ -221,11 +375,13 @@ static void dsp_handleEcho(Dsp* dsp, int* outputL, int* outputR) {
   }
 }
 
-static void dsp_cycleChannel(Dsp* dsp, int ch) {
+// |modSample| is this cycle's output of the previous channel, and |noiseSample|
+// the current noise value.
+static inline int16_t dsp_cycleChannel(Dsp* dsp, int ch, int16_t modSample, int16_t noiseSample) {
   // handle pitch counter
   uint16_t pitch = dsp->channel[ch].pitch;
   if(ch > 0 && dsp->channel[ch].pitchModulation) {
-    int factor = (dsp->channel[ch - 1].sampleOut >> 4) + 0x400;
+    int factor = (modSample >> 4) + 0x400;
     pitch = (pitch * factor) >> 10;
     if(pitch > 0x3fff) pitch = 0x3fff;
   }
@@ -237,7 +393,7 @@ static void dsp_cycleChannel(Dsp* dsp, int ch) {
   dsp->channel[ch].pitchCounter = newCounter;
   int16_t sample = 0;
   if(dsp->channel[ch].useNoise) {
-    sample = dsp->noiseSample;
+    sample = noiseSample;
   } else {
     sample = dsp_getSample(dsp, ch, dsp->channel[ch].pitchCounter >> 12, (dsp->channel[ch].pitchCounter >> 4) & 0xff);
   }
@@ -281,6 +437,7 @@ static void dsp_cycleChannel(Dsp* dsp, int ch) {
   sample = (sample * dsp->channel[ch].gain) >> 11;
   dsp->ram[(ch << 4) | 9] = sample >> 7;
   dsp->channel[ch].sampleOut = sample;
+  return sample;
 }
 
 static void dsp_handleGain(Dsp* dsp, int ch) {
@@ -367,19 +524,45 @@ static void dsp_decodeBrr(Dsp* dsp, int ch) {
     }
     dsp->ram[ENDX] |= 1 << ch; // set ENDX bit for channel
   }
-  uint8_t header = dsp->apu_ram[dsp->channel[ch].decodeOffset++];
+  DspChannel *c = &dsp->channel[ch];
+  uint8_t block[9];
+  const uint8_t *src = &dsp->apu_ram[c->decodeOffset];
+  if (c->decodeOffset > 0x10000 - 9) {
+    for (int i = 0; i < 9; i++)
+      block[i] = dsp->apu_ram[(c->decodeOffset + i) & 0xffff];
+    src = block;
+  }
+  c->previousFlags = src[0] & 0x3;
+  int filter = (src[0] & 0xc) >> 2;
+  const DspBrrBlock *b = dsp->brrCache ? dsp_findBrrBlock(dsp->brrCache, c->decodeOffset) : NULL;
+  // The cached samples can be used if the block is unchanged, and the filter
+  // doesn't depend on earlier samples or they are the same as when it was cached.
+  if (b && memcmp(b->raw, src, 9) == 0 && (filter == 0 || b->old == c->old && b->older == c->older)) {
+    memcpy(&c->decodeBuffer[3], b->samples, sizeof(b->samples));
+    c->older = b->samples[14];
+    c->old = b->samples[15];
+  } else {
+    int old = c->old, older = c->older;
+    dsp_decodeBrrBlock(src, &old, &older, &c->decodeBuffer[3]);
+    c->old = old;
+    c->older = older;
+  }
+  c->decodeOffset += 9;
+}
+
+static void dsp_decodeBrrBlock(const uint8_t *src, int *oldp, int *olderp, int16_t *out) {
+  uint8_t header = src[0];
   int shift = header >> 4;
   int filter = (header & 0xc) >> 2;
-  dsp->channel[ch].previousFlags = header & 0x3;
   uint8_t curByte = 0;
-  int old = dsp->channel[ch].old;
-  int older = dsp->channel[ch].older;
+  int old = *oldp;
+  int older = *olderp;
   for(int i = 0; i < 16; i++) {
     int s = 0;
     if(i & 1) {
       s = curByte & 0xf;
     } else {
-      curByte = dsp->apu_ram[dsp->channel[ch].decodeOffset++];
+      curByte = src[1 + (i >> 1)];
       s = curByte >> 4;
     }
     if(s > 7) s -= 16;
@@ -397,10 +580,74 @@ static void dsp_decodeBrr(Dsp* dsp, int ch) {
     s = ((int16_t) ((s & 0x7fff) << 1)) >> 1; // clip 15-bit
     older = old;
     old = s;
-    dsp->channel[ch].decodeBuffer[i + 3] = s;
+    out[i] = s;
+  }
+  *olderp = older;
+  *oldp = old;
+}
+
+static DspBrrBlock *dsp_findBrrBlock(DspBrrCache *cache, uint16_t adr) {
+  uint32_t i = (adr * 0x9e3779b1u) >> (32 - kDspBrrCache_Bits);
+  for (;; i = (i + 1) & (kDspBrrCache_Size - 1)) {
+    DspBrrBlock *b = &cache->blocks[i];
+    if (!b->used)
+      return NULL;
+    if (b->adr == adr)
+      return b;
+  }
+}
+
+static DspBrrBlock *dsp_insertBrrBlock(DspBrrCache *cache, uint16_t adr) {
+  if (cache->count >= kDspBrrCache_Size * 3 / 4)
+    return NULL;
+  uint32_t i = (adr * 0x9e3779b1u) >> (32 - kDspBrrCache_Bits);
+  for (;; i = (i + 1) & (kDspBrrCache_Size - 1)) {
+    DspBrrBlock *b = &cache->blocks[i];
+    if (!b->used) {
+      b->used = true;
+      b->adr = adr;
+      cache->count++;
+      return b;
+    }
+    if (b->adr == adr)
+      return b;
+  }
+}
+
+// Decodes the blocks of one sample starting at |adr|, until the end flag.
+// Blocks that are already cached are only replaced if |replace| is set, which
+// is used for the loop, so that it holds the filter state of the later passes.
+static void dsp_cacheBrrRun(Dsp* dsp, uint16_t adr, int *old, int *older, bool replace) {
+  DspBrrCache *cache = dsp->brrCache;
+  for (int n = 0; n < kDspBrrCache_MaxRun && adr <= 0x10000 - 9; n++, adr += 9) {
+    const uint8_t *src = &dsp->apu_ram[adr];
+    DspBrrBlock *b = dsp_findBrrBlock(cache, adr);
+    if (b && !replace)
+      return;  // shared with a sample that was already done
+    if (!b && !(b = dsp_insertBrrBlock(cache, adr)))
+      return;
+    memcpy(b->raw, src, 9);
+    b->old = *old;
+    b->older = *older;
+    dsp_decodeBrrBlock(src, old, older, b->samples);
+    if (src[0] & 1)
+      return;
+  }
+}
+
+void dsp_buildBrrCache(Dsp* dsp) {
+  if (!dsp->brrCache)
+    dsp->brrCache = (DspBrrCache*)malloc(sizeof(DspBrrCache));
+  memset(dsp->brrCache, 0, sizeof(DspBrrCache));
+  for (int srcn = 0; srcn < 256; srcn++) {
+    uint16_t samplePointer = dsp->dirPage + 4 * srcn;
+    uint16_t start = dsp->apu_ram[samplePointer] | dsp->apu_ram[(samplePointer + 1) & 0xffff] << 8;
+    uint16_t loop = dsp->apu_ram[(samplePointer + 2) & 0xffff] | dsp->apu_ram[(samplePointer + 3) & 0xffff] << 8;
+    int old = 0, older = 0;
+    dsp_cacheBrrRun(dsp, start, &old, &older, false);
+    dsp_cacheBrrRun(dsp, loop, &old, &older, false);
+    dsp_cacheBrrRun(dsp, loop, &old, &older, true);
   }
-  dsp->channel[ch].older = older;
-  dsp->channel[ch].old = old;
 }
 
 static void dsp_handleNoise(Dsp* dsp) {
@@ -605,7 +852,10 @@ void dsp_write(Dsp *dsp, uint8_t adr, uint8_t val) {
     break;
   }
   case DIR: {
+    bool changed = dsp->dirPage != (val << 8);
     dsp->dirPage = val << 8;
+    if (changed && dsp->brrCache)
+      dsp_buildBrrCache(dsp);
     break;
   }
   case ESA: {
@@ -634,7 +884,128 @@ void dsp_write(Dsp *dsp, uint8_t adr, uint8_t val) {
   dsp->ram[adr] = val;
 }
 
+enum {
+  kResampler_Phases = 256,
+  kResampler_MaxTaps = 32,
+  kResampler_CoefBits = 14,
+};
+
+struct DspResampler {
+  int taps;
+  int samplesPerFrame;  // what the filter was made for
+  // The last |taps| samples of the previous frame followed by this frame
+  int16_t history[2][kResampler_MaxTaps + 534];
+  int16_t coefs[kResampler_Phases * kResampler_MaxTaps];
+};
+
+void dsp_setResamplerQuality(Dsp* dsp, int quality) {
+  DspResampler *rs = NULL;
+  if (quality > 0) {
+    rs = (DspResampler*)calloc(1, sizeof(DspResampler));
+    if (rs == NULL)
+      return;  // keep the current resampler
+    rs->taps = 8 << (quality > 3 ? 2 : quality - 1);
+  }
+  free(dsp->resampler);
+  dsp->resampler = rs;
+}
+
+// Blackman windowed sinc, one set of |taps| coefficients for each fractional position.
+static void dsp_makeResamplerFilter(DspResampler* rs, int samplesPerFrame) {
+  const double kPi = 3.14159265358979323846;
+  int taps = rs->taps, half = taps / 2;
+  // Cut off a bit below nyquist of the lower of the two rates
+  double cutoff = (samplesPerFrame < 534 ? samplesPerFrame / 534.0 : 1.0) * 0.9;
+  for (int p = 0; p < kResampler_Phases; p++) {
+    double c[kResampler_MaxTaps], sum = 0;
+    for (int k = 0; k < taps; k++) {
+      // Distance from the tap to where the output sample is, in input samples
+      double d = (double)p / kResampler_Phases + half - 1 - k;
+      double x = kPi * d / half;
+      double w = (fabs(d) >= half) ? 0 : 0.42 + 0.5 * cos(x) + 0.08 * cos(2 * x);
+      double s = (d == 0) ? 1.0 : sin(kPi * cutoff * d) / (kPi * cutoff * d);
+      c[k] = s * w;
+      sum += c[k];
+    }
+    // Normalize so that each phase has unity gain, put the rounding error in the middle.
+    int16_t *dst = &rs->coefs[p * taps];
+    int isum = 0;
+    for (int k = 0; k < taps; k++)
+      isum += dst[k] = (int16_t)lrint(c[k] / sum * (1 << kResampler_CoefBits));
+    dst[half - 1] += (1 << kResampler_CoefBits) - isum;
+  }
+  memset(rs->history, 0, sizeof(rs->history));
+  rs->samplesPerFrame = samplesPerFrame;
+}
+
+static inline int32_t dsp_dotProduct(const int16_t* a, const int16_t* b, int n) {
+#if defined(DSP_SIMD_SSE2)
+  __m128i acc = _mm_setzero_si128();
+  for (int i = 0; i < n; i += 8)
+    acc = _mm_add_epi32(acc, _mm_madd_epi16(_mm_loadu_si128((const __m128i*)(a + i)), _mm_loadu_si128((const __m128i*)(b + i))));
+  acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, _MM_SHUFFLE(1, 0, 3, 2)));
+  acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, _MM_SHUFFLE(2, 3, 0, 1)));
+  return _mm_cvtsi128_si32(acc);
+#elif defined(DSP_SIMD_NEON)
+  int32x4_t acc = vdupq_n_s32(0);
+  for (int i = 0; i < n; i += 8) {
+    int16x8_t x = vld1q_s16(a + i), y = vld1q_s16(b + i);
+    acc = vmlal_s16(acc, vget_low_s16(x), vget_low_s16(y));
+    acc = vmlal_s16(acc, vget_high_s16(x), vget_high_s16(y));
+  }
+  int32x2_t s = vadd_s32(vget_low_s32(acc), vget_high_s32(acc));
+  return vget_lane_s32(vpadd_s32(s, s), 0);
+#else
+  int32_t sum = 0;
+  for (int i = 0; i < n; i++)
+    sum += a[i] * b[i];
+  return sum;
+#endif
+}
+
+static inline int16_t dsp_filterSample(const int16_t* src, const int16_t* coefs, int taps) {
+  int v = (dsp_dotProduct(src, coefs, taps) + (1 << (kResampler_CoefBits - 1))) >> kResampler_CoefBits;
+  return v < -0x8000 ? -0x8000 : (v > 0x7fff ? 0x7fff : v);
+}
+
+// The output is delayed by taps/2 input samples so that each output sample only
+// needs input up until the end of the current frame. The position is tracked as
+// an exact fraction so there is no drift or jump at the frame boundary.
+static void dsp_resample(Dsp* dsp, int16_t* sampleData, int samplesPerFrame, int numChannels) {
+  DspResampler* rs = dsp->resampler;
+  if (rs->samplesPerFrame != samplesPerFrame)
+    dsp_makeResamplerFilter(rs, samplesPerFrame);
+  int taps = rs->taps;
+  int16_t* histL = rs->history[0];
+  int16_t* histR = rs->history[1];
+  for (int i = 0; i < 534; i++) {
+    histL[taps + i] = dsp->sampleBuffer[i * 2];
+    histR[taps + i] = dsp->sampleBuffer[i * 2 + 1];
+  }
+  for (int i = 0; i < samplesPerFrame; i++) {
+    uint32_t pos = (uint32_t)i * 534;
+    uint32_t ipos = pos / samplesPerFrame;
+    uint32_t phase = (pos - ipos * samplesPerFrame) * kResampler_Phases / samplesPerFrame;
+    const int16_t* coefs = &rs->coefs[phase * taps];
+    int16_t sampleL = dsp_filterSample(histL + ipos + 1, coefs, taps);
+    int16_t sampleR = dsp_filterSample(histR + ipos + 1, coefs, taps);
+    if (numChannels == 1) {
+      sampleData[i] = (sampleL + sampleR) >> 1;
+    } else {
+      sampleData[i * 2] = sampleL;
+      sampleData[i * 2 + 1] = sampleR;
+    }
+  }
+  memmove(histL, histL + 534, taps * sizeof(int16_t));
+  memmove(histR, histR + 534, taps * sizeof(int16_t));
+}
+
 void dsp_getSamples(Dsp* dsp, int16_t* sampleData, int samplesPerFrame, int numChannels) {
+  if (dsp->resampler) {
+    dsp_resample(dsp, sampleData, samplesPerFrame, numChannels);
+    dsp->sampleOffset = 0;
+    return;
+  }
   // resample from 534 samples per frame to wanted value
   float adder = 534.0f / samplesPerFrame;
   float location = 0.0f;
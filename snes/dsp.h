@@ -46,8 +46,14 @@ typedef struct DspChannel {
   bool echoEnable;
 } DspChannel;
 
+typedef struct DspResampler DspResampler;
+typedef struct DspBrrCache DspBrrCache;
+
 struct Dsp {
   uint8_t *apu_ram;
+  // not part of the saved state
+  DspResampler *resampler;
+  DspBrrCache *brrCache;
   // mirror ram
   uint8_t ram[0x80];
   // 8 channels
@@ -92,9 +98,16 @@ Dsp* dsp_init(uint8_t *apu_ram);
 void dsp_free(Dsp* dsp);
 void dsp_reset(Dsp* dsp);
 void dsp_cycle(Dsp* dsp);
+// Same as |n| calls to dsp_cycle, where |n| is at most 64.
+void dsp_cycleBlock(Dsp* dsp, int n);
 uint8_t dsp_read(Dsp* dsp, uint8_t adr);
 void dsp_write(Dsp* dsp, uint8_t adr, uint8_t val);
 void dsp_getSamples(Dsp* dsp, int16_t* sampleData, int samplesPerFrame, int numChannels);
+// 0 = nearest neighbour, 1-3 = windowed sinc with 8, 16 or 32 taps
+void dsp_setResamplerQuality(Dsp* dsp, int quality);
+// Predecodes the samples in the sample directory, call after uploading new ones.
+// Voices still decode from ram if a block was changed after this.
+void dsp_buildBrrCache(Dsp* dsp);
 void dsp_saveload(Dsp *dsp, SaveLoadFunc *func, void *ctx);
 
 #endif
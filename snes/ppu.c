@@ -8,6 +8,14 @@
 #include "ppu.h"
 #include "src/types.h"
 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define PPU_SIMD_SSE2 1
+#elif defined(__ARM_NEON) || defined(_M_ARM64)
+#include <arm_neon.h>
+#define PPU_SIMD_NEON 1
+#endif
+
 static const uint8 kSpriteSizes[8][2] = {
   {8, 16}, {8, 32}, {8, 64}, {16, 32},
   {16, 64}, {32, 64}, {16, 32}, {16, 32}
@@ -34,17 +42,20 @@ enum {
 };
 
 Ppu* ppu_init(void) {
-  Ppu* ppu = (Ppu * )malloc(sizeof(Ppu));
+  Ppu* ppu = (Ppu * )calloc(1, sizeof(Ppu));
+  ppu->vram = ppu->vramData;
   ppu->extraLeftRight = kPpuExtraLeftRight;
   return ppu;
 }
 
 void ppu_free(Ppu* ppu) {
+  ppu_freeBgCache(ppu);
   free(ppu);
 }
 
 void ppu_reset(Ppu* ppu) {
-  memset(ppu->vram, 0, sizeof(ppu->vram));
+  memset(ppu->vramData, 0, sizeof(ppu->vramData));
+  PpuMarkVramDirty(ppu, 0, 0x8000);
   ppu->lastBrightnessMult = 0xff;
   ppu->lastMosaicModulo = 0xff;
   ppu->extraLeftCur = 0;
@@ -109,7 +120,7 @@ void ppu_reset(Ppu* ppu) {
 void ppu_saveload(Ppu *ppu, SaveLoadFunc *func, void *ctx) {
   uint8 tmp[556] = { 0 };
 
-  func(ctx, &ppu->vram, 0x8000 * 2);
+  func(ctx, ppu->vramData, 0x8000 * 2);
   func(ctx, tmp, 10);
   func(ctx, &ppu->cgram, 512);
   func(ctx, tmp, 556);
@@ -120,6 +131,11 @@ void ppu_saveload(Ppu *ppu, SaveLoadFunc *func, void *ctx) {
     func(ctx, tmp, 4);
   }
   func(ctx, tmp, 123);
+  PpuMarkVramDirty(ppu, 0, 0x8000);
+}
+
+static FORCEINLINE uint32 PpuExpandColor(uint32 color) {
+  return (color >> 10 & 0x1f) | (color >> 5 & 0x1f) << 8 | (color & 0x1f) << 16;
 }
 
 int PpuGetCurrentRenderScale(Ppu *ppu, uint32_t render_flags) {
@@ -144,6 +160,12 @@ void PpuBeginDrawing(Ppu *ppu, uint8_t *pixels, size_t pitch, uint32_t render_fl
     memset(&ppu->brightnessMult[32], ppu->brightnessMult[31], 31);
   }
 
+  for (int i = 0; i < 256; i++)
+    ppu->cgramExpanded[i] = PpuExpandColor(ppu->cgram[i]);
+
+  // oam may have been written directly
+  ppu->lineSpritesValid = false;
+
   if (PpuGetCurrentRenderScale(ppu, ppu->renderFlags) == 4) {
     for (int i = 0; i < 256; i++) {
       uint32 color = ppu->cgram[i];
@@ -195,6 +217,31 @@ void ppu_runLine(Ppu *ppu, int line) {
   }
 }
 
+// Render lines from a band of the frame. |writes| is sorted by line.
+void ppu_runLines(Ppu *ppu, const PpuRegWrite *writes, size_t num_writes, int line_start, int line_end) {
+  const PpuRegWrite *writes_end = writes + num_writes;
+  for (int line = line_start; line < line_end; line++) {
+    for (; writes != writes_end && writes->line <= line; writes++)
+      ppu_write(ppu, writes->adr, writes->val);
+    ppu_runLine(ppu, line);
+  }
+}
+
+// Copy everything needed to render a line, except the scratch buffers.
+// dst keeps its own bg cache, so it must always be copied from the same ppu.
+void ppu_copyRenderState(Ppu *dst, const Ppu *src) {
+  memcpy(dst, src, offsetof(Ppu, bgBuffers));
+  dst->vram = dst->vramData;
+  memcpy(dst->vram, src->vram, sizeof(dst->vramData));
+  dst->lineSpritesValid = false;
+}
+
+void ppu_copyRenderStateShared(Ppu *dst, Ppu *src) {
+  memcpy(dst, src, offsetof(Ppu, bgBuffers));
+  dst->vram = src->vram;
+  dst->lineSpritesValid = false;
+}
+
 typedef struct PpuWindows {
   int16 edges[6];
   uint8 nr;
@@ -269,6 +316,50 @@ static void PpuWindows_Calc(PpuWindows *win, Ppu *ppu, uint layer) {
   win->bits = w1_bits | w2_bits;
 }
 
+#if defined(PPU_SIMD_SSE2) || defined(PPU_SIMD_NEON)
+// Spread the 8 bits of one bitplane into the low bit of 8 bytes. Byte i gets
+// bit i if |lsb_first| is set, otherwise bit 7 - i.
+static FORCEINLINE uint64 PpuPlaneToChunky(uint32 plane, bool lsb_first) {
+  uint64 x = (plane & 0xff) * 0x0101010101010101ull &
+    (lsb_first ? 0x8040201008040201ull : 0x0102040810204080ull);
+  return ((x + 0x7f7f7f7f7f7f7f7full) & 0x8080808080808080ull) >> 7;
+}
+
+static FORCEINLINE uint64 PpuChunky4bpp(uint32 bits, bool lsb_first) {
+  return PpuPlaneToChunky(bits, lsb_first) | PpuPlaneToChunky(bits >> 8, lsb_first) << 1 |
+         PpuPlaneToChunky(bits >> 16, lsb_first) << 2 | PpuPlaneToChunky(bits >> 24, lsb_first) << 3;
+}
+
+static FORCEINLINE uint64 PpuChunky2bpp(uint32 bits, bool lsb_first) {
+  return PpuPlaneToChunky(bits, lsb_first) | PpuPlaneToChunky(bits >> 8, lsb_first) << 1;
+}
+
+// Merge 8 pixels into the z buffer, same as doing for each pixel:
+//   if (pixel && z > dstz[i]) dstz[i] = z + pixel;
+static FORCEINLINE void PpuMergeSliver(PpuZbufType *dstz, uint64 chunky, PpuZbufType z) {
+#if defined(PPU_SIMD_SSE2)
+  __m128i zero = _mm_setzero_si128();
+  __m128i bias = _mm_set1_epi16((short)0x8000);
+  __m128i pixels = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)&chunky), zero);
+  __m128i zv = _mm_set1_epi16((short)z);
+  __m128i dst = _mm_loadu_si128((const __m128i *)dstz);
+  // There's no unsigned 16-bit compare in sse2
+  __m128i mask = _mm_andnot_si128(_mm_cmpeq_epi16(pixels, zero),
+      _mm_cmpgt_epi16(_mm_xor_si128(zv, bias), _mm_xor_si128(dst, bias)));
+  dst = _mm_or_si128(_mm_and_si128(mask, _mm_add_epi16(zv, pixels)), _mm_andnot_si128(mask, dst));
+  _mm_storeu_si128((__m128i *)dstz, dst);
+#else
+  uint16x8_t pixels = vmovl_u8(vcreate_u8(chunky));
+  uint16x8_t zv = vdupq_n_u16(z);
+  uint16x8_t dst = vld1q_u16(dstz);
+  uint16x8_t mask = vandq_u16(vtstq_u16(pixels, pixels), vcgtq_u16(zv, dst));
+  vst1q_u16(dstz, vbslq_u16(mask, vaddq_u16(zv, pixels), dst));
+#endif
+}
+#define PPU_MERGE_SLIVER_4BPP(hflip_bit) PpuMergeSliver(dstz, PpuChunky4bpp(bits, hflip_bit), z)
+#define PPU_MERGE_SLIVER_2BPP(hflip_bit) PpuMergeSliver(dstz, PpuChunky2bpp(bits, hflip_bit), z)
+#endif  // defined(PPU_SIMD_SSE2) || defined(PPU_SIMD_NEON)
+
 // Draw a whole line of a 4bpp background layer into bgBuffers
 static void PpuDrawBackground_4bpp(Ppu *ppu, uint y, bool sub, uint layer, PpuZbufType zhi, PpuZbufType zlo) {
 #define DO_PIXEL(i) do { \
@@ -336,6 +427,9 @@ static void PpuDrawBackground_4bpp(Ppu *ppu, uint y, bool sub, uint layer, PpuZb
       uint32 bits = READ_BITS(ta, tile & 0x3ff);
       if (bits) {
         z += ((tile & 0x1c00) >> kPaletteShift);
+#if defined(PPU_MERGE_SLIVER_4BPP)
+        PPU_MERGE_SLIVER_4BPP((tile & 0x4000) != 0);
+#else
         if (tile & 0x4000) {
           DO_PIXEL(0); DO_PIXEL(1); DO_PIXEL(2); DO_PIXEL(3);
           DO_PIXEL(4); DO_PIXEL(5); DO_PIXEL(6); DO_PIXEL(7);
@@ -343,6 +437,7 @@ static void PpuDrawBackground_4bpp(Ppu *ppu, uint y, bool sub, uint layer, PpuZb
           DO_PIXEL_HFLIP(0); DO_PIXEL_HFLIP(1); DO_PIXEL_HFLIP(2); DO_PIXEL_HFLIP(3);
           DO_PIXEL_HFLIP(4); DO_PIXEL_HFLIP(5); DO_PIXEL_HFLIP(6); DO_PIXEL_HFLIP(7);
         }
+#endif
       }
       dstz += 8, w -= 8;
     }
@@ -436,6 +531,9 @@ static void PpuDrawBackground_2bpp(Ppu *ppu, uint y, bool sub, uint layer, PpuZb
       uint32 bits = READ_BITS(ta, tile & 0x3ff);
       if (bits) {
         z += ((tile & 0x1c00) >> kPaletteShift);
+#if defined(PPU_MERGE_SLIVER_2BPP)
+        PPU_MERGE_SLIVER_2BPP((tile & 0x4000) != 0);
+#else
         if (tile & 0x4000) {
           DO_PIXEL(0); DO_PIXEL(1); DO_PIXEL(2); DO_PIXEL(3);
           DO_PIXEL(4); DO_PIXEL(5); DO_PIXEL(6); DO_PIXEL(7);
@@ -443,6 +541,7 @@ static void PpuDrawBackground_2bpp(Ppu *ppu, uint y, bool sub, uint layer, PpuZb
           DO_PIXEL_HFLIP(0); DO_PIXEL_HFLIP(1); DO_PIXEL_HFLIP(2); DO_PIXEL_HFLIP(3);
           DO_PIXEL_HFLIP(4); DO_PIXEL_HFLIP(5); DO_PIXEL_HFLIP(6); DO_PIXEL_HFLIP(7);
         }
+#endif
       }
       dstz += 8, w -= 8;
     }
@@ -692,6 +791,16 @@ void PpuSetMode7PerspectiveCorrection(Ppu *ppu, int low, int high) {
   ppu->mode7PerspectiveHigh = 1.0f / high;
 }
 
+void PpuMarkVramDirty(Ppu *ppu, uint32 addr, uint32 num_words) {
+  if (num_words == 0)
+    return;
+  uint32 first = (addr & 0x7fff) >> kPpuVramPageShift;
+  uint32 last = IntMin(((addr & 0x7fff) + num_words - 1) >> kPpuVramPageShift, first + kPpuVramPages - 1);
+  for (uint32 i = first; i <= last; i++)
+    ppu->vramPageWrites[i & (kPpuVramPages - 1)]++;
+  ppu->vramWrites++;
+}
+
 void PpuSetExtraSideSpace(Ppu *ppu, int left, int right, int bottom) {
   ppu->extraLeftCur = UintMin(left, ppu->extraLeftRight);
   ppu->extraRightCur = UintMin(right, ppu->extraLeftRight);
@@ -797,6 +906,146 @@ static void PpuDrawMode7Upsampled(Ppu *ppu, uint y) {
 #undef DRAW_PIXEL
 }
 
+enum {
+  // Rows are direct mapped by the low bits of the scrolled y coordinate
+  kPpuBgCacheRows = 256,
+  kPpuBgCacheLayers = 3,
+};
+
+// One scrolled line of a background layer decoded over the full 512 pixel
+// tilemap width. Holds z + pixel, or 0 where the layer is transparent.
+typedef struct PpuBgCacheRow {
+  uint64 key;
+  uint32 z;
+  uint64 pages;  // vram pages the row was decoded from
+  PpuZbufType data[512];
+} PpuBgCacheRow;
+
+struct PpuBgCache {
+  uint32 vramWrites;
+  uint32 vramPageWrites[kPpuVramPages];
+  PpuBgCacheRow rows[kPpuBgCacheLayers][kPpuBgCacheRows];
+};
+
+void ppu_freeBgCache(Ppu *ppu) {
+  free(ppu->bgCache);
+  ppu->bgCache = NULL;
+}
+
+// Drop all rows that were decoded from a vram page written since the last check.
+static void PpuBgCache_Invalidate(PpuBgCache *cache, Ppu *ppu) {
+  uint64 dirty = 0;
+  for (int i = 0; i < kPpuVramPages; i++) {
+    if (cache->vramPageWrites[i] != ppu->vramPageWrites[i]) {
+      cache->vramPageWrites[i] = ppu->vramPageWrites[i];
+      dirty |= 1ull << i;
+    }
+  }
+  cache->vramWrites = ppu->vramWrites;
+  for (int i = 0; i < kPpuBgCacheLayers; i++) {
+    for (int j = 0; j < kPpuBgCacheRows; j++) {
+      if (cache->rows[i][j].pages & dirty)
+        cache->rows[i][j].key = 0;
+    }
+  }
+}
+
+static PpuBgCache *PpuBgCache_Get(Ppu *ppu) {
+  PpuBgCache *cache = ppu->bgCache;
+  if (!cache) {
+    cache = ppu->bgCache = (PpuBgCache *)calloc(1, sizeof(PpuBgCache));
+    if (!cache)
+      return NULL;
+    memcpy(cache->vramPageWrites, ppu->vramPageWrites, sizeof(cache->vramPageWrites));
+    cache->vramWrites = ppu->vramWrites;
+  } else if (cache->vramWrites != ppu->vramWrites) {
+    PpuBgCache_Invalidate(cache, ppu);
+  }
+  return cache;
+}
+
+static void PpuBgCache_DecodeRow(Ppu *ppu, PpuBgCacheRow *row, BgLayer *bglayer, uint y, bool is_4bpp,
+                                 PpuZbufType zhi, PpuZbufType zlo) {
+  int sc_offs = bglayer->tilemapAdr + (((y >> 3) & 0x1f) << 5);
+  if ((y & 0x100) && bglayer->tilemapHigher)
+    sc_offs += bglayer->tilemapWider ? 0x800 : 0x400;
+  uint32 sc_offs0 = sc_offs & 0x7fff, sc_offs1 = sc_offs + (bglayer->tilemapWider ? 0x400 : 0) & 0x7fff;
+  const uint16 *tps[2] = { &ppu->vram[sc_offs0], &ppu->vram[sc_offs1] };
+  uint64 pages = 1ull << (sc_offs0 >> kPpuVramPageShift) | 1ull << (sc_offs1 >> kPpuVramPageShift);
+  int tileadr = bglayer->tileAdr;
+  int tileadr1 = tileadr + 7 - (y & 0x7), tileadr0 = tileadr + (y & 0x7);
+  int tile_size = is_4bpp ? 16 : 8, palette_shift = is_4bpp ? 6 : 8;
+  PpuZbufType *dst = row->data;
+  for (int i = 0; i < 64; i++, dst += 8) {
+    uint32 tile = tps[i >> 5][i & 31];
+    uint32 addr = ((tile & 0x8000) ? tileadr1 : tileadr0) + (tile & 0x3ff) * tile_size & 0x7fff;
+    uint32 bits = is_4bpp ? ppu->vram[addr] | ppu->vram[addr + 8] << 16 : ppu->vram[addr];
+    pages |= 1ull << (addr >> kPpuVramPageShift);
+    if (!bits) {
+      memset(dst, 0, 8 * sizeof(PpuZbufType));
+      continue;
+    }
+    PpuZbufType z = ((tile & 0x2000) ? zhi : zlo) + ((tile & 0x1c00) >> palette_shift);
+    for (int j = 0; j < 8; j++) {
+      int s = (tile & 0x4000) ? j : 7 - j;
+      uint32 pixel = (bits >> s) & 1 | (bits >> (s + 7)) & 2 | (bits >> (s + 14)) & 4 | (bits >> (s + 21)) & 8;
+      dst[j] = pixel ? z + pixel : 0;
+    }
+  }
+  row->pages = pages;
+}
+
+// Same as doing dstz[i] = max(dstz[i], src[i]). This gives the same result as
+// the "if (pixel && z > dstz[i])" test in the line renderers, because no two
+// layers share the same prio byte.
+static void PpuMergeMax(PpuZbufType *dstz, const PpuZbufType *src, uint n) {
+  uint i = 0;
+#if defined(PPU_SIMD_SSE2)
+  for (; i + 8 <= n; i += 8) {
+    __m128i a = _mm_loadu_si128((const __m128i *)&dstz[i]);
+    __m128i b = _mm_loadu_si128((const __m128i *)&src[i]);
+    _mm_storeu_si128((__m128i *)&dstz[i], _mm_add_epi16(_mm_subs_epu16(b, a), a));
+  }
+#elif defined(PPU_SIMD_NEON)
+  for (; i + 8 <= n; i += 8)
+    vst1q_u16(&dstz[i], vmaxq_u16(vld1q_u16(&dstz[i]), vld1q_u16(&src[i])));
+#endif
+  for (; i < n; i++)
+    if (src[i] > dstz[i])
+      dstz[i] = src[i];
+}
+
+// Draw a whole line of a non mosaic background layer into bgBuffers, using rows from the bg cache
+static void PpuDrawBackground_cached(Ppu *ppu, PpuBgCache *cache, uint y, bool sub, uint layer, bool is_4bpp,
+                                     PpuZbufType zhi, PpuZbufType zlo) {
+  if (!IS_SCREEN_ENABLED(ppu, sub, layer))
+    return;  // layer is completely hidden
+  PpuWindows win;
+  IS_SCREEN_WINDOWED(ppu, sub, layer) ? PpuWindows_Calc(&win, ppu, layer) : PpuWindows_Clear(&win, ppu, layer);
+  BgLayer *bglayer = &ppu->bgLayer[layer];
+  y = (y + bglayer->vScroll) & (bglayer->tilemapHigher ? 0x1ff : 0xff);
+  uint64 key = 1ull << 63 | y | bglayer->tilemapAdr << 9 | (uint64)bglayer->tileAdr << 25 |
+      (uint64)bglayer->tilemapWider << 41 | (uint64)bglayer->tilemapHigher << 42;
+  uint32 z = zhi << 16 | zlo;
+  PpuBgCacheRow *row = &cache->rows[layer][y & (kPpuBgCacheRows - 1)];
+  if (row->key != key || row->z != z) {
+    PpuBgCache_DecodeRow(ppu, row, bglayer, y, is_4bpp, zhi, zlo);
+    row->key = key, row->z = z;
+  }
+  for (size_t windex = 0; windex < win.nr; windex++) {
+    if (win.bits & (1 << windex))
+      continue;  // layer is disabled for this window part
+    uint x = (win.edges[windex] + bglayer->hScroll) & 511;
+    uint w = win.edges[windex + 1] - win.edges[windex];
+    PpuZbufType *dstz = ppu->bgBuffers[sub].data + win.edges[windex] + kPpuExtraLeftRight;
+    while (w) {
+      uint n = IntMin(w, 512 - x);
+      PpuMergeMax(dstz, row->data + x, n);
+      dstz += n, w -= n, x = 0;
+    }
+  }
+}
+
 static void PpuDrawBackgrounds(Ppu *ppu, int y, bool sub) {
 // Top 4 bits contain the prio level, and bottom 4 bits the layer type.
 // SPRITE_PRIO_TO_PRIO can be used to convert from obj prio to this prio.
@@ -814,21 +1063,29 @@ static void PpuDrawBackgrounds(Ppu *ppu, int y, bool sub) {
 //  0: backdrop
 
   if (ppu->mode == 1) {
+    PpuBgCache *cache = (ppu->renderFlags & kPpuRenderFlags_BgRowCache) ? PpuBgCache_Get(ppu) : NULL;
+
     if (ppu->lineHasSprites)
       PpuDrawSprites(ppu, y, sub, true);
 
     if (IS_MOSAIC_ENABLED(ppu, 0))
       PpuDrawBackground_4bpp_mosaic(ppu, y, sub, 0, 0xc000, 0x8000);
+    else if (cache)
+      PpuDrawBackground_cached(ppu, cache, y, sub, 0, true, 0xc000, 0x8000);
     else
       PpuDrawBackground_4bpp(ppu, y, sub, 0, 0xc000, 0x8000);
 
     if (IS_MOSAIC_ENABLED(ppu, 1))
       PpuDrawBackground_4bpp_mosaic(ppu, y, sub, 1, 0xb100, 0x7100);
+    else if (cache)
+      PpuDrawBackground_cached(ppu, cache, y, sub, 1, true, 0xb100, 0x7100);
     else
       PpuDrawBackground_4bpp(ppu, y, sub, 1, 0xb100, 0x7100);
 
     if (IS_MOSAIC_ENABLED(ppu, 2))
       PpuDrawBackground_2bpp_mosaic(ppu, y, sub, 2, 0xf200, 0x1200);
+    else if (cache)
+      PpuDrawBackground_cached(ppu, cache, y, sub, 2, false, 0xf200, 0x1200);
     else
       PpuDrawBackground_2bpp(ppu, y, sub, 2, 0xf200, 0x1200);
   } else {
@@ -839,6 +1096,83 @@ static void PpuDrawBackgrounds(Ppu *ppu, int y, bool sub) {
   }
 }
 
+#if defined(PPU_SIMD_SSE2) || defined(PPU_SIMD_NEON)
+// Color math for 8 pixels at a time, giving the same result as the scalar loop in
+// PpuDrawWholeLine. Colors are in the cgramExpanded format, which means the math
+// can be done with saturating byte operations, and the output is already in the
+// right order. Returns the number of pixels drawn.
+static uint32 PpuDrawMathPixels(Ppu *ppu, uint32 *dst, uint32 i, uint32 right, uint32 clip_color_mask,
+                                uint32 math_enabled_cur, uint32 fixed_color) {
+  uint32 i_org = i;
+  uint32 clip_mask = clip_color_mask * 0x010101;
+  uint32 half_mask = ppu->halfColor ? 0xffffffff : 0;
+  const PpuZbufType *main_buf = ppu->bgBuffers[0].data, *sub_buf = ppu->bgBuffers[1].data;
+  uint32 c1[8], c2[8], half[8];
+#if defined(PPU_SIMD_SSE2)
+  __m128i zero = _mm_setzero_si128();
+  __m128i brightness = _mm_set1_epi16(ppu->lastBrightnessMult);
+#else
+  uint16x8_t brightness = vdupq_n_u16(ppu->lastBrightnessMult);
+#endif
+  for (; right - i >= 8; i += 8, dst += 8) {
+    for (int k = 0; k < 8; k++) {
+      uint32 m = main_buf[i + k];
+      c1[k] = ppu->cgramExpanded[m & 0xff] & clip_mask;
+      c2[k] = half[k] = 0;
+      if (math_enabled_cur & (1 << (m >> 8 & 0xf))) {
+        if (math_enabled_cur & 0x100) {  // addSubscreen ?
+          uint32 s = sub_buf[i + k] & 0xff;
+          // Don't halve if ppu->addSubscreen && backdrop
+          c2[k] = s ? ppu->cgramExpanded[s] : fixed_color;
+          half[k] = s ? half_mask : 0;
+        } else {
+          c2[k] = fixed_color;
+          half[k] = half_mask;
+        }
+      }
+    }
+#if defined(PPU_SIMD_SSE2)
+    for (int k = 0; k < 8; k += 4) {
+      __m128i a = _mm_loadu_si128((__m128i *)&c1[k]);
+      __m128i b = _mm_loadu_si128((__m128i *)&c2[k]);
+      __m128i h = _mm_loadu_si128((__m128i *)&half[k]);
+      // Components without math have 0 in b, so add/sub leaves them alone.
+      a = (math_enabled_cur & 0x200) ? _mm_subs_epu8(a, b) : _mm_add_epi8(a, b);
+      __m128i halved = _mm_and_si128(_mm_srli_epi16(a, 1), _mm_set1_epi8(0x7f));
+      a = _mm_or_si128(_mm_and_si128(h, halved), _mm_andnot_si128(h, a));
+      a = _mm_min_epu8(a, _mm_set1_epi8(31));
+      // brightnessMult: ((x << 3) | (x >> 2)) * brightness / 15, where
+      // n / 15 == (n * 0x8889) >> 19 for all n that can occur.
+      __m128i lo = _mm_unpacklo_epi8(a, zero), hi = _mm_unpackhi_epi8(a, zero);
+      lo = _mm_mullo_epi16(_mm_or_si128(_mm_slli_epi16(lo, 3), _mm_srli_epi16(lo, 2)), brightness);
+      hi = _mm_mullo_epi16(_mm_or_si128(_mm_slli_epi16(hi, 3), _mm_srli_epi16(hi, 2)), brightness);
+      lo = _mm_srli_epi16(_mm_mulhi_epu16(lo, _mm_set1_epi16((short)0x8889)), 3);
+      hi = _mm_srli_epi16(_mm_mulhi_epu16(hi, _mm_set1_epi16((short)0x8889)), 3);
+      _mm_storeu_si128((__m128i *)&dst[k], _mm_packus_epi16(lo, hi));
+    }
+#else
+    for (int k = 0; k < 8; k += 4) {
+      uint8x16_t a = vreinterpretq_u8_u32(vld1q_u32(&c1[k]));
+      uint8x16_t b = vreinterpretq_u8_u32(vld1q_u32(&c2[k]));
+      uint8x16_t h = vreinterpretq_u8_u32(vld1q_u32(&half[k]));
+      a = (math_enabled_cur & 0x200) ? vqsubq_u8(a, b) : vaddq_u8(a, b);
+      a = vbslq_u8(h, vshrq_n_u8(a, 1), a);
+      a = vminq_u8(a, vdupq_n_u8(31));
+      uint16x8_t lo = vmovl_u8(vget_low_u8(a)), hi = vmovl_u8(vget_high_u8(a));
+      lo = vmulq_u16(vorrq_u16(vshlq_n_u16(lo, 3), vshrq_n_u16(lo, 2)), brightness);
+      hi = vmulq_u16(vorrq_u16(vshlq_n_u16(hi, 3), vshrq_n_u16(hi, 2)), brightness);
+      lo = vshrq_n_u16(vcombine_u16(vshrn_n_u32(vmull_n_u16(vget_low_u16(lo), 0x8889), 16),
+                                    vshrn_n_u32(vmull_n_u16(vget_high_u16(lo), 0x8889), 16)), 3);
+      hi = vshrq_n_u16(vcombine_u16(vshrn_n_u32(vmull_n_u16(vget_low_u16(hi), 0x8889), 16),
+                                    vshrn_n_u32(vmull_n_u16(vget_high_u16(hi), 0x8889), 16)), 3);
+      vst1q_u32(&dst[k], vreinterpretq_u32_u8(vcombine_u8(vmovn_u16(lo), vmovn_u16(hi))));
+    }
+#endif
+  }
+  return i - i_org;
+}
+#endif  // defined(PPU_SIMD_SSE2) || defined(PPU_SIMD_NEON)
+
 static NOINLINE void PpuDrawWholeLine(Ppu *ppu, uint y) {
   if (ppu->forcedBlank) {
     uint8 *dst = &ppu->renderBuffer[(y - 1) * ppu->renderPitch];
@@ -907,6 +1241,12 @@ static NOINLINE void PpuDrawWholeLine(Ppu *ppu, uint y) {
       math_enabled_cur |= ppu->addSubscreen << 8 | ppu->subtractColor << 9;
       // Need to check for each pixel whether to use math or not based on the main screen layer.
       uint32 i = left;
+#if defined(PPU_SIMD_SSE2) || defined(PPU_SIMD_NEON)
+      uint32 n = PpuDrawMathPixels(ppu, dst, i, right, clip_color_mask, math_enabled_cur, PpuExpandColor(fixed_color));
+      i += n, dst += n;
+      if (i == right)
+        continue;
+#endif
       do {
         uint32 color = ppu->cgram[ppu->bgBuffers[0].data[i] & 0xff], color2;
         uint8 main_layer = (ppu->bgBuffers[0].data[i] >> 8) & 0xf;
@@ -1236,11 +1576,49 @@ static bool ppu_getWindowState(Ppu* ppu, int layer, int x) {
   return test1 || test2;
 }
 
+// Bucket the visible sprites by the lines they cover, so each line only
+// needs to look at the sprites that are on it.
+static void PpuBuildLineSprites(Ppu *ppu) {
+  uint8 spriteSizes[2] = { kSpriteSizes[ppu->objSize][0], kSpriteSizes[ppu->objSize][1] };
+  int extra_left_right = ppu->extraLeftRight;
+  uint8 visible[128], sizes[128];
+  int num_visible = 0;
+  uint16 *start = ppu->lineSpritesStart;
+  memset(start, 0, sizeof(ppu->lineSpritesStart));
+
+  for (int index = 0; index < 0x100; index += 2) {
+    int yy = ppu->oam[index] >> 8;
+    if (yy == 0xf0)
+      continue;  // this works for zelda because sprites are always 8 or 16.
+    int highOam = ppu->oam[0x100 + (index >> 4)] >> (index & 15);
+    int spriteSize = spriteSizes[(highOam >> 1) & 1];
+    // get the x location, using the high bit as well
+    int x = (ppu->oam[index] & 0xff) + (highOam & 1) * 256;
+    x -= (x >= 256 + extra_left_right) * 512;
+    // if in x-range
+    if (x <= -(spriteSize + extra_left_right))
+      continue;
+    visible[num_visible] = index;
+    sizes[num_visible++] = spriteSize;
+    for (int row = 0; row < spriteSize; row++)
+      start[((yy + row) & 0xff) + 1]++;
+  }
+  for (int i = 0; i < 256; i++)
+    start[i + 1] += start[i];
+  uint16 pos[256];
+  memcpy(pos, start, sizeof(pos));
+  for (int i = 0; i < num_visible; i++) {
+    int yy = ppu->oam[visible[i]] >> 8;
+    for (int row = 0; row < sizes[i]; row++)
+      ppu->lineSprites[pos[(yy + row) & 0xff]++] = visible[i];
+  }
+  ppu->lineSpritesValid = true;
+}
+
 static bool ppu_evaluateSprites(Ppu* ppu, int line) {
   // TODO: iterate over oam normally to determine in-range sprites,
   //   then iterate those in-range sprites in reverse for tile-fetching
   // TODO: rectangular sprites, wierdness with sprites at -256
-  int index = 0, index_end = index;
   int spritesLeft = 32 + 1, tilesLeft = 34 + 1;
   uint8 spriteSizes[2] = { kSpriteSizes[ppu->objSize][0], kSpriteSizes[ppu->objSize][1] };
   int extra_left_right = ppu->extraLeftRight;
@@ -1248,22 +1626,19 @@ static bool ppu_evaluateSprites(Ppu* ppu, int line) {
     spritesLeft = tilesLeft = 1024;
   int tilesLeftOrg = tilesLeft;
 
-  do {
+  if (!ppu->lineSpritesValid)
+    PpuBuildLineSprites(ppu);
+  const uint8 *cur = ppu->lineSprites + ppu->lineSpritesStart[line & 0xff];
+  const uint8 *end = ppu->lineSprites + ppu->lineSpritesStart[(line & 0xff) + 1];
+
+  for (; cur != end; cur++) {
+    int index = *cur;
     int yy = ppu->oam[index] >> 8;
-    if (yy == 0xf0)
-      continue;  // this works for zelda because sprites are always 8 or 16.
-    // check if the sprite is on this line and get the sprite size
     int row = (line - yy) & 0xff;
     int highOam = ppu->oam[0x100 + (index >> 4)] >> (index & 15);
     int spriteSize = spriteSizes[(highOam >> 1) & 1];
-    if (row >= spriteSize)
-      continue;
-    // in y-range, get the x location, using the high bit as well
     int x = (ppu->oam[index] & 0xff) + (highOam & 1) * 256;
     x -= (x >= 256 + extra_left_right) * 512;
-    // if in x-range
-    if (x <= -(spriteSize + extra_left_right))
-      continue;
     // break if we found 32 sprites already
     if (--spritesLeft == 0) {
       break;
@@ -1304,7 +1679,7 @@ static bool ppu_evaluateSprites(Ppu* ppu, int line) {
         }
       }
     }
-  } while ((index = (index + 2) & 0xff) != index_end);
+  }
   return (tilesLeft != tilesLeftOrg);
 }
 
@@ -1329,6 +1704,8 @@ void ppu_write(Ppu* ppu, uint8_t adr, uint8_t val) {
     }
     case 0x01: {
       assert(val == 2);
+      // The line buckets depend on the sprite sizes
+      ppu->lineSpritesValid = false;
       break;
     }
     case 0x02: {
@@ -1348,6 +1725,7 @@ void ppu_write(Ppu* ppu, uint8_t adr, uint8_t val) {
       } else {
         if (ppu->oamAdr < 0x110)
           ppu->oam[ppu->oamAdr++] = (val << 8) | ppu->oamBuffer;
+        ppu->lineSpritesValid = false;
       }
       ppu->oamSecondWrite = !ppu->oamSecondWrite;
       break;
@@ -1432,12 +1810,14 @@ void ppu_write(Ppu* ppu, uint8_t adr, uint8_t val) {
     case 0x18: {  // VMDATAL
       uint16_t vramAdr = ppu->vramPointer;
       ppu->vram[vramAdr & 0x7fff] = (ppu->vram[vramAdr & 0x7fff] & 0xff00) | val;
+      PpuMarkVramDirty(ppu, vramAdr, 1);
       if(!ppu->vramIncrementOnHigh) ppu->vramPointer += ppu->vramIncrement;
       break;
     }
     case 0x19: {  // VMDATAH
       uint16_t vramAdr = ppu->vramPointer;
       ppu->vram[vramAdr & 0x7fff] = (ppu->vram[vramAdr & 0x7fff] & 0x00ff) | (val << 8);
+      PpuMarkVramDirty(ppu, vramAdr, 1);
       if(ppu->vramIncrementOnHigh) ppu->vramPointer += ppu->vramIncrement;
       break;
     }
@@ -1472,6 +1852,7 @@ void ppu_write(Ppu* ppu, uint8_t adr, uint8_t val) {
       if(!ppu->cgramSecondWrite) {
         ppu->cgramBuffer = val;
       } else {
+        ppu->cgramExpanded[ppu->cgramPointer] = PpuExpandColor((val << 8) | ppu->cgramBuffer);
         ppu->cgram[ppu->cgramPointer++] = (val << 8) | ppu->cgramBuffer;
       }
       ppu->cgramSecondWrite = !ppu->cgramSecondWrite;
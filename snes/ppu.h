@@ -42,8 +42,26 @@ enum {
   kPpuRenderFlags_Height240 = 4,
   // Disable sprite render limits
   kPpuRenderFlags_NoSpriteLimits = 8,
+  // Reuse decoded background rows between frames when vram didn't change
+  kPpuRenderFlags_BgRowCache = 16,
 };
 
+enum {
+  // vram writes are tracked in pages of 1KB
+  kPpuVramPageShift = 9,
+  kPpuVramPages = 0x8000 >> kPpuVramPageShift,
+};
+
+typedef struct PpuBgCache PpuBgCache;
+
+
+// A register write done by hdma or irq during the frame, used to
+// render bands of lines in parallel.
+typedef struct PpuRegWrite {
+  uint8 line;  // the write happens before this line is drawn
+  uint8 adr;
+  uint8 val;
+} PpuRegWrite;
 
 struct Ppu {
   bool lineHasSprites;
@@ -122,9 +140,23 @@ struct Ppu {
   uint16_t cgram[0x100];
   uint8_t mosaicModulo[kPpuXPixels];
   uint32_t colorMapRgb[256];
+  // cgram with the 5 bit components in separate bytes, ordered like the output pixels
+  uint32_t cgramExpanded[256];
+  // Bumped on each vram write, in total and per page
+  uint32_t vramWrites;
+  uint32_t vramPageWrites[kPpuVramPages];
   PpuPixelPrioBufs bgBuffers[2];
   PpuPixelPrioBufs objBuffer;
-  uint16_t vram[0x8000];
+  // Not part of the render state, each Ppu has its own
+  PpuBgCache *bgCache;
+  // Points at vramData, or at the read-only vram of another Ppu, see ppu_copyRenderStateShared.
+  uint16_t *vram;
+  // Oam indexes of the sprites on each line (mod 256), in oam order.
+  // Rebuilt on the first line drawn after oam changes.
+  bool lineSpritesValid;
+  uint16_t lineSpritesStart[256 + 1];
+  uint8_t lineSprites[128 * 64];
+  uint16_t vramData[0x8000];
 };
 
 Ppu* ppu_init(void);
@@ -132,6 +164,12 @@ void ppu_free(Ppu* ppu);
 void ppu_reset(Ppu* ppu);
 void ppu_handleVblank(Ppu* ppu);
 void ppu_runLine(Ppu* ppu, int line);
+void ppu_runLines(Ppu *ppu, const PpuRegWrite *writes, size_t num_writes, int line_start, int line_end);
+void ppu_copyRenderState(Ppu *dst, const Ppu *src);
+// Same, but dst reads the vram of src instead of a copy. src must outlive the
+// drawing and dst must not write to vram.
+void ppu_copyRenderStateShared(Ppu *dst, Ppu *src);
+void ppu_freeBgCache(Ppu *ppu);
 uint8_t ppu_read(Ppu* ppu, uint8_t adr);
 void ppu_write(Ppu* ppu, uint8_t adr, uint8_t val);
 void ppu_saveload(Ppu *ppu, SaveLoadFunc *func, void *ctx);
@@ -142,5 +180,7 @@ int PpuGetCurrentRenderScale(Ppu *ppu, uint32_t render_flags);
 
 void PpuSetMode7PerspectiveCorrection(Ppu *ppu, int low, int high);
 void PpuSetExtraSideSpace(Ppu *ppu, int left, int right, int bottom);
+// Must be called after writing to vram directly instead of through ppu_write
+void PpuMarkVramDirty(Ppu *ppu, uint32 addr, uint32 num_words);
 
 #endif  // ZELDA3_SNES_PPU_H_
@@ -11,6 +11,7 @@
 #include "dungeon.h"
 #include "sprite_main.h"
 #include "assets.h"
+#include "profiler.h"
 
 static const uint8 kAncilla_Pflags[68] = {
   0,    8,  0xc, 0x10, 0x10,    4, 0x10, 0x18,    8,    8,    8,    0, 0x14, 0, 0x10, 0x28,
@@ -617,8 +618,10 @@ void SomariaBlock_SpawnBullets(int k) {  // 8881a7
 }
 
 void Ancilla_Main() {  // 888242
+  uint64 prof = Profiler_Begin();
   Ancilla_WeaponTink();
   Ancilla_ExecuteAll();
+  Profiler_End(kProfZone_Ancillas, prof);
 }
 
 ProjectSpeedRet Ancilla_ProjectReflexiveSpeedOntoSprite(int k, uint16 x, uint16 y, uint8 vel) {  // 88824d
@@ -674,7 +677,9 @@ void Ancilla_ExecuteOne(uint8 type, int k) {  // 88833c
   if (submodule_index == 0 && ancilla_timer[k] != 0)
     ancilla_timer[k]--;
 
+  uint64 prof = Profiler_Begin();
   kAncilla_Funcs[type - 1](k);
+  Profiler_EndObject(kProfObj_Ancilla, type, prof);
 }
 
 void Ancilla13_IceRodSparkle(int k) {  // 888435
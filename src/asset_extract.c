@@ -1,5 +1,7 @@
 #include "asset_extract.h"
 #include "util.h"
+#include "thread_pool.h"
+#include <SDL.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -2058,6 +2060,59 @@ static bool write_asset_file(AssetList *a, const char *output_path) {
   return true;
 }
 
+// ================================================================
+//  Parallel extraction
+// ================================================================
+
+typedef void ExtractFunc(AssetList *a);
+
+// In the order of the assets in the file. The extractors only read the ROM,
+// so they run in parallel, each one into its own list.
+static ExtractFunc *const kExtractors[] = {
+  extract_sound_banks,          // 0-2
+  extract_dungeon_rooms,        // 3-55
+  extract_enemy_damage,         // 56
+  extract_link_graphics,        // 57
+  extract_dungeon_sprites,      // 58-59
+  extract_map32_to_map16,       // 60-63
+  extract_sprite_gfx,           // 64
+  extract_bg_gfx,               // 65
+  extract_misc,                 // 66-93
+  extract_dialogue,             // 94-96
+  extract_dungeon_map,          // 97-98
+  extract_tilemaps,             // 99-104
+  extract_overworld_compressed, // 105-106
+  extract_overworld_tables,     // 107-164
+};
+
+static void RunExtractor(void *ctx, int i) {
+  kExtractors[i](&((AssetList *)ctx)[i]);
+}
+
+// Runs all extractors and moves their assets into |a| in order.
+static void extract_all(AssetList *a) {
+  AssetList *lists = (AssetList *)calloc(countof(kExtractors), sizeof(AssetList));
+  if (!lists) Die("memory allocation failed");
+  // The pool is shared with the renderer. Leave it with as many workers
+  // as it had before, so extracting doesn't keep idle threads around.
+  int old_threads = ThreadPool_GetNumThreads();
+  ThreadPool_Init(SDL_GetCPUCount() - 1);
+  ThreadPool_Run(&RunExtractor, lists, countof(kExtractors));
+  if (ThreadPool_GetNumThreads() != old_threads) {
+    ThreadPool_Shutdown();
+    ThreadPool_Init(old_threads);
+  }
+  for (int i = 0; i < countof(kExtractors); i++) {
+    AssetList *l = &lists[i];
+    if (a->count + l->count > MAX_ASSETS) Die("Too many assets");
+    memcpy(a->names + a->count, l->names, l->count * sizeof(l->names[0]));
+    memcpy(a->data + a->count, l->data, l->count * sizeof(l->data[0]));
+    memcpy(a->sizes + a->count, l->sizes, l->count * sizeof(l->sizes[0]));
+    a->count += l->count;
+  }
+  free(lists);
+}
+
 // ================================================================
 //  Public API
 // ================================================================
@@ -2092,20 +2147,7 @@ bool AssetExtract_BuildFromROM(const uint8 *rom, size_t rom_size,
   assets_init(&assets);
 
   // Extract all 165 assets in the correct order
-  extract_sound_banks(&assets);        // 0-2
-  extract_dungeon_rooms(&assets);      // 3-55
-  extract_enemy_damage(&assets);       // 56
-  extract_link_graphics(&assets);      // 57
-  extract_dungeon_sprites(&assets);    // 58-59
-  extract_map32_to_map16(&assets);     // 60-63
-  extract_sprite_gfx(&assets);        // 64
-  extract_bg_gfx(&assets);            // 65
-  extract_misc(&assets);               // 66-93
-  extract_dialogue(&assets);           // 94-96
-  extract_dungeon_map(&assets);        // 97-98
-  extract_tilemaps(&assets);           // 99-104
-  extract_overworld_compressed(&assets); // 105-106
-  extract_overworld_tables(&assets);   // 107-164
+  extract_all(&assets);
 
   if (assets.count != 165) {
     snprintf(g_error, sizeof(g_error),
@@ -1025,6 +1025,7 @@ void Attract_TriggerBGDMA(uint16 dstv) {  // 8cf879
     memcpy(dst, &g_ram[0x1006], 0x100);
     dst += 0x80;
   }
+  ZeldaMarkVramDirty(dstv, 8 * 0x80);
 }
 
 void Attract_DrawPreloadedSprite(const uint8 *xp, const uint8 *yp, const uint8 *cp, const uint8 *fp, const uint8 *ep, int n) {  // 8cf9b5
@@ -8,6 +8,10 @@
 #include "config.h"
 #include "assets.h"
 #include "spatial_audio.h"
+#include "spsc_ring.h"
+#include "profiler.h"
+#include "tracer.h"
+#include <SDL.h>
 
 // This needs to hold a lot more things than with just PCM
 typedef struct MsuPlayerResumeInfo {
@@ -27,22 +31,102 @@ enum {
   kMsuState_Playing = 3,
 };
 
+enum {
+  kMsuChunk_Samples = 960,
+  kMsuChunk_Count = 32,  // about 0.6 seconds of audio
+  kMsuCache_MaxTracks = 16,
+};
+
+enum {
+  kMsuEnd_None = 0,
+  kMsuEnd_Finished = 1,
+  kMsuEnd_Error = 2,
+};
+
+// Decoded audio going from the decoder thread to the audio callback, or a
+// marker that the track ended.
+typedef struct MsuChunk {
+  uint32 generation;
+  uint16 pos, size;  // the samples to play are [pos, size)
+  uint8 end;
+  MsuPlayerResumeInfo resume_info;  // where to resume when this starts playing
+  int16 samples[kMsuChunk_Samples * 2];
+} MsuChunk;
+
+// Tells the decoder thread what to decode next. A track of 0 stops it.
+typedef struct MsuCommand {
+  uint32 generation;
+  uint8 actual_track;
+  bool resuming;
+  bool opus;
+  uint32 repeat_position;
+  uint32 total_samples_in_file;
+  MsuPlayerResumeInfo resume_info;
+} MsuCommand;
+
+// The header of each track, read when msu is enabled so that starting a
+// track doesn't need to touch the disk.
+typedef struct MsuTrackInfo {
+  bool exists;
+  uint32 file_tag;
+  uint32 repeat_position;
+  uint32 file_size;
+} MsuTrackInfo;
+
 typedef struct MsuPlayer {
+  uint8 enabled;
+  uint8 state;
+  uint8 orig_track, actual_track;
+  uint32 generation;
+  // Shared with the audio callback, only changed with the apu lock held
+  bool playing, chunk_started;
+  uint32 buffer_pos;
+  MsuPlayerResumeInfo resume_info;
+  float volume, volume_step, volume_target;
+  // Set by the audio callback when a track ends, generation << 2 | kMsuEnd_*
+  SDL_atomic_t end_event;
+  MsuTrackInfo tracks[256];
+} MsuPlayer;
+
+// Reads from a track file, or from a copy of it in memory.
+typedef struct MsuStream {
   FILE *f;
-  uint32 buffer_size, buffer_pos;
+  const uint8 *data;
+  uint32 size, pos;
+} MsuStream;
+
+typedef struct MsuCacheEntry {
+  uint8 track;
+  uint8 *data;
+  uint32 size;
+  uint32 last_used;
+} MsuCacheEntry;
+
+typedef struct MsuDecoder {
+  SDL_Thread *thread;
+  SDL_sem *wakeup;
+  SDL_atomic_t quit;
+  SpscRing *commands, *chunks;
+  // The rest is only touched by the decoder thread
+  MsuStream stream;
+  OpusDecoder *opus;
+  bool active, resuming, has_pending;
+  uint32 generation;
+  uint8 actual_track;
   uint32 preskip, samples_until_repeat;
   uint32 total_samples_in_file, repeat_position;
   uint32 cur_file_offs;
-  MsuPlayerResumeInfo resume_info;
-  uint8 enabled;
-  uint8 state;
-  float volume, volume_step, volume_target;
   uint16 range_cur, range_repeat;
-  OpusDecoder *opus;
-  int16 buffer[960 * 2];
-} MsuPlayer;
+  MsuPlayerResumeInfo resume_info;
+  MsuChunk pending;
+  uint8 packet[1280];
+  size_t cache_budget, cache_used;
+  uint32 cache_clock;
+  MsuCacheEntry cache[kMsuCache_MaxTracks];
+} MsuDecoder;
 
 static MsuPlayer g_msu_player;
+static MsuDecoder g_msu_decoder;
 
 static void MsuPlayer_Open(MsuPlayer *mp, int orig_track, bool resume_from_snapshot);
 
@@ -103,7 +187,7 @@ static uint8 RemapMsuDeluxeTrack(MsuPlayer *mp, uint8 track) {
 bool ZeldaIsPlayingMusicTrack(uint8 track) {
   MsuPlayer *mp = &g_msu_player;
   if (mp->state != kMsuState_Idle && mp->enabled & kMsuEnabled_MsuDeluxe)
-    return RemapMsuDeluxeTrack(mp, track) == mp->resume_info.actual_track;
+    return RemapMsuDeluxeTrack(mp, track) == mp->actual_track;
   else
     return track == music_unk1;
 }
@@ -111,7 +195,7 @@ bool ZeldaIsPlayingMusicTrack(uint8 track) {
 bool ZeldaIsPlayingMusicTrackWithBug(uint8 track) {
   MsuPlayer *mp = &g_msu_player;
   if (mp->state != kMsuState_Idle && mp->enabled & kMsuEnabled_MsuDeluxe)
-    return RemapMsuDeluxeTrack(mp, track) == mp->resume_info.actual_track;
+    return RemapMsuDeluxeTrack(mp, track) == mp->actual_track;
   else
     return track == (enhanced_features0 & kFeatures0_MiscBugFixes ? music_unk1 : last_music_control);
 }
@@ -158,15 +242,26 @@ void ZeldaPlayMsuAudioTrack(uint8 music_ctrl) {
   ZeldaApuUnlock();
 }
 
-static void MsuPlayer_CloseFile(MsuPlayer *mp) {
-  if (mp->f)
-    fclose(mp->f);
-  opus_decoder_destroy(mp->opus);
-  mp->opus = NULL;
-  mp->f = NULL;
+static void MsuTrackFilename(char *buf, size_t size, int track, uint8 enabled) {
+  snprintf(buf, size, "%s%d.%s", g_config.msu_path ? g_config.msu_path : "", track, enabled & kMsuEnabled_Opuz ? "opuz" : "pcm");
+}
+
+static void MsuPlayer_SendCommand(MsuPlayer *mp, MsuCommand *cmd) {
+  MsuDecoder *d = &g_msu_decoder;
+  cmd->generation = ++mp->generation;
+  if (!SpscRing_Push(d->commands, cmd))
+    fprintf(stderr, "MSU decoder is not responding!\n");
+  SDL_SemPost(d->wakeup);
+}
+
+static void MsuPlayer_Stop(MsuPlayer *mp) {
+  mp->playing = false;
   if (mp->state != kMsuState_FinishedPlaying)
     mp->state = kMsuState_Idle;
+  mp->actual_track = 0;
   memset(&mp->resume_info, 0, sizeof(mp->resume_info));
+  MsuCommand cmd = { 0 };
+  MsuPlayer_SendCommand(mp, &cmd);
 }
 
 static void MsuPlayer_Open(MsuPlayer *mp, int orig_track, bool resume_from_snapshot) {
@@ -190,23 +285,20 @@ static void MsuPlayer_Open(MsuPlayer *mp, int orig_track, bool resume_from_snaps
   mp->volume_step = kVolumeTransitionStepFloat[3];
 
   mp->state = kMsuState_Idle;
-  MsuPlayer_CloseFile(mp);
+  MsuPlayer_Stop(mp);
   if (actual_track == 0)
     return;
-  char fname[256], buf[8];
-  snprintf(fname, sizeof(fname), "%s%d.%s", g_config.msu_path ? g_config.msu_path : "", actual_track, mp->enabled & kMsuEnabled_Opuz ? "opuz" : "pcm");
+  char fname[256];
+  MsuTrackFilename(fname, sizeof(fname), actual_track, mp->enabled);
   printf("Loading MSU %s\n", fname);
-  mp->f = fopen(fname, "rb");
-  if (mp->f == NULL)
-    goto READ_ERROR;
-  setvbuf(mp->f, NULL, _IOFBF, 16384);
-  if (fread(buf, 1, 8, mp->f) != 8) READ_ERROR: {
+  // The header was read up front, the decoder thread opens the file.
+  const MsuTrackInfo *info = &mp->tracks[actual_track];
+  uint32 file_tag = info->file_tag;
+  bool opus = (file_tag == (('Z' << 24) | ('U' << 16) | ('P' << 8) | 'O'));
+  if (!info->exists || !opus && file_tag != (('1' << 24) | ('U' << 16) | ('S' << 8) | 'M')) {
     fprintf(stderr, "Unable to read MSU file %s\n", fname);
-    MsuPlayer_CloseFile(mp);
     return;
   }
-  uint32 file_tag = *(uint32 *)(buf + 0);
-  mp->repeat_position = *(uint32 *)(buf + 4);
   mp->state = (resume.actual_track == actual_track && resume.tag == file_tag) ? kMsuState_Resuming : kMsuState_Playing;
   if (mp->state == kMsuState_Resuming) {
     memcpy(&mp->resume_info, &resume, sizeof(mp->resume_info));
@@ -216,26 +308,332 @@ static void MsuPlayer_Open(MsuPlayer *mp, int orig_track, bool resume_from_snaps
     mp->resume_info.tag = file_tag;
     mp->resume_info.range_cur = 8;
   }
-  mp->cur_file_offs = mp->resume_info.offset;
-  mp->samples_until_repeat = mp->resume_info.samples_until_repeat;
-  mp->range_cur = mp->resume_info.range_cur;
-  mp->range_repeat = mp->resume_info.range_repeat;
-  mp->buffer_size = mp->buffer_pos = 0;
-  mp->preskip = 0;
-  if (file_tag == (('Z' << 24) | ('U' << 16) | ('P' << 8) | 'O')) {
-    mp->opus = opus_decoder_create(48000, 2, NULL);
-    if (!mp->opus)
+  mp->orig_track = mp->resume_info.orig_track;
+  mp->actual_track = actual_track;
+  mp->playing = true;
+  mp->chunk_started = false;
+
+  MsuCommand cmd = {
+    .actual_track = actual_track,
+    .resuming = (mp->state == kMsuState_Resuming),
+    .opus = opus,
+    .repeat_position = info->repeat_position,
+    .total_samples_in_file = (info->file_size - 8) / 4,
+    .resume_info = mp->resume_info,
+  };
+  MsuPlayer_SendCommand(mp, &cmd);
+}
+
+// Picks up tracks that ended in the audio callback. Runs on the game thread.
+static void MsuPlayer_PollEnd(MsuPlayer *mp) {
+  if (SDL_AtomicGet(&mp->end_event) == 0)
+    return;
+  ZeldaApuLock();
+  uint32 ev = (uint32)SDL_AtomicSet(&mp->end_event, 0);
+  if ((ev >> 2) == (mp->generation & 0x3fffffff) && !mp->playing) {
+    if ((ev & 3) == kMsuEnd_Error) {
+      zelda_apu_write(APUI00, mp->orig_track);
+      mp->state = kMsuState_Idle;
+    } else {
+      mp->state = kMsuState_FinishedPlaying;
+    }
+    mp->actual_track = 0;
+  }
+  ZeldaApuUnlock();
+}
+
+static void MsuPlayer_ReadTrackHeaders(MsuPlayer *mp) {
+  for (int i = 1; i < countof(mp->tracks); i++) {
+    MsuTrackInfo *info = &mp->tracks[i];
+    char fname[256];
+    uint32 buf[2];
+    memset(info, 0, sizeof(*info));
+    MsuTrackFilename(fname, sizeof(fname), i, mp->enabled);
+    FILE *f = fopen(fname, "rb");
+    if (f == NULL)
+      continue;
+    if (fread(buf, 1, 8, f) == 8 && fseek(f, 0, SEEK_END) == 0) {
+      info->exists = true;
+      info->file_tag = buf[0];
+      info->repeat_position = buf[1];
+      info->file_size = ftell(f);
+    }
+    fclose(f);
+  }
+}
+
+static uint32 MsuStream_Read(MsuStream *s, void *dst, uint32 n) {
+  if (s->f)
+    return (uint32)fread(dst, 1, n, s->f);
+  n = UintMin(n, s->size - s->pos);
+  memcpy(dst, s->data + s->pos, n);
+  s->pos += n;
+  return n;
+}
+
+static void MsuStream_Seek(MsuStream *s, uint32 pos) {
+  if (s->f)
+    fseek(s->f, pos, SEEK_SET);
+  else
+    s->pos = UintMin(pos, s->size);
+}
+
+static void MsuStream_Close(MsuStream *s) {
+  if (s->f)
+    fclose(s->f);
+  memset(s, 0, sizeof(*s));
+}
+
+// Keeps whole track files in memory so that tracks that play often, like the
+// overworld themes, never wait for the disk. The least recently used are
+// dropped when over budget.
+static const uint8 *MsuDecoder_AddToCache(MsuDecoder *d, uint8 track, uint8 *data, uint32 size) {
+  for (;;) {
+    MsuCacheEntry *oldest = NULL, *free_entry = NULL;
+    for (int i = 0; i < kMsuCache_MaxTracks; i++) {
+      MsuCacheEntry *e = &d->cache[i];
+      if (e->data == NULL)
+        free_entry = e;
+      else if (oldest == NULL || e->last_used < oldest->last_used)
+        oldest = e;
+    }
+    if (free_entry && d->cache_used + size <= d->cache_budget) {
+      free_entry->track = track;
+      free_entry->data = data;
+      free_entry->size = size;
+      free_entry->last_used = ++d->cache_clock;
+      d->cache_used += size;
+      return data;
+    }
+    if (oldest == NULL)
+      return NULL;
+    d->cache_used -= oldest->size;
+    free(oldest->data);
+    oldest->data = NULL;
+  }
+}
+
+static bool MsuDecoder_OpenStream(MsuDecoder *d, uint8 track, bool opus) {
+  for (int i = 0; i < kMsuCache_MaxTracks; i++) {
+    MsuCacheEntry *e = &d->cache[i];
+    if (e->data && e->track == track) {
+      e->last_used = ++d->cache_clock;
+      d->stream.data = e->data;
+      d->stream.size = e->size;
+      return true;
+    }
+  }
+  char fname[256];
+  MsuTrackFilename(fname, sizeof(fname), track, opus ? kMsuEnabled_Opuz : 0);
+  FILE *f = fopen(fname, "rb");
+  if (f == NULL)
+    return false;
+  if (d->cache_budget != 0 && fseek(f, 0, SEEK_END) == 0) {
+    long size = ftell(f);
+    uint8 *data = (size > 0 && size <= d->cache_budget) ? malloc(size) : NULL;
+    fseek(f, 0, SEEK_SET);
+    if (data && fread(data, 1, size, f) == size && MsuDecoder_AddToCache(d, track, data, (uint32)size)) {
+      fclose(f);
+      d->stream.data = data;
+      d->stream.size = (uint32)size;
+      return true;
+    }
+    free(data);
+    fseek(f, 0, SEEK_SET);
+  }
+  setvbuf(f, NULL, _IOFBF, 16384);
+  d->stream.f = f;
+  return true;
+}
+
+static void MsuDecoder_Close(MsuDecoder *d) {
+  MsuStream_Close(&d->stream);
+  opus_decoder_destroy(d->opus);
+  d->opus = NULL;
+  d->active = false;
+}
+
+static void MsuDecoder_End(MsuDecoder *d, uint8 end) {
+  MsuDecoder_Close(d);
+  d->pending.generation = d->generation;
+  d->pending.pos = d->pending.size = 0;
+  d->pending.end = end;
+  d->has_pending = true;
+}
+
+static void MsuDecoder_Start(MsuDecoder *d, const MsuCommand *cmd) {
+  MsuDecoder_Close(d);
+  d->has_pending = false;
+  d->generation = cmd->generation;
+  if (cmd->actual_track == 0)
+    return;
+  if (!MsuDecoder_OpenStream(d, cmd->actual_track, cmd->opus)) READ_ERROR: {
+    fprintf(stderr, "MSU read/decode error!\n");
+    MsuDecoder_End(d, kMsuEnd_Error);
+    return;
+  }
+  d->active = true;
+  d->resuming = cmd->resuming;
+  d->actual_track = cmd->actual_track;
+  d->resume_info = cmd->resume_info;
+  d->repeat_position = cmd->repeat_position;
+  d->total_samples_in_file = cmd->total_samples_in_file;
+  d->cur_file_offs = d->resume_info.offset;
+  d->samples_until_repeat = d->resume_info.samples_until_repeat;
+  d->range_cur = d->resume_info.range_cur;
+  d->range_repeat = d->resume_info.range_repeat;
+  d->preskip = 0;
+  if (cmd->opus) {
+    d->opus = opus_decoder_create(48000, 2, NULL);
+    if (!d->opus)
       goto READ_ERROR;
-    if (mp->state == kMsuState_Resuming)
-      fseek(mp->f, mp->cur_file_offs, SEEK_SET);
-  } else if (file_tag == (('1' << 24) | ('U' << 16) | ('S' << 8) | 'M')) {
-    fseek(mp->f, 0, SEEK_END);
-    mp->total_samples_in_file = (ftell(mp->f) - 8) / 4;
-    mp->samples_until_repeat = mp->total_samples_in_file - mp->cur_file_offs;
-    fseek(mp->f, mp->cur_file_offs * 4 + 8, SEEK_SET);
+    if (d->resuming)
+      MsuStream_Seek(&d->stream, d->cur_file_offs);
+  } else {
+    d->samples_until_repeat = d->total_samples_in_file - d->cur_file_offs;
+    MsuStream_Seek(&d->stream, d->cur_file_offs * 4 + 8);
+  }
+}
+
+// Decodes the next block of samples into |d->pending|.
+static void MsuDecoder_Decode(MsuDecoder *d) {
+  MsuChunk *c = &d->pending;
+  int r;
+  if (d->opus != NULL) {
+    if (d->samples_until_repeat == 0) {
+      if (d->range_cur == 0) FINISHED_PLAYING: {
+        MsuDecoder_End(d, kMsuEnd_Finished);
+        return;
+      }
+      opus_decoder_ctl(d->opus, OPUS_RESET_STATE);
+      MsuStream_Seek(&d->stream, d->range_cur);
+      uint8 *file_data = d->packet;
+      if (MsuStream_Read(&d->stream, file_data, 10) != 10) READ_ERROR: {
+        fprintf(stderr, "MSU read/decode error!\n");
+        MsuDecoder_End(d, kMsuEnd_Error);
+        return;
+      }
+      uint32 file_offs = *(uint32 *)&file_data[0];
+      assert((file_offs & 0xF0000000) == 0);
+      uint32 samples_until_repeat = *(uint32 *)&file_data[4];
+      uint16 preskip = *(uint32 *)&file_data[8];
+      d->samples_until_repeat = samples_until_repeat;
+      d->preskip = preskip & 0x3fff;
+      if (preskip & 0x4000)
+        d->range_repeat = d->range_cur;
+      d->range_cur = (preskip & 0x8000) ? d->range_repeat : d->range_cur + 10;
+      d->cur_file_offs = file_offs;
+      d->resume_info.range_repeat = d->range_repeat;
+      d->resume_info.range_cur = d->range_cur;
+      MsuStream_Seek(&d->stream, file_offs);
+    }
+    assert(d->samples_until_repeat != 0);
+    for (;;) {
+      uint8 *file_data = d->packet;
+      *(uint64 *)file_data = 0;
+      if (MsuStream_Read(&d->stream, file_data, 2) != 2)
+        goto READ_ERROR;
+      int size = *(uint16 *)file_data & 0x7fff;
+      if (size > 1275)
+        goto READ_ERROR;
+      int n = (*(uint16 *)file_data >> 15);
+      if (MsuStream_Read(&d->stream, &file_data[2], size) != size)
+        goto READ_ERROR;
+      // Verify if the snapshot matches the file on disk.
+      uint64 initial_file_data = *(uint64 *)file_data;
+      if (d->resuming) {
+        d->resuming = false;
+        if (d->resume_info.initial_packet_bytes != initial_file_data)
+          goto READ_ERROR;
+      }
+      d->resume_info.initial_packet_bytes = initial_file_data;
+      d->resume_info.samples_until_repeat = d->samples_until_repeat + d->preskip;
+      d->resume_info.offset = d->cur_file_offs;
+      d->cur_file_offs += 2 + size;
+      file_data[1] = 0xfc;
+      r = opus_decode(d->opus, &file_data[2 - n], size + n, c->samples, kMsuChunk_Samples, 0);
+      if (r <= 0)
+        goto READ_ERROR;
+      if (r > d->preskip)
+        break;
+      d->preskip -= r;
+    }
   } else {
-    goto READ_ERROR;
+    if (d->samples_until_repeat == 0) {
+      if (d->actual_track < sizeof(kMsuTracksWithRepeat) && !kMsuTracksWithRepeat[d->actual_track])
+        goto FINISHED_PLAYING;
+      d->samples_until_repeat = d->total_samples_in_file - d->repeat_position;
+      if (d->samples_until_repeat == 0)
+        goto READ_ERROR; // impossible to make progress
+      d->cur_file_offs = d->repeat_position;
+      MsuStream_Seek(&d->stream, d->cur_file_offs * 4 + 8);
+    }
+    r = UintMin(kMsuChunk_Samples, d->samples_until_repeat);
+    if (MsuStream_Read(&d->stream, c->samples, r * 4) != r * 4)
+      goto READ_ERROR;
+    d->resume_info.offset = d->cur_file_offs;
+    d->cur_file_offs += r;
+  }
+  uint32 n = UintMin(r - d->preskip, d->samples_until_repeat);
+  d->samples_until_repeat -= n;
+  c->generation = d->generation;
+  c->pos = d->preskip;
+  c->size = d->preskip + n;
+  c->end = kMsuEnd_None;
+  c->resume_info = d->resume_info;
+  d->preskip = 0;
+  d->has_pending = true;
+}
+
+// Keeps the chunk queue full so the audio callback only has to mix.
+static int SDLCALL MsuDecoder_Thread(void *arg) {
+  MsuDecoder *d = (MsuDecoder *)arg;
+  while (!SDL_AtomicGet(&d->quit)) {
+    MsuCommand cmd;
+    while (SpscRing_Pop(d->commands, &cmd))
+      MsuDecoder_Start(d, &cmd);
+    if (d->has_pending) {
+      if (SpscRing_Push(d->chunks, &d->pending)) {
+        d->has_pending = false;
+        continue;
+      }
+    } else if (d->active) {
+      MsuDecoder_Decode(d);
+      continue;
+    }
+    SDL_SemWaitTimeout(d->wakeup, 100);
   }
+  MsuDecoder_Close(d);
+  return 0;
+}
+
+static void MsuDecoder_Initialize(MsuDecoder *d, size_t cache_budget) {
+  if (d->thread)
+    return;
+  d->cache_budget = cache_budget;
+  d->commands = SpscRing_Create(sizeof(MsuCommand), 16);
+  d->chunks = SpscRing_Create(sizeof(MsuChunk), kMsuChunk_Count);
+  d->wakeup = SDL_CreateSemaphore(0);
+  if (!d->wakeup)
+    Die("No semaphore");
+  d->thread = SDL_CreateThread(&MsuDecoder_Thread, "msu", d);
+  if (!d->thread)
+    Die("Unable to create msu thread");
+}
+
+static void MsuDecoder_Shutdown(MsuDecoder *d) {
+  if (!d->thread)
+    return;
+  SDL_AtomicSet(&d->quit, 1);
+  SDL_SemPost(d->wakeup);
+  SDL_WaitThread(d->thread, NULL);
+  d->thread = NULL;
+  for (int i = 0; i < kMsuCache_MaxTracks; i++)
+    free(d->cache[i].data);
+  SpscRing_Destroy(d->commands);
+  SpscRing_Destroy(d->chunks);
+  SDL_DestroySemaphore(d->wakeup);
+  memset(d, 0, sizeof(*d));
 }
 
 static void MixToBufferWithVolume(int16 *dst, const int16 *src, size_t n, float volume) {
@@ -282,158 +680,173 @@ static void MixToBuffer(MsuPlayer *mp, int16 *dst, const int16 *src, uint32 n) {
   MixToBufferWithVolume(dst, src, n, mp->volume);
 }
 
+// Runs in the audio callback. Never waits for the decoder, if it falls behind
+// the music is silent until it catches up.
 void MsuPlayer_Mix(MsuPlayer *mp, int16 *audio_buffer, int audio_samples) {
-  int r;
-
-  do {
-    if (mp->buffer_size - mp->buffer_pos == 0) {
-      if (mp->opus != NULL) {
-        if (mp->samples_until_repeat == 0) {
-          if (mp->range_cur == 0) FINISHED_PLAYING: {
-            mp->state = kMsuState_FinishedPlaying;
-            MsuPlayer_CloseFile(mp);
-            return;
-          }
-          opus_decoder_ctl(mp->opus, OPUS_RESET_STATE);
-          fseek(mp->f, mp->range_cur, SEEK_SET);
-          uint8 *file_data = (uint8 *)mp->buffer;
-          if (fread(file_data, 1, 10, mp->f) != 10) READ_ERROR: {
-            fprintf(stderr, "MSU read/decode error!\n");
-            zelda_apu_write(APUI00, mp->resume_info.orig_track);
-            MsuPlayer_CloseFile(mp);
-            return;
-          }
-          uint32 file_offs = *(uint32 *)&file_data[0];
-          assert((file_offs & 0xF0000000) == 0);
-          uint32 samples_until_repeat = *(uint32 *)&file_data[4];
-          uint16 preskip = *(uint32 *)&file_data[8];
-          mp->samples_until_repeat = samples_until_repeat;
-          mp->preskip = preskip & 0x3fff;
-          if (preskip & 0x4000)
-            mp->range_repeat = mp->range_cur;
-          mp->range_cur = (preskip & 0x8000) ? mp->range_repeat : mp->range_cur + 10;
-          mp->cur_file_offs = file_offs;
-          mp->resume_info.range_repeat = mp->range_repeat;
-          mp->resume_info.range_cur = mp->range_cur;
-          fseek(mp->f, file_offs, SEEK_SET);
-        }
-        assert(mp->samples_until_repeat != 0);
-        for (;;) {
-          uint8 *file_data = (uint8 *)mp->buffer;
-          *(uint64 *)file_data = 0;
-          if (fread(file_data, 1, 2, mp->f) != 2)
-            goto READ_ERROR;
-          int size = *(uint16 *)file_data & 0x7fff;
-          if (size > 1275)
-            goto READ_ERROR;
-          int n = (*(uint16 *)file_data >> 15);
-          if (fread(&file_data[2], 1, size, mp->f) != size)
-            goto READ_ERROR;
-          // Verify if the snapshot matches the file on disk.
-          uint64 initial_file_data = *(uint64 *)file_data;
-          if (mp->state == kMsuState_Resuming) {
-            mp->state = kMsuState_Playing;
-            if (mp->resume_info.initial_packet_bytes != initial_file_data)
-              goto READ_ERROR;
-          }
-          mp->resume_info.initial_packet_bytes = initial_file_data;
-          mp->resume_info.samples_until_repeat = mp->samples_until_repeat + mp->preskip;
-          mp->resume_info.offset = mp->cur_file_offs;
-          mp->cur_file_offs += 2 + size;
-          file_data[1] = 0xfc;
-          r = opus_decode(mp->opus, &file_data[2 - n], size + n, mp->buffer, 960, 0);
-          if (r <= 0)
-            goto READ_ERROR;
-          if (r > mp->preskip)
-            break;
-          mp->preskip -= r;
-        }
-      } else {
-        if (mp->samples_until_repeat == 0) {
-          if (mp->resume_info.actual_track < sizeof(kMsuTracksWithRepeat) && !kMsuTracksWithRepeat[mp->resume_info.actual_track])
-            goto FINISHED_PLAYING;
-          mp->samples_until_repeat = mp->total_samples_in_file - mp->repeat_position;
-          if (mp->samples_until_repeat == 0)
-            goto READ_ERROR; // impossible to make progress
-          mp->cur_file_offs = mp->repeat_position;
-          fseek(mp->f, mp->cur_file_offs * 4 + 8, SEEK_SET);
-        }
-        r = UintMin(960, mp->samples_until_repeat);
-        if (fread(mp->buffer, 4, r, mp->f) != r)
-          goto READ_ERROR;
-        mp->resume_info.offset = mp->cur_file_offs;
-        mp->cur_file_offs += r;
-      }
-      uint32 n = UintMin(r - mp->preskip, mp->samples_until_repeat);
-      mp->samples_until_repeat -= n;
-      mp->buffer_pos = mp->preskip;
-      mp->buffer_size = mp->buffer_pos + n;
-      mp->preskip = 0;
+  MsuDecoder *d = &g_msu_decoder;
+  while (audio_samples != 0 && mp->playing) {
+    const MsuChunk *c = SpscRing_Peek(d->chunks);
+    if (c == NULL)
+      break;
+    if (c->generation != mp->generation) {
+      SpscRing_Skip(d->chunks);
+      SDL_SemPost(d->wakeup);
+      continue;
     }
-#if 0
-    if (mp->samples_to_play > 44100 * 5) {
-      mp->buffer_pos = mp->buffer_size;
+    if (!mp->chunk_started) {
+      mp->chunk_started = true;
+      mp->buffer_pos = c->pos;
+      mp->resume_info = c->resume_info;
+      if (c->end != kMsuEnd_None) {
+        mp->playing = false;
+        memset(&mp->resume_info, 0, sizeof(mp->resume_info));
+        SDL_AtomicSet(&mp->end_event, (int)(mp->generation << 2 | c->end));
+      }
     }
-#endif
-    int nr = IntMin(audio_samples, mp->buffer_size - mp->buffer_pos);
-    int16 *buf = mp->buffer + mp->buffer_pos * 2;
+    int nr = IntMin(audio_samples, c->size - mp->buffer_pos);
+    MixToBuffer(mp, audio_buffer, c->samples + mp->buffer_pos * 2, nr);
     mp->buffer_pos += nr;
-
-#if 0
-    static int t;
-    for (int i = 0; i < nr; i++) {
-      buf[i * 2 + 0] = buf[i * 2 + 1] = 5000 * sinf(2 * 3.1415 * t++ / 440);
-    }
-#endif
-    MixToBuffer(mp, audio_buffer, buf, nr);
-
-#if 0
-    static FILE *f;
-    if (!f)f = fopen("out.pcm", "wb");
-    fwrite(audio_buffer, 4, nr, f);
-    fflush(f);
-#endif
     audio_samples -= nr, audio_buffer += nr * 2;
-  } while (audio_samples != 0);
+    if (mp->buffer_pos == c->size) {
+      mp->chunk_started = false;
+      SpscRing_Skip(d->chunks);
+      SDL_SemPost(d->wakeup);
+    }
+  }
 }
 
-// Maintain a queue cause the snes and audio callback are not in sync.
-struct ApuWriteEnt {
+// Maintain a queue cause the snes and audio callback are not in sync. The game
+// thread pushes the port values at the end of each frame, and the audio thread
+// pops one for each frame of audio, so neither has to wait for the other.
+typedef struct ApuWriteEnt {
+  uint32 frame;  // which game frame wrote it
   uint8 ports[4];
-};
-static struct ApuWriteEnt g_apu_write_ents[16], g_apu_write;
-static uint8 g_apu_write_ent_pos, g_apu_write_count, g_apu_total_write;
+} ApuWriteEnt;
+
+typedef struct ZeldaAudioState {
+  // Held by the audio thread while it runs the spc player, and by the game
+  // thread while it replaces the whole audio state.
+  SDL_mutex *apu_mutex;
+  SpscRing *apu_write_ring;
+  ApuWriteEnt apu_write;
+  // Audio thread side: the frame after the last one that was popped, and the
+  // frame where the queued ports last differed from the current ones.
+  uint32 apu_next_frame, apu_last_change_frame;
+  // Ports going the other way, from the spc player to the game.
+  SDL_atomic_t apu_port_to_snes;
+  SDL_atomic_t audio_underruns;
+  // Frames dropped from the ring because the audio thread fell behind.
+  SDL_atomic_t audio_drops;
+} ZeldaAudioState;
+
+#define g_apu_write_ring (g_zenv.audio->apu_write_ring)
+#define g_apu_write (g_zenv.audio->apu_write)
+#define g_apu_next_frame (g_zenv.audio->apu_next_frame)
+#define g_apu_last_change_frame (g_zenv.audio->apu_last_change_frame)
+#define g_apu_port_to_snes (g_zenv.audio->apu_port_to_snes)
+#define g_audio_underruns (g_zenv.audio->audio_underruns)
+#define g_audio_drops (g_zenv.audio->audio_drops)
+
 void zelda_apu_write(uint32_t adr, uint8_t val) {
   g_apu_write.ports[adr & 0x3] = val;
 }
 
 void ZeldaPushApuState() {
-  ZeldaApuLock();
-  g_apu_write_ents[g_apu_write_ent_pos++ & 0xf] = g_apu_write;
-  if (g_apu_write_count < 16)
-    g_apu_write_count++;
-  g_apu_total_write++;
-  ZeldaApuUnlock();
+  if (g_msu_player.enabled)
+    MsuPlayer_PollEnd(&g_msu_player);
+  if (!SpscRing_Push(g_apu_write_ring, &g_apu_write)) {
+    // The audio thread is behind. The newest ports matter the most, so drop
+    // the oldest frame instead. Everything that consumes the ring holds the
+    // apu lock, so it's safe to advance the tail from here while holding it.
+    ZeldaApuLock();
+    if (!SpscRing_Push(g_apu_write_ring, &g_apu_write)) {
+      SpscRing_Skip(g_apu_write_ring);
+      SpscRing_Push(g_apu_write_ring, &g_apu_write);
+      SDL_AtomicAdd(&g_audio_drops, 1);
+    }
+    ZeldaApuUnlock();
+  }
+  g_apu_write.frame++;
 }
 
 static void ZeldaPopApuState() {
-  if (g_apu_write_count != 0)
-    memcpy(g_zenv.player->input_ports, &g_apu_write_ents[(g_apu_write_ent_pos - g_apu_write_count--) & 0xf], 4);
+  ApuWriteEnt ent;
+  if (SpscRing_Pop(g_apu_write_ring, &ent)) {
+    memcpy(g_zenv.player->input_ports, ent.ports, 4);
+    g_apu_next_frame = ent.frame + 1;
+  } else {
+    SDL_AtomicAdd(&g_audio_underruns, 1);
+  }
 }
 
+static void ZeldaPublishApuPorts() {
+  uint8 *p = g_zenv.player->port_to_snes;
+  SDL_AtomicSet(&g_apu_port_to_snes, p[0] | p[1] << 8 | p[2] << 16 | p[3] << 24);
+}
+
+// Called both from the audio thread and from the game thread while seeking,
+// the apu lock keeps it from racing with the other consumers of the ring.
 void ZeldaDiscardUnusedAudioFrames() {
-  if (g_apu_write_count != 0 && memcmp(g_zenv.player->input_ports, &g_apu_write_ents[(g_apu_write_ent_pos - g_apu_write_count) & 0xf], 4) == 0) {
-    if (g_apu_total_write >= 16) {
-      g_apu_total_write = 14;
-      g_apu_write_count--;
+  if (!ZeldaApuTryLock())
+    return;
+  const ApuWriteEnt *ent = SpscRing_Peek(g_apu_write_ring);
+  if (ent != NULL && memcmp(g_zenv.player->input_ports, ent->ports, 4) == 0) {
+    // The game has been running ahead of the audio for a while, so drop
+    // queued frames that don't change anything.
+    if (ent->frame - g_apu_last_change_frame >= 16) {
+      g_apu_last_change_frame = ent->frame - 14;
+      SpscRing_Skip(g_apu_write_ring);
     }
   } else {
-    g_apu_total_write = 0;
+    g_apu_last_change_frame = ent ? ent->frame : g_apu_next_frame;
   }
+  ZeldaApuUnlock();
 }
 
 static void ZeldaResetApuQueue() {
-  g_apu_write_ent_pos = g_apu_total_write = g_apu_write_count = 0;
+  SpscRing_Reset(g_apu_write_ring);
+  g_apu_write.frame = g_apu_next_frame = g_apu_last_change_frame = 0;
+  ZeldaPublishApuPorts();
+}
+
+void ZeldaAudioInitialize() {
+  g_zenv.audio = (ZeldaAudioState *)calloc(1, sizeof(ZeldaAudioState));
+  if (!g_zenv.audio)
+    Die("memory allocation failed");
+  g_zenv.audio->apu_mutex = SDL_CreateMutex();
+  if (!g_zenv.audio->apu_mutex)
+    Die("No mutex");
+  g_apu_write_ring = SpscRing_Create(sizeof(ApuWriteEnt), 16);
+  ZeldaPublishApuPorts();
+}
+
+void ZeldaAudioDestroy() {
+  SpscRing_Destroy(g_apu_write_ring);
+  SDL_DestroyMutex(g_zenv.audio->apu_mutex);
+  free(g_zenv.audio);
+  g_zenv.audio = NULL;
+}
+
+void ZeldaApuLock() {
+  Tracer_Begin("apu lock wait");
+  SDL_LockMutex(g_zenv.audio->apu_mutex);
+  Tracer_End("apu lock wait");
+}
+
+bool ZeldaApuTryLock() {
+  return SDL_TryLockMutex(g_zenv.audio->apu_mutex) == 0;
+}
+
+void ZeldaApuUnlock() {
+  SDL_UnlockMutex(g_zenv.audio->apu_mutex);
+}
+
+uint32 ZeldaGetAudioUnderruns() {
+  return (uint32)SDL_AtomicGet(&g_audio_underruns);
+}
+
+uint32 ZeldaGetAudioDrops() {
+  return (uint32)SDL_AtomicGet(&g_audio_drops);
 }
 
 uint8_t zelda_read_apui00() {
@@ -445,17 +858,41 @@ uint8_t zelda_read_apui00() {
 }
 
 uint8_t zelda_apu_read(uint32_t adr) {
-  return g_zenv.player->port_to_snes[adr & 0x3];
+  return (uint8)(SDL_AtomicGet(&g_apu_port_to_snes) >> (adr & 0x3) * 8);
 }
 
 void ZeldaRenderAudio(int16 *audio_buffer, int samples, int channels) {
+  // The game thread holds the lock only briefly, like while it copies the
+  // audio state for a snapshot, so wait for it rather than dropping a frame.
   ZeldaApuLock();
+  uint64 prof = Profiler_Begin();
+  Tracer_Begin("render audio");
   ZeldaPopApuState();
+  Tracer_Begin("spc");
   SpcPlayer_GenerateSamples(g_zenv.player);
+  ZeldaPublishApuPorts();
   dsp_getSamples(g_zenv.player->dsp, audio_buffer, samples, channels);
-  if (g_msu_player.f && channels == 2)
+  Tracer_End("spc");
+  if (g_msu_player.playing && channels == 2) {
+    Tracer_Begin("msu mix");
     MsuPlayer_Mix(&g_msu_player, audio_buffer, samples);
+    Tracer_End("msu mix");
+  }
+  Tracer_Begin("spatial mix");
   SpatialAudio_MixAudio(audio_buffer, samples, channels);
+  Tracer_End("spatial mix");
+  ZeldaApuUnlock();
+  Tracer_End("render audio");
+  Profiler_End(kProfZone_Audio, prof);
+}
+
+// Like ZeldaRenderAudio, but only runs the spc player so the values that the
+// game reads back from the apu stay the same. Used when fast forwarding.
+void ZeldaSkipAudioFrame() {
+  ZeldaApuLock();
+  ZeldaPopApuState();
+  SpcPlayer_RunWithoutSamples(g_zenv.player);
+  ZeldaPublishApuPorts();
   ZeldaApuUnlock();
 }
 
@@ -463,7 +900,7 @@ bool ZeldaIsMusicPlaying() {
   if (g_msu_player.state != kMsuState_Idle) {
     return g_msu_player.state != kMsuState_FinishedPlaying;
   } else {
-    return g_zenv.player->port_to_snes[0] != 0;
+    return zelda_apu_read(APUI00) != 0;
   }
 }
 
@@ -481,6 +918,8 @@ void ZeldaRestoreMusicAfterLoad_Locked(bool is_reset) {
   if (is_reset) {
     SpcPlayer_Initialize(g_zenv.player);
   }
+  // The snapshot may have a different song bank
+  dsp_buildBrrCache(g_zenv.player->dsp);
 
   MsuPlayer *mp = &g_msu_player;
   if (mp->enabled) {
@@ -535,10 +974,24 @@ void ZeldaEnableMsu(uint8 enable) {
     kVolumeTransitionStepFloat[i] = kVolumeTransitionStep[i] * stepscale;
     kVolumeTransitionTargetFloat[i] = kVolumeTransitionTarget[i] * volscale;
   }
+
+  if (enable) {
+    MsuPlayer_ReadTrackHeaders(&g_msu_player);
+    MsuDecoder_Initialize(&g_msu_decoder, (size_t)g_config.msu_cache_memory << 20);
+  }
+}
+
+void ZeldaAudioShutdown() {
+  MsuDecoder_Shutdown(&g_msu_decoder);
+}
+
+void ZeldaSetResamplerQuality(int quality) {
+  dsp_setResamplerQuality(g_zenv.player->dsp, quality);
 }
 
 void LoadSongBank(const uint8 *p) {  // 808888
   ZeldaApuLock();
   SpcPlayer_Upload(g_zenv.player, p);
+  ZeldaPublishApuPorts();
   ZeldaApuUnlock();
 }
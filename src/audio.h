@@ -9,12 +9,22 @@ bool ZeldaIsPlayingMusicTrackWithBug(uint8 track);
 void ZeldaPlayMsuAudioTrack(uint8 track);
 bool ZeldaIsMusicPlaying();
 
+// Sets up and frees the audio state of the current game
+void ZeldaAudioInitialize();
+void ZeldaAudioDestroy();
+void ZeldaAudioShutdown();
+// The msu player is shared by all games, so only the main game should use it.
 void ZeldaEnableMsu(uint8 enable);
+void ZeldaSetResamplerQuality(int quality);
 
 void ZeldaRenderAudio(int16 *audio_buffer, int samples, int channels);
+void ZeldaSkipAudioFrame();
 void ZeldaDiscardUnusedAudioFrames();
 void ZeldaRestoreMusicAfterLoad_Locked(bool is_reset);
 void ZeldaSaveMusicStateToRam_Locked();
 void ZeldaPushApuState();
+// Number of audio frames that were generated without a new frame from the game.
+uint32 ZeldaGetAudioUnderruns();
+uint32 ZeldaGetAudioDrops();
 
 #endif  // ZELDA3_AUDIO_H_
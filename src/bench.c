@@ -0,0 +1,322 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <SDL.h>
+
+#include "bench.h"
+#include "zelda_rtl.h"
+#include "audio.h"
+#include "snes/ppu.h"
+#include "profiler.h"
+#include "tracer.h"
+
+enum {
+  kBench_Logic,
+  kBench_Ppu,
+  kBench_Audio,
+  kBench_Total,
+  kBench_Count,
+};
+
+static const char *const kBenchNames[kBench_Count] = { "logic", "ppu", "audio", "total" };
+
+typedef struct BenchTimings {
+  uint32 *ticks[kBench_Count];
+  size_t size, capacity;
+} BenchTimings;
+
+static void BenchTimings_Append(BenchTimings *bt, const uint32 *v) {
+  if (bt->size == bt->capacity) {
+    bt->capacity = bt->capacity ? bt->capacity * 2 : 4096;
+    for (int i = 0; i < kBench_Count; i++) {
+      bt->ticks[i] = realloc(bt->ticks[i], bt->capacity * sizeof(uint32));
+      if (!bt->ticks[i])
+        Die("realloc failed");
+    }
+  }
+  for (int i = 0; i < kBench_Count; i++)
+    bt->ticks[i][bt->size] = v[i];
+  bt->size++;
+}
+
+static int CompareUint32(const void *a, const void *b) {
+  uint32 x = *(const uint32 *)a, y = *(const uint32 *)b;
+  return x < y ? -1 : x > y;
+}
+
+static uint64 HashBytes(uint64 h, const uint8 *p, size_t n) {
+  // FNV-1a
+  for (size_t i = 0; i < n; i++)
+    h = (h ^ p[i]) * 0x100000001b3ull;
+  return h;
+}
+
+// Faster than HashBytes for the big buffers that get hashed every frame.
+// |n| must be a multiple of 8.
+static uint64 HashWords(uint64 h, const uint8 *p, size_t n) {
+  for (size_t i = 0; i < n; i += 8) {
+    uint64 w;
+    memcpy(&w, p + i, 8);
+    h = (h ^ w) * 0x100000001b3ull;
+    h ^= h >> 29;
+  }
+  return h;
+}
+
+typedef struct BenchReplay {
+  uint8 *pixels;
+  size_t pitch;
+  int16 *audio;
+  int audio_samples, audio_channels;
+  uint32 render_flags;
+} BenchReplay;
+
+static bool BenchReplay_Init(BenchReplay *br, const char *filename, uint32 render_flags, int audio_freq, int audio_channels) {
+  // Large enough for the 4x4 mode7 renderer with the widest aspect ratio.
+  br->pitch = kPpuXPixels * 4 * sizeof(uint32);
+  br->pixels = calloc(br->pitch, 240 * 4);
+  br->audio_samples = 534 * audio_freq / 32000;
+  br->audio_channels = audio_channels;
+  br->audio = malloc(br->audio_samples * audio_channels * sizeof(int16));
+  br->render_flags = render_flags;
+  if (!br->pixels || !br->audio)
+    Die("Out of memory");
+  if (!ZeldaLoadReplay(filename)) {
+    fprintf(stderr, "Unable to open %s\n", filename);
+    return false;
+  }
+  return true;
+}
+
+static void BenchReplay_Destroy(BenchReplay *br) {
+  free(br->audio);
+  free(br->pixels);
+}
+
+// Runs one frame of the replay, filling in the time each part took.
+static void BenchReplay_RunFrame(BenchReplay *br, uint32 *v) {
+  uint64 t0 = SDL_GetPerformanceCounter();
+  ZeldaRunFrame(0);
+  uint64 t1 = SDL_GetPerformanceCounter();
+  ZeldaDrawPpuFrame(br->pixels, br->pitch, br->render_flags);
+  uint64 t2 = SDL_GetPerformanceCounter();
+  ZeldaRenderAudio(br->audio, br->audio_samples, br->audio_channels);
+  ZeldaDiscardUnusedAudioFrames();
+  uint64 t3 = SDL_GetPerformanceCounter();
+  v[kBench_Logic] = (uint32)(t1 - t0);
+  v[kBench_Ppu] = (uint32)(t2 - t1);
+  v[kBench_Audio] = (uint32)(t3 - t2);
+  v[kBench_Total] = (uint32)(t3 - t0);
+}
+
+int Bench_Run(const char *filename, uint32 render_flags, int audio_freq, int audio_channels, uint32 seek_frame) {
+  BenchReplay br;
+  if (!BenchReplay_Init(&br, filename, render_flags, audio_freq, audio_channels))
+    return 1;
+
+  BenchTimings bt = { 0 };
+  double freq = (double)SDL_GetPerformanceFrequency();
+  if (seek_frame) {
+    uint64 t0 = SDL_GetPerformanceCounter();
+    ZeldaSeekReplay(seek_frame);
+    ZeldaDrawPpuFrame(br.pixels, br.pitch, render_flags);
+    double elapsed = (SDL_GetPerformanceCounter() - t0) / freq;
+    printf("%s: seeked to frame %d in %.3f s\n", filename, ZeldaGetReplayFrame(), elapsed);
+  }
+  uint64 start = SDL_GetPerformanceCounter();
+  while (ZeldaIsReplaying()) {
+    uint32 v[kBench_Count];
+    BenchReplay_RunFrame(&br, v);
+    BenchTimings_Append(&bt, v);
+  }
+  double elapsed = (SDL_GetPerformanceCounter() - start) / freq;
+
+  printf("%s: %d frames in %.3f s, %.1f fps\n", filename, (int)bt.size, elapsed,
+         elapsed > 0 ? bt.size / elapsed : 0.0);
+  if (bt.size) {
+    printf("%-6s %10s %10s %10s %10s\n", "(ms)", "min", "p50", "p99", "avg");
+    for (int i = 0; i < kBench_Count; i++) {
+      uint32 *t = bt.ticks[i];
+      uint64 sum = 0;
+      for (size_t j = 0; j < bt.size; j++)
+        sum += t[j];
+      qsort(t, bt.size, sizeof(uint32), &CompareUint32);
+      double ms = 1000.0 / freq;
+      printf("%-6s %10.3f %10.3f %10.3f %10.3f\n", kBenchNames[i],
+             t[0] * ms, t[bt.size / 2] * ms, t[(bt.size - 1) * 99 / 100] * ms, sum * ms / bt.size);
+    }
+  }
+  printf("ram hash: %.16llx\n", (unsigned long long)HashBytes(0xcbf29ce484222325ull, g_zenv.ram, 0x20000));
+  if (g_profiler_enabled)
+    Profiler_PrintTopObjects(10);
+
+  for (int i = 0; i < kBench_Count; i++)
+    free(bt.ticks[i]);
+  BenchReplay_Destroy(&br);
+  return 0;
+}
+
+enum {
+  kGolden_Magic = 0x444c4f47,  // GOLD
+  kGolden_Version = 1,
+  // Hash the state this often
+  kGolden_Interval = 16,
+  kGolden_RamBlockSize = 1024,
+  kGolden_RamBlocks = 0x20000 / kGolden_RamBlockSize,
+  // Flags that only change how fast frames are drawn, not what they look like.
+  // A golden recorded with or without them verifies the other setting.
+  kGolden_OutputNeutralFlags = kPpuRenderFlags_BgRowCache,
+};
+
+typedef struct GoldenHeader {
+  uint32 magic, version;
+  uint32 interval;
+  uint32 render_flags;
+  uint32 extra_left_right;
+  uint32 reserved;
+} GoldenHeader;
+
+typedef struct GoldenEntry {
+  // Rolling hashes, covering every checkpoint up until this one
+  uint64 ram, vram, framebuffer;
+  uint32 frame;
+  // Hash of each ram block at this frame, to tell where things went wrong
+  uint32 ram_blocks[kGolden_RamBlocks];
+} GoldenEntry;
+
+static void GoldenEntry_Update(GoldenEntry *e, const BenchReplay *br, uint32 frame) {
+  int scale = PpuGetCurrentRenderScale(g_zenv.ppu, br->render_flags);
+  size_t width = (256 + g_zenv.ppu->extraLeftRight * 2) * scale * sizeof(uint32);
+  size_t height = (br->render_flags & kPpuRenderFlags_Height240 ? 240 : 224) * scale;
+  e->frame = frame;
+  e->ram = HashWords(e->ram, g_zenv.ram, 0x20000);
+  e->vram = HashWords(e->vram, (uint8 *)g_zenv.vram, 0x10000);
+  for (size_t y = 0; y < height; y++)
+    e->framebuffer = HashWords(e->framebuffer, br->pixels + y * br->pitch, width);
+  for (int i = 0; i < kGolden_RamBlocks; i++)
+    e->ram_blocks[i] = (uint32)HashWords(0, g_zenv.ram + i * kGolden_RamBlockSize, kGolden_RamBlockSize);
+}
+
+static void GoldenEntry_PrintDiff(const GoldenEntry *want, const GoldenEntry *got, const char *filename, uint32 last_ok) {
+  fprintf(stderr, "%s: diverged between frame %d and %d\n", filename, last_ok, got->frame);
+  int printed = 0;
+  for (int i = 0; i < kGolden_RamBlocks; i++) {
+    if (want->ram_blocks[i] != got->ram_blocks[i] && printed++ < 16)
+      fprintf(stderr, "  ram differs in 0x%.5X-0x%.5X\n", i * kGolden_RamBlockSize, (i + 1) * kGolden_RamBlockSize - 1);
+  }
+  if (printed > 16)
+    fprintf(stderr, "  ... and %d more ram blocks\n", printed - 16);
+  if (want->vram != got->vram)
+    fprintf(stderr, "  vram differs\n");
+  if (want->framebuffer != got->framebuffer)
+    fprintf(stderr, "  framebuffer differs\n");
+}
+
+int Bench_CheckReplay(const char *filename, const char *golden_filename, bool record, uint32 render_flags) {
+  // Always render audio the same way, the game reads back the apu state.
+  BenchReplay br;
+  if (!BenchReplay_Init(&br, filename, render_flags, 32000, 2))
+    return 1;
+  FILE *f = fopen(golden_filename, record ? "wb" : "rb");
+  if (!f) {
+    fprintf(stderr, "Unable to open %s\n", golden_filename);
+    BenchReplay_Destroy(&br);
+    return 1;
+  }
+  GoldenHeader hdr = { kGolden_Magic, kGolden_Version, kGolden_Interval, render_flags & ~kGolden_OutputNeutralFlags,
+                       g_zenv.ppu->extraLeftRight, 0 };
+  int rv = 0;
+  if (record) {
+    fwrite(&hdr, 1, sizeof(hdr), f);
+  } else {
+    GoldenHeader want;
+    if (fread(&want, 1, sizeof(want), f) != sizeof(want) || want.magic != hdr.magic || want.version != hdr.version) {
+      fprintf(stderr, "%s: not a golden file\n", golden_filename);
+      rv = 1;
+    } else if (memcmp(&want, &hdr, sizeof(hdr)) != 0) {
+      fprintf(stderr, "%s: recorded with different render settings\n", golden_filename);
+      rv = 1;
+    }
+  }
+
+  GoldenEntry cur = { 0 }, want;
+  uint32 frame = 0, last_ok = 0;
+  while (rv == 0 && ZeldaIsReplaying()) {
+    uint32 v[kBench_Count];
+    BenchReplay_RunFrame(&br, v);
+    frame++;
+    if (frame % kGolden_Interval != 0 && ZeldaIsReplaying())
+      continue;
+    GoldenEntry_Update(&cur, &br, frame);
+    if (record) {
+      fwrite(&cur, 1, sizeof(cur), f);
+    } else if (fread(&want, 1, sizeof(want), f) != sizeof(want)) {
+      fprintf(stderr, "%s: replay is longer than the golden file, at frame %d\n", filename, frame);
+      rv = 1;
+    } else if (want.frame != cur.frame || want.ram != cur.ram || want.vram != cur.vram ||
+               want.framebuffer != cur.framebuffer) {
+      GoldenEntry_PrintDiff(&want, &cur, filename, last_ok);
+      rv = 1;
+    } else {
+      last_ok = frame;
+    }
+  }
+  if (rv == 0 && !record && fread(&want, 1, sizeof(want), f) != 0) {
+    fprintf(stderr, "%s: replay ended at frame %d, before the golden file\n", filename, frame);
+    rv = 1;
+  }
+  if (rv == 0)
+    printf("%s: %d frames %s\n", filename, frame, record ? "recorded" : "ok");
+  fclose(f);
+  BenchReplay_Destroy(&br);
+  return rv;
+}
+
+typedef struct CheckReplaysCtx {
+  int num;
+  const char *const *filenames, *const *golden_filenames;
+  bool record;
+  uint32 render_flags;
+  BenchSetupFunc *setup;
+  SDL_atomic_t next;
+  SDL_atomic_t failed;
+} CheckReplaysCtx;
+
+static void CheckReplaysWorker(CheckReplaysCtx *ctx) {
+  ZeldaEnv *old = g_zenv_cur;
+  int i;
+  while ((i = SDL_AtomicAdd(&ctx->next, 1)) < ctx->num) {
+    ZeldaEnv *env = ZeldaEnv_Create();
+    ZeldaEnv_MakeCurrent(env);
+    ctx->setup();
+    if (Bench_CheckReplay(ctx->filenames[i], ctx->golden_filenames[i], ctx->record, ctx->render_flags))
+      SDL_AtomicAdd(&ctx->failed, 1);
+    fflush(stdout);
+    ZeldaEnv_MakeCurrent(old);
+    ZeldaEnv_Destroy(env);
+  }
+}
+
+static int SDLCALL CheckReplaysThread(void *ctx) {
+  Tracer_SetThreadName("replay");
+  CheckReplaysWorker((CheckReplaysCtx *)ctx);
+  return 0;
+}
+
+int Bench_CheckReplays(int num, const char *const *filenames, const char *const *golden_filenames,
+                       bool record, uint32 render_flags, int jobs, BenchSetupFunc *setup) {
+  CheckReplaysCtx ctx = { num, filenames, golden_filenames, record, render_flags, setup, { 0 }, { 0 } };
+  SDL_Thread *threads[64];
+  int num_threads = IntMin(IntMin(jobs, num), countof(threads)) - 1;
+  for (int i = 0; i < num_threads; i++) {
+    if (!(threads[i] = SDL_CreateThread(&CheckReplaysThread, "replay", &ctx)))
+      Die("Unable to create thread");
+  }
+  CheckReplaysWorker(&ctx);
+  for (int i = 0; i < num_threads; i++)
+    SDL_WaitThread(threads[i], NULL);
+  int failed = SDL_AtomicGet(&ctx.failed);
+  if (num > 1)
+    printf("%d of %d replays %s\n", num - failed, num, record ? "recorded" : "ok");
+  return failed != 0;
+}
@@ -0,0 +1,22 @@
+#ifndef ZELDA3_BENCH_H_
+#define ZELDA3_BENCH_H_
+
+#include "types.h"
+
+// Replays a save file headlessly as fast as possible and prints
+// timing statistics. If |seek_frame| is set, first seeks to that frame
+// and reports how long it took. Returns the process exit code.
+int Bench_Run(const char *filename, uint32 render_flags, int audio_freq, int audio_channels, uint32 seek_frame);
+
+// Replays a save file headlessly and compares hashes of the game state and the
+// rendered frames against a golden file, or records a new golden file.
+int Bench_CheckReplay(const char *filename, const char *golden_filename, bool record, uint32 render_flags);
+
+typedef void BenchSetupFunc(void);
+
+// Same as Bench_CheckReplay for |num| replays. Each one runs in a ZeldaEnv of
+// its own, configured by |setup|, and up to |jobs| of them run at once.
+int Bench_CheckReplays(int num, const char *const *filenames, const char *const *golden_filenames,
+                       bool record, uint32 render_flags, int jobs, BenchSetupFunc *setup);
+
+#endif  // ZELDA3_BENCH_H_
@@ -45,6 +45,10 @@ static const uint16 kDefaultKbdControls[kKeys_Total] = {
   C(SDLK_SPACE), _(SDLK_h), _(SDLK_i), C(SDLK_h), C(SDLK_o),
   // SetupScreen
   S(SDLK_F12),
+  // Rewind
+  _(SDLK_BACKSPACE),
+  // DisplayProfiler
+  S(SDLK_f),
 };
 #undef _
 #undef A
@@ -72,6 +76,8 @@ static const KeyNameId kKeyNameId[] = {
   S(SoundLegend),
   S(AccessibilityOptions),
   S(SetupScreen),
+  S(Rewind),
+  S(DisplayProfiler),
 };
 #undef S
 #undef M
@@ -379,6 +385,11 @@ static bool HandleIniConfig(int section, const char *key, char *value) {
       return ParseBool(value, &g_config.linear_filtering);
     } else if (StringEqualsNoCase(key, "NoSpriteLimits")) {
       return ParseBool(value, &g_config.no_sprite_limits);
+    } else if (StringEqualsNoCase(key, "RenderThreads")) {
+      g_config.render_threads = (uint8)strtol(value, (char**)NULL, 10);
+      return true;
+    } else if (StringEqualsNoCase(key, "BgRowCache")) {
+      return ParseBool(value, &g_config.bg_row_cache);
     } else if (StringEqualsNoCase(key, "LinkGraphics")) {
       g_config.link_graphics = value;
       return true;
@@ -400,6 +411,12 @@ static bool HandleIniConfig(int section, const char *key, char *value) {
     } else if (StringEqualsNoCase(key, "AudioSamples")) {
       g_config.audio_samples = (uint16)strtol(value, (char**)NULL, 10);
       return true;
+    } else if (StringEqualsNoCase(key, "ResamplerQuality")) {
+      int quality = strtol(value, (char**)NULL, 10);
+      if (quality < 0 || quality > 3)
+        return false;
+      g_config.resampler_quality = quality;
+      return true;
     } else if (StringEqualsNoCase(key, "EnableMSU")) {
         if (StringEqualsNoCase(value, "opuz"))
         g_config.enable_msu = kMsuEnabled_Opuz;
@@ -418,6 +435,9 @@ static bool HandleIniConfig(int section, const char *key, char *value) {
       return true;
     } else if (StringEqualsNoCase(key, "ResumeMSU")) {
       return ParseBool(value, &g_config.resume_msu);
+    } else if (StringEqualsNoCase(key, "MSUCacheMemory")) {
+      g_config.msu_cache_memory = atoi(value);
+      return true;
     }
   } else if (section == 3) {
     if (StringEqualsNoCase(key, "Autosave")) {
@@ -453,11 +473,23 @@ static bool HandleIniConfig(int section, const char *key, char *value) {
       return true;
     } else if (StringEqualsNoCase(key, "DisplayPerfInTitle")) {
       return ParseBool(value, &g_config.display_perf_title);
+    } else if (StringEqualsNoCase(key, "ReplayKeyframeInterval")) {
+      g_config.replay_keyframe_interval = atoi(value);
+      return true;
+    } else if (StringEqualsNoCase(key, "RewindMemory")) {
+      g_config.rewind_memory = atoi(value);
+      return true;
     } else if (StringEqualsNoCase(key, "DisableFrameDelay")) {
       return ParseBool(value, &g_config.disable_frame_delay);
     } else if (StringEqualsNoCase(key, "Language")) {
       g_config.language = value;
       return true;
+    } else if (StringEqualsNoCase(key, "ProfilerReport")) {
+      g_config.profiler_report = *value ? value : NULL;
+      return true;
+    } else if (StringEqualsNoCase(key, "TraceFile")) {
+      g_config.trace_file = *value ? value : NULL;
+      return true;
     }
   } else if (section == 4) {
     if (StringEqualsNoCase(key, "ItemSwitchLR")) {
@@ -538,6 +570,7 @@ void ResetKeymap(void) {
 
 void ParseConfigFile(const char *filename) {
   g_config.msuvolume = 100;  // default msu volume, 100%
+  g_config.resampler_quality = 2;
 
   if (filename != NULL || !ParseOneConfigFile("zelda3.user.ini", 0)) {
     if (filename == NULL)
@@ -42,6 +42,8 @@ enum {
   kKeys_SoundLegend,
   kKeys_AccessibilityOptions,
   kKeys_SetupScreen,
+  kKeys_Rewind,
+  kKeys_DisplayProfiler,
   kKeys_Total,
 };
 
@@ -66,15 +68,21 @@ typedef struct Config {
   uint16 audio_freq;
   uint8 audio_channels;
   uint16 audio_samples;
+  uint8 resampler_quality;
   bool autosave;
+  uint32 replay_keyframe_interval;
+  uint32 rewind_memory;
   uint8 extended_aspect_ratio;
   bool extend_y;
   bool no_sprite_limits;
+  uint8 render_threads;
+  bool bg_row_cache;
   bool display_perf_title;
   uint8 enable_msu;
   bool resume_msu;
   bool disable_frame_delay;
   uint8 msuvolume;
+  uint32 msu_cache_memory;
   uint32 features0;
 
   const char *link_graphics;
@@ -82,6 +90,8 @@ typedef struct Config {
   const char *shader;
   const char *msu_path;
   const char *language;
+  const char *profiler_report;
+  const char *trace_file;
 } Config;
 
 enum {
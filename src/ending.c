@@ -70,7 +70,7 @@ static PlayerHandlerFunc *const kEndSequence0_Funcs[3] = {
 &Credits_LoadScene_Overworld_Overlay,
 &Credits_LoadScene_Overworld_LoadMap,
 };
-static PrepOamCoordsRet g_ending_coords;
+#define g_ending_coords (g_zenv.ending_coords)
 static const uint16 kEnding1_TargetScrollY[16] = { 0x6f2, 0x210, 0x72c, 0xc00, 0x10c, 0xa9b, 0x10, 0x510, 0x89, 0xa8e, 0x222c, 0x2510, 0x826, 0x5c, 0x20a, 0x30 };
 static const uint16 kEnding1_TargetScrollX[16] = { 0x77f, 0x480, 0x193, 0xaa, 0x878, 0x847, 0x4fd, 0xc57, 0x40f, 0x478, 0xa00, 0x200, 0x201, 0xaa1, 0x26f, 0 };
 static const int8 kEnding1_Yvel[16] = { -1, -1, 1, -1, 1, 1, 0, 1, 0, -1, -1, 0, 0, 0, 1, -1 };
@@ -149,6 +149,7 @@ void Intro_SetupScreen() {  // 828000
 
   for (int i = 0; i < 17; i++)
     g_zenv.vram[0x27f0 + i] = 0;
+  ZeldaMarkVramDirty(0x27f0, 17);
 
   R16 = 0x1ffe;
   R18 = 0x1bfe;
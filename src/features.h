@@ -59,7 +59,4 @@ enum {
 
 
 
-extern uint32 g_wanted_zelda_features;
-
-
 #endif  // ZELDA3_FEATURES_H_
@@ -980,6 +980,7 @@ static void CopyTilesForSwitchLR(int switch_lr) {
     };
     memcpy(&g_zenv.vram[0x7000 + 0xf * 8], kBytesForNewTile0xF_BottomofL, sizeof(kBytesForNewTile0xF_BottomofL));
   }
+  ZeldaMarkVramDirty(0x7000 + 0xc * 8, 4 * 8);
 #undef PV
 }
 
@@ -6,6 +6,7 @@
 #include "player.h"
 #include "sprite.h"
 #include "assets.h"
+#include <SDL.h>
 
 // Allow this to be overwritten
 uint16 kGlovesColor[2] = {0x52f6, 0x376};
@@ -413,6 +414,7 @@ static void DecompAndUpload2bpp(uint16 *vram_ptr, uint8 pack) {
   Decomp_spr(&g_ram[0x14000], pack);
   const uint8 *src = &g_ram[0x14000];
   memcpy(vram_ptr, src, 1024 * sizeof(uint16));
+  ZeldaMarkVramDirty(vram_ptr - g_zenv.vram, 1024);
 }
 
 void RecoverPegGFXFromMapping() {
@@ -442,6 +444,8 @@ void EraseTileMaps(uint16 r2, uint16 r0) {  // 808355
   dst = g_zenv.vram + 0x6000;
   for (int i = 0; i < 0x800; i++)
     dst[i] = r2;
+  ZeldaMarkVramDirty(0, 0x2000);
+  ZeldaMarkVramDirty(0x6000, 0x800);
 }
 
 void EnableForceBlank() {  // 80893d
@@ -858,6 +862,7 @@ void LoadDefaultGraphics() {  // 80e2d0
       *vram_ptr++ = src[0] | (src[0] | tmp[i]) << 8;
     }
   } while (--num);
+  ZeldaMarkVramDirty(0x4000, 0x400);
 
   // Load 2bpp graphics used for hud
   DecompAndUpload2bpp(&g_zenv.vram[0x7000], 0x6a);
@@ -933,11 +938,13 @@ void Graphics_LoadChrHalfSlot() {  // 80e3fa
 
 void TransferFontToVRAM() {  // 80e556
   memcpy(&g_zenv.vram[0x7000], FindIndexInMemblk(kDialogueFont(0), 0).ptr, 0x800 * sizeof(uint16));
+  ZeldaMarkVramDirty(0x7000, 0x800);
 }
 
-void Do3To4High(uint16 *vram_ptr, const uint8 *decomp_addr) {  // 80e5af
+// |t| receives the bitplane masks of the last tile row, the game keeps them
+// in dung_line_ptrs_row0.
+static void Expand3To4HighSheet(uint16 *vram_ptr, const uint8 *decomp_addr, uint16 *t) {
   for (int j = 0; j < 64; j++) {
-    uint16 *t = (uint16 *)&dung_line_ptrs_row0;
     for (int i = 7; i >= 0; i--, decomp_addr += 2) {
       uint16 d = *(uint16 *)decomp_addr;
       t[i] = (d | (d >> 8)) & 0xff;
@@ -950,7 +957,7 @@ void Do3To4High(uint16 *vram_ptr, const uint8 *decomp_addr) {  // 80e5af
   }
 }
 
-void Do3To4Low(uint16 *vram_ptr, const uint8 *decomp_addr) {  // 80e63c
+static void Expand3To4LowSheet(uint16 *vram_ptr, const uint8 *decomp_addr) {
   for (int j = 0; j < 64; j++) {
     for (int i = 0; i < 8; i++, decomp_addr += 2)
       *vram_ptr++ = *(uint16 *)decomp_addr;
@@ -959,18 +966,145 @@ void Do3To4Low(uint16 *vram_ptr, const uint8 *decomp_addr) {  // 80e63c
   }
 }
 
+void Do3To4High(uint16 *vram_ptr, const uint8 *decomp_addr) {  // 80e5af
+  ZeldaMarkVramDirty(vram_ptr - g_zenv.vram, 64 * 16);
+  Expand3To4HighSheet(vram_ptr, decomp_addr, (uint16 *)&dung_line_ptrs_row0);
+}
+
+void Do3To4Low(uint16 *vram_ptr, const uint8 *decomp_addr) {  // 80e63c
+  ZeldaMarkVramDirty(vram_ptr - g_zenv.vram, 64 * 16);
+  Expand3To4LowSheet(vram_ptr, decomp_addr);
+}
+
+// Graphics packs decompressed and expanded to 4bpp the first time they're
+// loaded, so room transitions only copy them. The decompressed data is still
+// copied to the scratch area in ram as parts of the game read it from there.
+enum {
+  kGfxSheet_Spr = 0,
+  kGfxSheet_Bg = 1,
+  kGfxSheet_Bytes = 64 * 24,  // what Do3To4High/Low read
+  kGfxSheet_MaxDecompSize = 0x10000,
+};
+
+typedef struct GfxSheet {
+  bool loaded;
+  bool cacheable;
+  int decomp_size;
+  uint8 *decomp;
+  uint16 *vram[2];  // low, high
+  uint16 high_masks[8];
+} GfxSheet;
+
+// Shared by all games. The work is done outside of the lock and only the
+// result is published under it. Entries don't change once filled.
+static GfxSheet g_gfx_sheets[2][256];
+static SDL_SpinLock g_gfx_sheets_lock;
+
+static int DecompSprSized(uint8 *dst, size_t dst_size, int gfx);
+static int DecompressSized(uint8 *dst, size_t dst_size, const uint8 *src);
+
+// Returns -1 if the sheet doesn't fit in |dst_size| bytes.
+static int DecompSheet(int kind, uint8 *dst, size_t dst_size, int gfx_pack) {
+  return kind == kGfxSheet_Spr ? DecompSprSized(dst, dst_size, gfx_pack) :
+                                 DecompressSized(dst, dst_size, kBgGfx(gfx_pack).ptr);
+}
+
+// Returns a copy of the decompressed sheet, or NULL if it can't be cached.
+static uint8 *DecompSheetForCache(int kind, int gfx_pack, int *size) {
+  uint8 *buf = malloc(2 * kGfxSheet_MaxDecompSize), *rv = NULL;
+  if (!buf)
+    Die("memory allocation failed");
+  // The result can only be reused if it doesn't depend on what was in the
+  // destination before, so decompress on top of two different fills.
+  memset(buf, 0, kGfxSheet_MaxDecompSize);
+  memset(buf + kGfxSheet_MaxDecompSize, 0xff, kGfxSheet_MaxDecompSize);
+  int n0 = DecompSheet(kind, buf, kGfxSheet_MaxDecompSize, gfx_pack);
+  int n1 = DecompSheet(kind, buf + kGfxSheet_MaxDecompSize, kGfxSheet_MaxDecompSize, gfx_pack);
+  if (n0 == n1 && n0 >= kGfxSheet_Bytes && memcmp(buf, buf + kGfxSheet_MaxDecompSize, n0) == 0) {
+    rv = malloc(n0);
+    if (!rv)
+      Die("memory allocation failed");
+    memcpy(rv, buf, n0);
+    *size = n0;
+  }
+  free(buf);
+  return rv;
+}
+
+static GfxSheet *GetGfxSheet(int kind, int gfx_pack, bool high) {
+  GfxSheet *s = &g_gfx_sheets[kind][gfx_pack & 0xff];
+  SDL_AtomicLock(&g_gfx_sheets_lock);
+  bool loaded = s->loaded, has_vram = s->vram[high] != NULL;
+  SDL_AtomicUnlock(&g_gfx_sheets_lock);
+  if (!loaded) {
+    int size = 0;
+    uint8 *decomp = DecompSheetForCache(kind, gfx_pack, &size);
+    SDL_AtomicLock(&g_gfx_sheets_lock);
+    if (!s->loaded) {
+      s->loaded = true;
+      s->cacheable = (decomp != NULL);
+      s->decomp = decomp;
+      s->decomp_size = size;
+      decomp = NULL;
+    }
+    SDL_AtomicUnlock(&g_gfx_sheets_lock);
+    free(decomp);  // another thread got there first
+  }
+  if (!s->cacheable)
+    return NULL;
+  if (!has_vram) {
+    uint16 *vram = malloc(64 * 16 * sizeof(uint16));
+    uint16 high_masks[8];
+    if (!vram)
+      Die("memory allocation failed");
+    if (high)
+      Expand3To4HighSheet(vram, s->decomp, high_masks);
+    else
+      Expand3To4LowSheet(vram, s->decomp);
+    SDL_AtomicLock(&g_gfx_sheets_lock);
+    if (!s->vram[high]) {
+      if (high)
+        memcpy(s->high_masks, high_masks, sizeof(high_masks));
+      s->vram[high] = vram;
+      vram = NULL;
+    }
+    SDL_AtomicUnlock(&g_gfx_sheets_lock);
+    free(vram);
+  }
+  return s;
+}
+
+// Same as decompressing into |decomp_addr| and calling Do3To4High/Low.
+static bool LoadCachedGfxSheet(int kind, int gfx_pack, bool high, uint16 *vram_ptr, uint8 *decomp_addr) {
+  GfxSheet *s = GetGfxSheet(kind, gfx_pack, high);
+  if (!s)
+    return false;
+  memcpy(decomp_addr, s->decomp, s->decomp_size);
+  memcpy(vram_ptr, s->vram[high], 64 * 16 * sizeof(uint16));
+  ZeldaMarkVramDirty(vram_ptr - g_zenv.vram, 64 * 16);
+  if (high)
+    memcpy(&dung_line_ptrs_row0, s->high_masks, sizeof(s->high_masks));
+  return true;
+}
+
 void LoadSpriteGraphics(uint16 *vram_ptr, int gfx_pack, uint8 *decomp_addr) {  // 80e583
+  bool high = (gfx_pack == 0x52 || gfx_pack == 0x53 || gfx_pack == 0x5a || gfx_pack == 0x5b ||
+               gfx_pack == 0x5c || gfx_pack == 0x5e || gfx_pack == 0x5f);
+  if (LoadCachedGfxSheet(kGfxSheet_Spr, gfx_pack, high, vram_ptr, decomp_addr))
+    return;
   Decomp_spr(decomp_addr, gfx_pack);
-  if (gfx_pack == 0x52 || gfx_pack == 0x53 || gfx_pack == 0x5a || gfx_pack == 0x5b ||
-      gfx_pack == 0x5c || gfx_pack == 0x5e || gfx_pack == 0x5f)
+  if (high)
     Do3To4High(vram_ptr, decomp_addr);
   else
     Do3To4Low(vram_ptr, decomp_addr);
 }
 
 void LoadBackgroundGraphics(uint16 *vram_ptr, int gfx_pack, int slot, uint8 *decomp_addr) {  // 80e609
+  bool high = (main_tile_theme_index >= 0x20) ? (slot == 7 || slot == 2 || slot == 3 || slot == 4) : (slot >= 4);
+  if (LoadCachedGfxSheet(kGfxSheet_Bg, gfx_pack, high, vram_ptr, decomp_addr))
+    return;
   Decomp_bg(decomp_addr, gfx_pack);
-  if ((main_tile_theme_index >= 0x20) ? (slot == 7 || slot == 2 || slot == 3 || slot == 4) : (slot >= 4))
+  if (high)
     Do3To4High(vram_ptr, decomp_addr);
   else
     Do3To4Low(vram_ptr, decomp_addr);
@@ -988,23 +1122,33 @@ void LoadCommonSprites() {  // 80e6b7
   }
 }
 
-int Decomp_spr(uint8 *dst, int gfx) {  // 80e772
+static int DecompSprSized(uint8 *dst, size_t dst_size, int gfx) {
   if (gfx < 12)
     gfx = 12; // ensure it wont decode bad sheets.
   MemBlk blk = kSprGfx(gfx);
-  const uint8 *sprite_data = GetCompSpritePtr(gfx);
   // If the size is not 0x600 then it's compressed
   if (gfx >= 103 || blk.size != 0x600)
-    return Decompress(dst, blk.ptr);
+    return DecompressSized(dst, dst_size, blk.ptr);
+  if (dst_size < 0x600)
+    return -1;
   memcpy(dst, blk.ptr, 0x600);
   return 0x600;
 }
 
+int Decomp_spr(uint8 *dst, int gfx) {  // 80e772
+  return DecompSprSized(dst, SIZE_MAX, gfx);
+}
+
 int Decomp_bg(uint8 *dst, int gfx) {  // 80e78f
   return Decompress(dst, kBgGfx(gfx).ptr);
 }
 
 int Decompress(uint8 *dst, const uint8 *src) {  // 80e79e
+  return DecompressSized(dst, SIZE_MAX, src);
+}
+
+// Stops and returns -1 before writing or copying from beyond |dst_size| bytes.
+static int DecompressSized(uint8 *dst, size_t dst_size, const uint8 *src) {
   uint8 *dst_org = dst;
   int len;
   for (;;) {
@@ -1020,6 +1164,8 @@ int Decompress(uint8 *dst, const uint8 *src) {  // 80e79e
       cmd = (cmd << 3) & 0xe0;
     }
     //printf("%d: %d,%d\n", (int)(dst - dst_org), cmd, len);
+    if ((size_t)len > dst_size - (dst - dst_org))
+      return -1;
     if (cmd == 0) {
       do {
         *dst++ = *src++;
@@ -1027,6 +1173,8 @@ int Decompress(uint8 *dst, const uint8 *src) {  // 80e79e
     } else if (cmd & 0x80) {
       uint32 offs = *src++;
       offs |= *src++ << 8;
+      if (offs + len > dst_size)
+        return -1;
       do {
         *dst++ = dst_org[offs++];
       } while (--len);
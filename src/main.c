@@ -33,6 +33,10 @@
 #include "setup_screen.h"
 #include "filepicker.h"
 #include "asset_extract.h"
+#include "bench.h"
+#include "thread_pool.h"
+#include "profiler.h"
+#include "tracer.h"
 
 static bool g_run_without_emu = 0;
 
@@ -65,11 +69,12 @@ static const char kWindowTitle[] = "The Legend of Zelda: A Link to the Past";
 static uint32 g_win_flags = SDL_WINDOW_RESIZABLE;
 static SDL_Window *g_window;
 
-static uint8 g_paused, g_turbo, g_replay_turbo = true, g_cursor = true;
+static uint8 g_paused, g_turbo, g_replay_turbo = true, g_cursor = true, g_rewinding;
 static uint8 g_current_window_scale;
 static uint8 g_gamepad_buttons;
 static int g_input1_state;
 static bool g_display_perf;
+static bool g_display_profiler;
 static int g_curr_fps;
 static int g_ppu_render_flags = 0;
 static int g_snes_width, g_snes_height;
@@ -178,16 +183,22 @@ static void DrawPpuFrameWithPerf() {
   }
   if (g_display_perf)
     RenderNumber(pixel_buffer + pitch * render_scale, pitch, g_curr_fps, render_scale == 4);
+  if (g_display_profiler) {
+    int y = render_scale + (g_display_perf ? 12 << (render_scale == 4) : 0);
+    Profiler_DrawOverlay(pixel_buffer + pitch * y, pitch, render_scale == 4);
+  }
   g_renderer_funcs.EndDraw();
 }
 
-static SDL_mutex *g_audio_mutex;
 static uint8 *g_audiobuffer, *g_audiobuffer_cur, *g_audiobuffer_end;
 static int g_frames_per_block;
 static uint8 g_audio_channels;
 
+// Runs on the audio thread. The game state is only shared through lock free
+// queues, so this never has to wait for a slow frame.
 static void SDLCALL AudioCallback(void *userdata, Uint8 *stream, int len) {
-  if (SDL_LockMutex(g_audio_mutex)) Die("Mutex lock failed!");
+  Tracer_SetThreadName("audio");
+  Tracer_Begin("audio callback");
   while (len != 0) {
     if (g_audiobuffer_end - g_audiobuffer_cur == 0) {
       ZeldaRenderAudio((int16*)g_audiobuffer, g_frames_per_block, g_audio_channels);
@@ -207,7 +218,7 @@ static void SDLCALL AudioCallback(void *userdata, Uint8 *stream, int len) {
   }
 
   ZeldaDiscardUnusedAudioFrames();
-  SDL_UnlockMutex(g_audio_mutex);
+  Tracer_End("audio callback");
 }
 
 // State for sdl renderer
@@ -287,11 +298,25 @@ static const struct RendererFuncs kSdlRendererFuncs  = {
 void OpenGLRenderer_Create(struct RendererFuncs *funcs, bool use_opengl_es);
 static void InitSaveDir(void);
 
+// Configures the current game for running without a window, from the config.
+static void SetupHeadlessEnv(void) {
+  g_zenv.ppu->extraLeftRight = UintMin(g_config.extended_aspect_ratio, kPpuExtraLeftRight);
+  g_wanted_zelda_features = g_config.features0;
+  ZeldaSetLanguage(g_config.language);
+  ZeldaSetRenderThreads(g_config.render_threads);
+  ZeldaSetResamplerQuality(g_config.resampler_quality);
+}
+
 #undef main
 int main(int argc, char** argv) {
   argc--, argv++;
   const char *config_file = NULL;
   bool enable_accessibility = false;
+  const char *bench_file = NULL, *profile_file = NULL, *trace_file = NULL;
+  const char **replay_files = NULL, **golden_files = NULL;
+  int num_replays = 0, replay_jobs = 0;
+  bool record_golden = false;
+  uint32 seek_frame = 0;
   if (argc >= 2 && strcmp(argv[0], "--config") == 0) {
     config_file = argv[1];
     argc -= 2, argv += 2;
@@ -307,6 +332,57 @@ int main(int argc, char** argv) {
         argv[j] = argv[j + 1];
       argc--;
       i--;
+    } else if (strcmp(argv[i], "--bench") == 0 && i + 1 < argc) {
+      // Headless benchmark of a replay, e.g. --bench "saves/ref/Chapter 1 - Zelda's Rescue.sav"
+      bench_file = argv[i + 1];
+      for (int j = i; j < argc - 2; j++)
+        argv[j] = argv[j + 2];
+      argc -= 2;
+      i--;
+    } else if (strcmp(argv[i], "--profile") == 0 && i + 1 < argc) {
+      // Profile and write the report to this file on exit, like ProfilerReport in the config.
+      profile_file = argv[i + 1];
+      for (int j = i; j < argc - 2; j++)
+        argv[j] = argv[j + 2];
+      argc -= 2;
+      i--;
+    } else if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc) {
+      // Record a timeline of every thread and write it to this file on exit, like TraceFile in the config.
+      trace_file = argv[i + 1];
+      for (int j = i; j < argc - 2; j++)
+        argv[j] = argv[j + 2];
+      argc -= 2;
+      i--;
+    } else if (strcmp(argv[i], "--seek") == 0 && i + 1 < argc) {
+      // Used with --bench, fast forward to this frame before starting to measure.
+      seek_frame = strtoul(argv[i + 1], NULL, 10);
+      for (int j = i; j < argc - 2; j++)
+        argv[j] = argv[j + 2];
+      argc -= 2;
+      i--;
+    } else if (strcmp(argv[i], "--jobs") == 0 && i + 1 < argc) {
+      // How many of the replays given to --check-replay to run at once, defaults to one per cpu.
+      replay_jobs = strtol(argv[i + 1], NULL, 10);
+      for (int j = i; j < argc - 2; j++)
+        argv[j] = argv[j + 2];
+      argc -= 2;
+      i--;
+    } else if ((strcmp(argv[i], "--check-replay") == 0 || strcmp(argv[i], "--record-replay") == 0) && i + 2 < argc) {
+      // Compare a replay against a golden file of state hashes, or record one. Used by make check-replays.
+      // Can be given several times, the replays then run in parallel.
+      if (!replay_files) {
+        replay_files = calloc(argc, sizeof(char *));
+        golden_files = calloc(argc, sizeof(char *));
+        if (!replay_files || !golden_files)
+          Die("memory allocation failed");
+      }
+      record_golden = (strcmp(argv[i], "--record-replay") == 0);
+      replay_files[num_replays] = argv[i + 1];
+      golden_files[num_replays++] = argv[i + 2];
+      for (int j = i; j < argc - 3; j++)
+        argv[j] = argv[j + 3];
+      argc -= 3;
+      i--;
     }
   }
   ParseConfigFile(config_file);
@@ -323,6 +399,57 @@ int main(int argc, char** argv) {
   if (g_config.audio_samples <= 0 || ((g_config.audio_samples & (g_config.audio_samples - 1)) != 0))
     g_config.audio_samples = kDefaultSamples;
 
+  if (profile_file)
+    g_config.profiler_report = profile_file;
+  Profiler_SetEnabled(g_config.profiler_report != NULL);
+  if (trace_file)
+    g_config.trace_file = trace_file;
+#ifdef NO_THREAD_LOCAL
+  // Each thread records into its own buffer, found through a thread local.
+  if (g_config.trace_file) {
+    fprintf(stderr, "Tracing isn't supported in this build\n");
+    g_config.trace_file = NULL;
+  }
+#endif
+  Tracer_SetThreadName("game");
+  if (g_config.trace_file)
+    Tracer_Start();
+
+  if (bench_file || num_replays) {
+    InitSaveDir();
+    LoadAssets();
+    LoadLinkGraphics();
+    ZeldaInitialize();
+    g_ppu_render_flags = g_config.new_renderer * kPpuRenderFlags_NewRenderer |
+                         g_config.enhanced_mode7 * kPpuRenderFlags_4x4Mode7 |
+                         g_config.extend_y * kPpuRenderFlags_Height240 |
+                         g_config.no_sprite_limits * kPpuRenderFlags_NoSpriteLimits |
+                         g_config.bg_row_cache * kPpuRenderFlags_BgRowCache;
+    if (replay_jobs <= 0)
+      replay_jobs = SDL_GetCPUCount();
+    // The msu player and the profiler only follow one game at a time, and the
+    // replays use the cpus better than render threads would.
+    if (g_config.enable_msu || g_profiler_enabled)
+      replay_jobs = 1;
+#ifdef NO_THREAD_LOCAL
+    replay_jobs = 1;
+#endif
+    if (replay_jobs > 1 && num_replays > 1)
+      g_config.render_threads = 0;
+    ZeldaEnableMsu(g_config.enable_msu);
+    SetupHeadlessEnv();
+    int rv = num_replays ? Bench_CheckReplays(num_replays, replay_files, golden_files, record_golden,
+                                              g_ppu_render_flags, replay_jobs, &SetupHeadlessEnv) :
+                           Bench_Run(bench_file, g_ppu_render_flags, g_config.audio_freq, g_config.audio_channels, seek_frame);
+    if (g_config.profiler_report)
+      Profiler_WriteReport(g_config.profiler_report);
+    ThreadPool_Shutdown();
+    if (g_config.trace_file)
+      Tracer_Write(g_config.trace_file);
+    ZeldaAudioShutdown();
+    return rv;
+  }
+
   // set up SDL early so the setup screen can use it
   if(SDL_Init(SDL_INIT_VIDEO | SDL_INIT_AUDIO | SDL_INIT_GAMECONTROLLER) != 0) {
     printf("Failed to init SDL: %s\n", SDL_GetError());
@@ -415,9 +542,14 @@ int main(int argc, char** argv) {
   g_ppu_render_flags = g_config.new_renderer * kPpuRenderFlags_NewRenderer |
                        g_config.enhanced_mode7 * kPpuRenderFlags_4x4Mode7 |
                        g_config.extend_y * kPpuRenderFlags_Height240 |
-                       g_config.no_sprite_limits * kPpuRenderFlags_NoSpriteLimits;
+                       g_config.no_sprite_limits * kPpuRenderFlags_NoSpriteLimits |
+                       g_config.bg_row_cache * kPpuRenderFlags_BgRowCache;
   ZeldaEnableMsu(g_config.enable_msu);
+  ZeldaSetResamplerQuality(g_config.resampler_quality);
   ZeldaSetLanguage(g_config.language);
+  ZeldaSetRenderThreads(g_config.render_threads);
+  ZeldaSetReplayKeyframeInterval(g_config.replay_keyframe_interval);
+  ZeldaRewindInit((size_t)g_config.rewind_memory << 20);
 
   if (g_config.fullscreen == 1)
     g_win_flags ^= SDL_WINDOW_FULLSCREEN_DESKTOP;
@@ -452,9 +584,6 @@ int main(int argc, char** argv) {
 
   SDL_AudioDeviceID device = 0;
   SDL_AudioSpec want = { 0 }, have;
-  g_audio_mutex = SDL_CreateMutex();
-  if (!g_audio_mutex) Die("No mutex");
-
   if (g_config.enable_audio) {
     want.freq = g_config.audio_freq;
     want.format = AUDIO_S16;
@@ -572,10 +701,21 @@ int main(int argc, char** argv) {
       g_gamepad_buttons = 0;
     inputs |= g_gamepad_buttons;
 
-    SDL_LockMutex(g_audio_mutex);
-    bool is_replay = ZeldaRunFrame(inputs);
-    SpatialAudio_ScanFrame();
-    SDL_UnlockMutex(g_audio_mutex);
+    if (g_replay_turbo && !g_turbo && !g_rewinding && ZeldaIsReplaying()) {
+      // Skip ahead without rendering or generating audio, only the last frame gets drawn.
+      // The spatial audio cues are rescanned below, they only depend on the current frame.
+      ZeldaSeekReplay(ZeldaGetReplayFrame() + 127);
+      frameCtr |= 0x7f;
+    }
+
+    bool is_replay = false;
+    if (g_rewinding) {
+      ZeldaRewindStep();
+    } else {
+      is_replay = ZeldaRunFrame(inputs);
+      SpatialAudio_ScanFrame();
+      ZeldaRewindCapture();
+    }
 
     frameCtr++;
 
@@ -586,8 +726,9 @@ int main(int argc, char** argv) {
     DrawPpuFrameWithPerf();
 
     if (g_config.display_perf_title) {
-      char title[60];
-      snprintf(title, sizeof(title), "%s | FPS: %d", kWindowTitle, g_curr_fps);
+      char title[128];
+      snprintf(title, sizeof(title), "%s | FPS: %d | Audio underruns: %u, dropped: %u", kWindowTitle, g_curr_fps,
+               ZeldaGetAudioUnderruns(), ZeldaGetAudioDrops());
       SDL_SetWindowTitle(g_window, title);
     }
 
@@ -619,12 +760,18 @@ int main(int argc, char** argv) {
     SDL_PauseAudioDevice(device, 1);
     SDL_CloseAudioDevice(device);
   }
+  ZeldaAudioShutdown();
+
+  if (g_config.profiler_report)
+    Profiler_WriteReport(g_config.profiler_report);
 
-  SDL_DestroyMutex(g_audio_mutex);
   free(g_audiobuffer);
 
   g_renderer_funcs.Destroy();
 
+  ThreadPool_Shutdown();
+  if (g_config.trace_file)
+    Tracer_Write(g_config.trace_file);
   SpatialAudio_Shutdown();
   Accessibility_Shutdown();
 
@@ -722,19 +869,16 @@ static void HandleCommand(uint32 j, bool pressed) {
     return;
   }
 
+  if (j == kKeys_Rewind) {
+    g_rewinding = pressed;
+    return;
+  }
+
   // Everything that might access audio state
   // (like SaveLoad and Reset) must have the lock.
-  SDL_LockMutex(g_audio_mutex);
+  ZeldaApuLock();
   HandleCommand_Locked(j, pressed);
-  SDL_UnlockMutex(g_audio_mutex);
-}
-
-void ZeldaApuLock() {
-  SDL_LockMutex(g_audio_mutex);
-}
-
-void ZeldaApuUnlock() {
-  SDL_UnlockMutex(g_audio_mutex);
+  ZeldaApuUnlock();
 }
 
 
@@ -786,6 +930,10 @@ static void HandleCommand_Locked(uint32 j, bool pressed) {
     case kKeys_WindowBigger: ChangeWindowScale(1); break;
     case kKeys_WindowSmaller: ChangeWindowScale(-1); break;
     case kKeys_DisplayPerf: g_display_perf ^= 1; break;
+    case kKeys_DisplayProfiler:
+      g_display_profiler ^= 1;
+      Profiler_SetEnabled(g_display_profiler || g_config.profiler_report);
+      break;
     case kKeys_ToggleRenderer: g_ppu_render_flags ^= kPpuRenderFlags_NewRenderer; break;
     case kKeys_VolumeUp:
     case kKeys_VolumeDown: HandleVolumeAdjustment(j == kKeys_VolumeUp ? 1 : -1); break;
@@ -989,6 +1137,67 @@ static void LoadLinkGraphics() {
 const uint8 *g_asset_ptrs[kNumberOfAssets];
 uint32 g_asset_sizes[kNumberOfAssets];
 
+static bool IsValidAssetsFile(const uint8 *data, size_t length) {
+  static const char kAssetsSig[] = { kAssets_Sig };
+  return length >= 16 + 32 + 32 + 8 + kNumberOfAssets * 4 &&
+         memcmp(data, kAssetsSig, 48) == 0 &&
+         *(uint32 *)(data + 80) == kNumberOfAssets;
+}
+
+// Applies zelda3_assets.bps to the rom. The result is kept in the save
+// directory so later runs can map it directly.
+static uint8 *LoadAssetsFromBps(size_t *length) {
+  char cache_path[PATH_MAX] = "";
+  uint8 *data;
+  if (g_save_dir[0] &&
+      snprintf(cache_path, sizeof(cache_path), "%s/zelda3_assets_bps.dat", g_save_dir) < (int)sizeof(cache_path)) {
+    data = MapWholeFile(cache_path, length);
+    if (data && IsValidAssetsFile(data, *length))
+      return data;
+    UnmapWholeFile(data, *length);
+  } else {
+    cache_path[0] = 0;
+  }
+  size_t bps_length, bps_src_length;
+  uint8 *bps, *bps_src;
+  bps = ReadWholeFile("zelda3_assets.bps", &bps_length);
+  if (!bps)
+    Die("Failed to read zelda3_assets.dat. Please see the README for information about how you get this file.");
+  bps_src = ReadWholeFile("zelda3.sfc", &bps_src_length);
+  if (!bps_src)
+    Die("Missing file: zelda3.sfc");
+  data = ApplyBps(bps_src, bps_src_length, bps, bps_length, length);
+  if (!data)
+    Die("Unable to apply zelda3_assets.bps. Please make sure you got the right version of 'zelda3.sfc'");
+  free(bps);
+  free(bps_src);
+  if (!cache_path[0] || !IsValidAssetsFile(data, *length))
+    return data;
+  // Write to a temporary file first so other instances never see half a file
+  char tmp_path[PATH_MAX + 8];
+  snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", cache_path);
+  FILE *f = fopen(tmp_path, "wb");
+  if (!f)
+    return data;
+  bool ok = fwrite(data, 1, *length, f) == *length;
+  ok = (fclose(f) == 0) && ok;
+#ifdef _WIN32
+  remove(cache_path);  // rename doesn't replace files on windows
+#endif
+  if (!ok || rename(tmp_path, cache_path) != 0) {
+    remove(tmp_path);
+    return data;
+  }
+  size_t mapped_length;
+  uint8 *mapped = MapWholeFile(cache_path, &mapped_length);
+  if (!mapped || mapped_length != *length) {
+    UnmapWholeFile(mapped, mapped_length);
+    return data;
+  }
+  free(data);
+  return mapped;
+}
+
 static void LoadAssets() {
   size_t length = 0;
   uint8 *data = NULL;
@@ -997,32 +1206,17 @@ static void LoadAssets() {
   if (g_save_dir[0]) {
     char path[PATH_MAX];
     snprintf(path, sizeof(path), "%s/zelda3_assets.dat", g_save_dir);
-    data = ReadWholeFile(path, &length);
+    data = MapWholeFile(path, &length);
   }
 
   // Fall back to current directory
   if (!data)
-    data = ReadWholeFile("zelda3_assets.dat", &length);
-
-  if (!data) {
-    size_t bps_length, bps_src_length;
-    uint8 *bps, *bps_src;
-    bps = ReadWholeFile("zelda3_assets.bps", &bps_length);
-    if (!bps)
-      Die("Failed to read zelda3_assets.dat. Please see the README for information about how you get this file.");
-    bps_src = ReadWholeFile("zelda3.sfc", &bps_src_length);
-    if (!bps_src)
-      Die("Missing file: zelda3.sfc");
-    data = ApplyBps(bps_src, bps_src_length, bps, bps_length, &length);
-    if (!data)
-      Die("Unable to apply zelda3_assets.bps. Please make sure you got the right version of 'zelda3.sfc'");
-  }
+    data = MapWholeFile("zelda3_assets.dat", &length);
 
-  static const char kAssetsSig[] = { kAssets_Sig };
+  if (!data)
+    data = LoadAssetsFromBps(&length);
 
-  if (length < 16 + 32 + 32 + 8 + kNumberOfAssets * 4 ||
-      memcmp(data, kAssetsSig, 48) != 0 ||
-      *(uint32*)(data + 80) != kNumberOfAssets)
+  if (!IsValidAssetsFile(data, length))
     Die("Invalid assets file");
 
   uint32 offset = 88 + kNumberOfAssets * 4 + *(uint32 *)(data + 84);
@@ -1037,6 +1231,10 @@ static void LoadAssets() {
     offset += size;
   }
 
+  // The intro music and Link's graphics are needed right away
+  PrefetchMappedData(kSoundBank_intro, kSoundBank_intro_SIZE);
+  PrefetchMappedData(kLinkGraphics, kLinkGraphics_SIZE);
+
   if (g_config.features0 & kFeatures0_DimFlashes) { // patch dungeon floor palettes
     kPalette_DungBgMain[0x484] = 0x70;
     kPalette_DungBgMain[0x485] = 0x95;
@@ -273,6 +273,7 @@ void TransferMode7Characters() {  // 80e399
   const uint8 *src = kOverworldMapGfx;
   for (int i = 0; i != 0x4000; i++)
     HIBYTE(dst[i]) = src[i];
+  ZeldaMarkVramDirty(0, 0x4000);
 }
 
 void Module0E_Interface() {  // 80f800
@@ -1280,6 +1281,7 @@ void WorldMap_FillTilemapWithEF() {  // 8abda5
   uint16 *dst = g_zenv.vram;
   for (int i = 0; i != 0x4000; i++)
     BYTE(dst[i]) = 0xef;
+  ZeldaMarkVramDirty(0, 0x4000);
 }
 
 void WorldMap_HandleSprites() {  // 8abf66
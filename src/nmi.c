@@ -6,6 +6,8 @@
 #include "snes/ppu.h"
 #include "assets.h"
 #include "audio.h"
+#include "profiler.h"
+#include "tracer.h"
 
 static const uint8 kNmiVramAddrs[] = {
   0, 0, 4, 8, 12, 8, 12, 0, 4, 0, 8, 4, 12, 4, 12, 0,
@@ -49,6 +51,7 @@ void NMI_UploadSubscreenOverlayLatter() {
 
 static void CopyToVram(uint32 dstv, const uint8 *src, int len) {
   memcpy(&g_zenv.vram[dstv], src, len);
+  ZeldaMarkVramDirty(dstv, len >> 1);
 }
 
 static void CopyToVramVertical(uint32 dstv, const uint8 *src, int len) {
@@ -56,12 +59,14 @@ static void CopyToVramVertical(uint32 dstv, const uint8 *src, int len) {
   uint16 *dst = &g_zenv.vram[dstv];
   for (int i = 0, i_end = len >> 1; i < i_end; i++, dst += 32, src += 2)
     *dst = WORD(*src);
+  ZeldaMarkVramDirty(dstv, (len >> 1) * 32);
 }
 
 static void CopyToVramLow(const uint8 *src, uint32 addr, int num) {
   uint16 *dst = &g_zenv.vram[addr];
   for (int i = 0; i < num; i++)
     dst[i] = (dst[i] & ~0xff) | src[i];
+  ZeldaMarkVramDirty(addr, num);
 }
 
 void WritePpuRegisters() {
@@ -141,7 +146,11 @@ void Interrupt_NMI(uint16 joypad_input) {  // 8080c9
 
   if (!nmi_boolean) {
     nmi_boolean = true;
+    uint64 prof = Profiler_Begin();
+    Tracer_Begin("nmi upload");
     NMI_DoUpdates();
+    Tracer_End("nmi upload");
+    Profiler_End(kProfZone_Nmi, prof);
     NMI_ReadJoypads(joypad_input);
   }
 
@@ -200,12 +209,18 @@ void NMI_DoUpdates() {  // 8089e0
       memcpy(&g_zenv.vram[0x40e0], &g_ram[dma_source_addr_20], 0x40);
       memcpy(&g_zenv.vram[0x41e0], &g_ram[dma_source_addr_21], 0x40);
     }
+    ZeldaMarkVramDirty(0x4000, 0x400);
 
-    memcpy(&g_zenv.vram[animated_tile_vram_addr], &g_ram[animated_tile_data_src], 0x400);
+    // This is uploaded every frame, but only changes when the animation advances
+    if (memcmp(&g_zenv.vram[animated_tile_vram_addr], &g_ram[animated_tile_data_src], 0x400)) {
+      memcpy(&g_zenv.vram[animated_tile_vram_addr], &g_ram[animated_tile_data_src], 0x400);
+      ZeldaMarkVramDirty(animated_tile_vram_addr, 0x200);
+    }
   }
 
   if (flag_update_hud_in_nmi) {
     memcpy(&g_zenv.vram[word_7E0219], hud_tile_indices_buffer, 165 * sizeof(uint16));
+    ZeldaMarkVramDirty(word_7E0219, 165);
   }
 
   if (flag_update_cgram_in_nmi) {
@@ -239,6 +254,7 @@ void NMI_DoUpdates() {  // 8089e0
 
   if (nmi_update_tilemap_dst) {
     memcpy(&g_zenv.vram[nmi_update_tilemap_dst * 256], &g_ram[0x10000 + nmi_update_tilemap_src], 0x200);
+    ZeldaMarkVramDirty(nmi_update_tilemap_dst * 256, 0x100);
     nmi_update_tilemap_dst = 0;
   }
 
@@ -252,12 +268,14 @@ void NMI_DoUpdates() {  // 8089e0
       if (vmain == 0x80) {
         // plain copy
         memcpy(&g_zenv.vram[dst], p, len);
+        ZeldaMarkVramDirty(dst, len >> 1);
       } else if (vmain == 0x81) {
         // copy with other increment
         assert((len & 1) == 0);
         uint16 *dp = &g_zenv.vram[dst];
         for (int i = 0; i < len; i += 2, dp += 32)
           *dp = WORD(p[i]);
+        ZeldaMarkVramDirty(dst, (len >> 1) * 32);
       } else {
         assert(0);
       }
@@ -274,6 +292,7 @@ void NMI_DoUpdates() {  // 8089e0
 
 void NMI_UploadTilemap() {  // 808cb0
   memcpy(&g_zenv.vram[kNmiVramAddrs[BYTE(nmi_load_target_addr)] << 8], &g_ram[0x1000], 0x800);
+  ZeldaMarkVramDirty(kNmiVramAddrs[BYTE(nmi_load_target_addr)] << 8, 0x400);
 
   *(uint16 *)&g_ram[0x1000] = 0;
   nmi_disable_core_updates = 0;
@@ -284,6 +303,7 @@ void NMI_UploadTilemap_doNothing() {  // 808ce3
 
 void NMI_UploadBG3Text() {  // 808ce4
   memcpy(&g_zenv.vram[0x7c00], &g_ram[0x10000], 0x7e0);
+  ZeldaMarkVramDirty(0x7c00, 0x3f0);
   nmi_disable_core_updates = 0;
 }
 
@@ -295,6 +315,7 @@ void NMI_UpdateOWScroll() {  // 808d13
   src += 2;
   do {
     uint16 *dst = &g_zenv.vram[WORD(src[0])];
+    ZeldaMarkVramDirty(WORD(src[0]), (len >> 1) * step);
     src += 2;
     for (int i = 0, i_end = len >> 1; i < i_end; i++, dst += step, src += 2)
       *dst = WORD(*src);
@@ -310,6 +331,7 @@ void NMI_HandleArbitraryTileMap(const uint8 *src, int i, int i_end) {  // 808dae
   uint16 *r10 = &word_7F4000;
   do {
     memcpy(&g_zenv.vram[r10[i >> 1]], src, 0x80);
+    ZeldaMarkVramDirty(r10[i >> 1], 0x40);
     src += 0x80;
   } while ((i += 2) != i_end);
   nmi_disable_core_updates = 0;
@@ -344,16 +366,19 @@ void NMI_UpdateBG2Left() {  // 808ea9
 
 void NMI_UpdateBGChar3and4() {  // 808ee7
   memcpy(&g_zenv.vram[0x2c00], &g_ram[0x10000], 0x1000);
+  ZeldaMarkVramDirty(0x2c00, 0x800);
   nmi_disable_core_updates = 0;
 }
 
 void NMI_UpdateBGChar5and6() {  // 808f16
   memcpy(&g_zenv.vram[0x3400], &g_ram[0x11000], 0x1000);
+  ZeldaMarkVramDirty(0x3400, 0x800);
   nmi_disable_core_updates = 0;
 }
 
 void NMI_UpdateBGCharHalf() {  // 808f45
   memcpy(&g_zenv.vram[BYTE(nmi_load_target_addr) * 256], &g_ram[0x11000], 0x400);
+  ZeldaMarkVramDirty(BYTE(nmi_load_target_addr) * 256, 0x200);
 }
 
 void NMI_UpdateBGChar0() {  // 808f72
@@ -421,6 +446,7 @@ void HandleStripes14(const uint8 *p) {  // 8092a1
     int len = (swap16(WORD(p[2])) & 0x3fff) + 1;
     p += 4;
 
+    ZeldaMarkVramDirty(vmem_addr, vram_incr_amount ? (len + 1 >> 1) * 32 : len + 1 >> 1);
     if (vram_incr_amount == 0) {
       uint16 *dst = &g_zenv.vram[vmem_addr];
       if (is_memset) {
@@ -455,6 +481,7 @@ void HandleStripes14(const uint8 *p) {  // 8092a1
 void NMI_UpdateIRQGFX() {  // 809347
   if (nmi_flag_update_polyhedral) {
     memcpy(&g_zenv.vram[0x5800], &g_ram[0xe800], 0x800);
+    ZeldaMarkVramDirty(0x5800, 0x400);
     nmi_flag_update_polyhedral = 0;
   }
 }
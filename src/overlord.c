@@ -2,6 +2,7 @@
 #include "sprite.h"
 #include "misc.h"
 #include "sprite_main.h"
+#include "profiler.h"
 
 uint16 Overlord_GetX(int k) { return (overlord_x_lo[k] | overlord_x_hi[k] << 8); }
 uint16 Overlord_GetY(int k) { return (overlord_y_lo[k] | overlord_y_hi[k] << 8); }
@@ -81,8 +82,10 @@ void Overlord_SpawnBoulder() {  // 89b714
 }
 
 void Overlord_Main() {  // 89b773
+  uint64 prof = Profiler_Begin();
   Overlord_ExecuteAll();
   Overlord_SpawnBoulder();
+  Profiler_End(kProfZone_Overlords, prof);
 }
 
 void Overlord_ExecuteAll() {  // 89b77e
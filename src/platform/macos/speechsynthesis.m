@@ -1,5 +1,6 @@
 #import <AVFoundation/AVFoundation.h>
 #include "speechsynthesis.h"
+#include "../../tracer.h"
 #include <string.h>
 #include <stdlib.h>
 
@@ -94,6 +95,7 @@ static AVSpeechUtterance *MakeUtterance(const char *text) {
 void SpeechSynthesis_Speak(const char *text) {
   if (!g_synth || !text || !text[0])
     return;
+  Tracer_Begin("speech");
   @autoreleasepool {
     if ([g_synth isSpeaking])
       [g_synth stopSpeakingAtBoundary:AVSpeechBoundaryImmediate];
@@ -101,16 +103,19 @@ void SpeechSynthesis_Speak(const char *text) {
     if (utterance)
       [g_synth speakUtterance:utterance];
   }
+  Tracer_End("speech");
 }
 
 void SpeechSynthesis_SpeakQueued(const char *text) {
   if (!g_synth || !text || !text[0])
     return;
+  Tracer_Begin("speech queued");
   @autoreleasepool {
     AVSpeechUtterance *utterance = MakeUtterance(text);
     if (utterance)
       [g_synth speakUtterance:utterance];
   }
+  Tracer_End("speech queued");
 }
 
 void SpeechSynthesis_AdjustRate(int direction) {
@@ -4,6 +4,7 @@
 #ifdef _WIN32
 
 #include "speechsynthesis.h"
+#include "../../tracer.h"
 #include <windows.h>
 #include <stdlib.h>
 
@@ -44,21 +45,25 @@ void SpeechSynthesis_Init(void) {
 
 void SpeechSynthesis_Speak(const char *text) {
   if (!g_nvda_available || !text) return;
+  Tracer_Begin("speech");
   g_cancelSpeech();
   wchar_t *wide = Utf8ToWide(text);
   if (wide) {
     g_speakText(wide);
     free(wide);
   }
+  Tracer_End("speech");
 }
 
 void SpeechSynthesis_SpeakQueued(const char *text) {
   if (!g_nvda_available || !text) return;
+  Tracer_Begin("speech queued");
   wchar_t *wide = Utf8ToWide(text);
   if (wide) {
     g_speakText(wide);
     free(wide);
   }
+  Tracer_End("speech queued");
 }
 
 void SpeechSynthesis_AdjustRate(int direction) {
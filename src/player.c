@@ -12,8 +12,9 @@
 #include "misc.h"
 #include "player_oam.h"
 #include "sprite_main.h"
+#include "profiler.h"
 
-static bool g_ApplyLinksMovementToCamera_called;
+#define g_ApplyLinksMovementToCamera_called (g_zenv.link_moved_camera)
 
 static const uint8 kSpinAttackDelays[] = { 1, 0, 0, 0, 0, 3, 0, 0, 1, 0, 3, 3, 3, 3, 4, 4, 1, 5 };
 static const uint8 kFireBeamSounds[] = { 1, 2, 3, 4, 0, 9, 18, 27 };
@@ -136,13 +137,14 @@ void Link_Main() {  // 878000
 //  return;
 
 
-
+  uint64 prof = Profiler_Begin();
   link_x_coord_prev = link_x_coord;
   link_y_coord_prev = link_y_coord;
   flag_unk1 = 0;
   if (!flag_is_link_immobilized)
     Link_ControlHandler();
   HandleSomariaAndGraves();
+  Profiler_End(kProfZone_Player, prof);
 }
 
 void Link_ControlHandler() {  // 87807f
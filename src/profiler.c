@@ -0,0 +1,406 @@
+#include <stdio.h>
+#include <string.h>
+#include <SDL.h>
+
+#include "profiler.h"
+#include "util.h"
+#include "embed_font.h"
+
+enum {
+  kProf_Modules = 28,
+  kProf_HistBuckets = 32,
+  // The overlay shows averages over this many frames
+  kProf_OverlayFrames = 32,
+};
+
+// Bucket i counts the durations below kHistLimitUs[i] microseconds, the last
+// one everything above.
+static const uint32 kHistLimitUs[kProf_HistBuckets - 1] = {
+  1, 2, 3, 4, 6, 8, 12, 16, 24, 32, 48, 64, 96, 128, 192, 256, 384, 512,
+  768, 1024, 1536, 2048, 3072, 4096, 6144, 8192, 12288, 16384, 24576, 32768, 49152,
+};
+
+static const char *const kZoneNames[kProfZone_Count] = {
+  "logic", "module", "player", "sprites", "ancillas", "overlords", "nmi", "ppu", "audio",
+};
+
+static const char *const kModuleNames[kProf_Modules] = {
+  "Intro", "FileSelect", "CopyFile", "KillFile", "NameFile", "LoadFile", "PreDungeon", "Dungeon",
+  "OverworldLoad", "Overworld", "SpecialOverworldLoad", "SpecialOverworld", "Unknown0", "Unknown1",
+  "Interface", "SpotlightClose", "SpotlightOpen", "DungeonFallingEntrance", "GameOver",
+  "BossVictoryPendant", "Attract", "MirrorWarpFromAga", "BossVictoryCrystal", "SaveAndQuit",
+  "GanonEmerges", "TriforceRoom", "Credits", "SpawnSelect",
+};
+
+typedef struct ProfStats {
+  uint32 count;
+  uint32 hist[kProf_HistBuckets];
+  uint64 total, max;
+} ProfStats;
+
+typedef struct ObjStats {
+  uint32 count;
+  uint64 total;
+} ObjStats;
+
+typedef struct Profiler {
+  double us_per_tick;
+  // Indexed by submodule and zone, allocated the first time a module is seen.
+  ProfStats *modules[kProf_Modules];
+  // Time of the current frame.
+  bool in_frame;
+  uint8 module, submodule;
+  uint16 room;
+  uint32 zones_hit;
+  uint64 frame_ticks[kProfZone_Count];
+  // For the overlay
+  uint32 window_frames;
+  uint64 window_ticks[kProfZone_Count];
+  uint32 window_audio_count;
+  uint64 window_audio_total;
+  float shown_ms[kProfZone_Count];
+  uint8 shown_module, shown_submodule;
+  // Per object type, and per room of each type, allocated on first use.
+  ObjStats objs[kProfObj_Count][256];
+  ObjStats *obj_rooms[kProfObj_Count][256];
+  // Written by the audio thread
+  SDL_SpinLock audio_lock;
+  ProfStats audio;
+} Profiler;
+
+bool g_profiler_enabled;
+static Profiler g_prof;
+
+uint64 Profiler_Now(void) {
+  return SDL_GetPerformanceCounter();
+}
+
+void Profiler_SetEnabled(bool enabled) {
+  if (g_prof.us_per_tick == 0)
+    g_prof.us_per_tick = 1e6 / (double)SDL_GetPerformanceFrequency();
+  g_profiler_enabled = enabled;
+}
+
+static void ProfStats_Add(ProfStats *s, uint64 ticks) {
+  uint32 us = (uint32)(ticks * g_prof.us_per_tick);
+  int b = 0;
+  while (b < kProf_HistBuckets - 1 && us >= kHistLimitUs[b])
+    b++;
+  s->hist[b]++;
+  s->count++;
+  s->total += ticks;
+  if (ticks > s->max)
+    s->max = ticks;
+}
+
+static void ProfStats_Merge(ProfStats *s, const ProfStats *o) {
+  for (int i = 0; i < kProf_HistBuckets; i++)
+    s->hist[i] += o->hist[i];
+  s->count += o->count;
+  s->total += o->total;
+  if (o->max > s->max)
+    s->max = o->max;
+}
+
+// Upper limit of the bucket that contains the |pct| percentile.
+static uint32 ProfStats_Percentile(const ProfStats *s, int pct) {
+  uint64 want = ((uint64)s->count * pct + 99) / 100, n = 0;
+  for (int i = 0; i < kProf_HistBuckets - 1; i++) {
+    if ((n += s->hist[i]) >= want)
+      return kHistLimitUs[i];
+  }
+  return (uint32)(s->max * g_prof.us_per_tick);
+}
+
+void Profiler_AddTicks(int zone, uint64 ticks) {
+  if (zone == kProfZone_Audio) {
+    SDL_AtomicLock(&g_prof.audio_lock);
+    ProfStats_Add(&g_prof.audio, ticks);
+    SDL_AtomicUnlock(&g_prof.audio_lock);
+    return;
+  }
+  g_prof.zones_hit |= 1 << zone;
+  g_prof.frame_ticks[zone] += ticks;
+}
+
+void Profiler_AddObjectTicks(int kind, uint8 type, uint64 ticks) {
+  ObjStats *s = &g_prof.objs[kind][type];
+  s->count++;
+  s->total += ticks;
+  if (!g_prof.in_frame)
+    return;
+  ObjStats *r = g_prof.obj_rooms[kind][type];
+  if (!r) {
+    r = g_prof.obj_rooms[kind][type] = calloc(kProfRoom_Count, sizeof(ObjStats));
+    if (!r)
+      Die("memory allocation failed");
+  }
+  r[g_prof.room].count++;
+  r[g_prof.room].total += ticks;
+}
+
+static void Profiler_UpdateOverlay(void) {
+  SDL_AtomicLock(&g_prof.audio_lock);
+  uint32 audio_count = g_prof.audio.count;
+  uint64 audio_total = g_prof.audio.total;
+  SDL_AtomicUnlock(&g_prof.audio_lock);
+  float ms_per_tick = (float)(g_prof.us_per_tick * 1e-3);
+  for (int i = 0; i < kProfZone_Count; i++) {
+    g_prof.shown_ms[i] = g_prof.window_ticks[i] * ms_per_tick / g_prof.window_frames;
+    g_prof.window_ticks[i] = 0;
+  }
+  uint32 n = audio_count - g_prof.window_audio_count;
+  g_prof.shown_ms[kProfZone_Audio] = n ? (audio_total - g_prof.window_audio_total) * ms_per_tick / n : 0;
+  g_prof.window_audio_count = audio_count;
+  g_prof.window_audio_total = audio_total;
+  g_prof.window_frames = 0;
+  g_prof.shown_module = g_prof.module;
+  g_prof.shown_submodule = g_prof.submodule;
+}
+
+static void Profiler_EndFrame(void) {
+  if (!g_prof.in_frame)
+    return;
+  g_prof.in_frame = false;
+  ProfStats *s = g_prof.modules[g_prof.module];
+  if (!s) {
+    s = g_prof.modules[g_prof.module] = calloc(256 * kProfZone_Count, sizeof(ProfStats));
+    if (!s)
+      Die("memory allocation failed");
+  }
+  s += g_prof.submodule * kProfZone_Count;
+  for (int i = 0; i < kProfZone_Count; i++) {
+    if (g_prof.zones_hit & (1 << i))
+      ProfStats_Add(&s[i], g_prof.frame_ticks[i]);
+    g_prof.window_ticks[i] += g_prof.frame_ticks[i];
+    g_prof.frame_ticks[i] = 0;
+  }
+  g_prof.zones_hit = 0;
+  if (++g_prof.window_frames == kProf_OverlayFrames)
+    Profiler_UpdateOverlay();
+}
+
+void Profiler_BeginFrame(uint8 module, uint8 submodule, uint16 room) {
+  Profiler_EndFrame();
+  memset(g_prof.frame_ticks, 0, sizeof(g_prof.frame_ticks));
+  g_prof.zones_hit = 0;
+  if (!g_profiler_enabled || module >= kProf_Modules)
+    return;
+  g_prof.in_frame = true;
+  g_prof.module = module;
+  g_prof.submodule = submodule;
+  g_prof.room = room < kProfRoom_Count ? room : 0;
+}
+
+static void DrawText(uint8 *dst, size_t pitch, const char *s, uint32 color, int scale) {
+  for (; *s; s++, dst += 8 * scale * sizeof(uint32)) {
+    if (*s < 32 || *s > 126)
+      continue;
+    const uint8 *glyph = kFont8x8[*s - 32];
+    for (int y = 0; y < 8 * scale; y++) {
+      uint32 *row = (uint32 *)(dst + y * pitch);
+      for (int x = 0; x < 8 * scale; x++) {
+        if (glyph[y / scale] & (0x80 >> (x / scale)))
+          row[x] = color;
+      }
+    }
+  }
+}
+
+void Profiler_DrawOverlay(uint8 *pixels, size_t pitch, bool big) {
+  int scale = big ? 2 : 1;
+  char line[kProfZone_Count + 1][32];
+  snprintf(line[0], sizeof(line[0]), "module %.2X.%.2X", g_prof.shown_module, g_prof.shown_submodule);
+  for (int i = 0; i < kProfZone_Count; i++)
+    snprintf(line[i + 1], sizeof(line[i + 1]), "%-9s %6.3f", kZoneNames[i], g_prof.shown_ms[i]);
+  for (int i = 0; i <= kProfZone_Count; i++) {
+    uint8 *dst = pixels + i * 9 * scale * pitch + 2 * scale * sizeof(uint32);
+    DrawText(dst + scale * (pitch + sizeof(uint32)), pitch, line[i], 0x404040, scale);
+    DrawText(dst, pitch, line[i], 0xffffff, scale);
+  }
+}
+
+typedef struct ReportWriter {
+  FILE *f;
+  bool json;
+  bool first;
+} ReportWriter;
+
+static void ReportWriter_Entry(ReportWriter *w, int module, int submodule, int zone, const ProfStats *s) {
+  double ms = g_prof.us_per_tick * 1e-3;
+  char mod[8] = "all", submod[8] = "all";
+  if (module >= 0)
+    snprintf(mod, sizeof(mod), "%d", module);
+  if (submodule >= 0)
+    snprintf(submod, sizeof(submod), "%d", submodule);
+  const char *name = module >= 0 ? kModuleNames[module] : "all";
+  if (w->json) {
+    fprintf(w->f, "%s\n    {\"module\": \"%s\", \"name\": \"%s\", \"submodule\": \"%s\", \"zone\": \"%s\", "
+            "\"count\": %u, \"total_ms\": %.3f, \"avg_us\": %.1f, \"max_us\": %.1f, "
+            "\"p50_us\": %u, \"p90_us\": %u, \"p99_us\": %u, \"hist\": [",
+            w->first ? "" : ",", mod, name, submod, kZoneNames[zone],
+            s->count, s->total * ms, s->total * ms * 1e3 / s->count, s->max * ms * 1e3,
+            ProfStats_Percentile(s, 50), ProfStats_Percentile(s, 90), ProfStats_Percentile(s, 99));
+    for (int i = 0; i < kProf_HistBuckets; i++)
+      fprintf(w->f, "%s%u", i ? ", " : "", s->hist[i]);
+    fprintf(w->f, "]}");
+  } else {
+    fprintf(w->f, "%s,%s,%s,%s,%u,%.3f,%.1f,%.1f,%u,%u,%u", mod, name, submod, kZoneNames[zone],
+            s->count, s->total * ms, s->total * ms * 1e3 / s->count, s->max * ms * 1e3,
+            ProfStats_Percentile(s, 50), ProfStats_Percentile(s, 90), ProfStats_Percentile(s, 99));
+    for (int i = 0; i < kProf_HistBuckets; i++)
+      fprintf(w->f, ",%u", s->hist[i]);
+    fprintf(w->f, "\n");
+  }
+  w->first = false;
+}
+
+static const char *const kObjKindNames[kProfObj_Count] = { "sprite", "ancilla" };
+
+static void FormatRoom(char *buf, size_t size, int room) {
+  if (room < 0)
+    snprintf(buf, size, "all");
+  else if (room >= kProfRoom_Overworld)
+    snprintf(buf, size, "ow_%.2x", room - kProfRoom_Overworld);
+  else
+    snprintf(buf, size, "room_%.3x", room);
+}
+
+static void ReportWriter_Object(ReportWriter *w, int kind, int type, int room, const ObjStats *s) {
+  double ms = g_prof.us_per_tick * 1e-3;
+  char room_str[16];
+  FormatRoom(room_str, sizeof(room_str), room);
+  if (w->json) {
+    fprintf(w->f, "%s\n    {\"kind\": \"%s\", \"type\": %d, \"room\": \"%s\", \"count\": %u, "
+            "\"total_ms\": %.3f, \"avg_us\": %.2f}",
+            w->first ? "" : ",", kObjKindNames[kind], type, room_str, s->count, s->total * ms,
+            s->total * ms * 1e3 / s->count);
+  } else {
+    fprintf(w->f, "%s,%d,%s,%u,%.3f,%.2f\n", kObjKindNames[kind], type, room_str, s->count, s->total * ms,
+            s->total * ms * 1e3 / s->count);
+  }
+  w->first = false;
+}
+
+// Each type with all rooms, then split up by room.
+static void ReportWriter_Objects(ReportWriter *w) {
+  for (int kind = 0; kind < kProfObj_Count; kind++) {
+    for (int type = 0; type < 256; type++) {
+      if (!g_prof.objs[kind][type].count)
+        continue;
+      ReportWriter_Object(w, kind, type, -1, &g_prof.objs[kind][type]);
+      const ObjStats *r = g_prof.obj_rooms[kind][type];
+      for (int room = 0; r && room < kProfRoom_Count; room++) {
+        if (r[room].count)
+          ReportWriter_Object(w, kind, type, room, &r[room]);
+      }
+    }
+  }
+}
+
+static bool WriteObjectsCsv(const char *filename) {
+  const char *ext = strrchr(filename, '.');
+  int base_len = ext && !strpbrk(ext, "/\\") ? (int)(ext - filename) : (int)strlen(filename);
+  char *name = StrFmt("%.*s_objects%s", base_len, filename, filename + base_len);
+  ReportWriter w = { fopen(name, "w"), false, true };
+  if (!w.f) {
+    fprintf(stderr, "Unable to write %s\n", name);
+    free(name);
+    return false;
+  }
+  fprintf(w.f, "kind,type,room,count,total_ms,avg_us\n");
+  ReportWriter_Objects(&w);
+  fclose(w.f);
+  free(name);
+  return true;
+}
+
+bool Profiler_WriteReport(const char *filename) {
+  Profiler_EndFrame();
+  size_t len = strlen(filename);
+  ReportWriter w = { fopen(filename, "w"), len >= 5 && StringEqualsNoCase(filename + len - 5, ".json"), true };
+  if (!w.f) {
+    fprintf(stderr, "Unable to write %s\n", filename);
+    return false;
+  }
+  if (w.json) {
+    fprintf(w.f, "{\n  \"hist_limits_us\": [");
+    for (int i = 0; i < kProf_HistBuckets - 1; i++)
+      fprintf(w.f, "%s%u", i ? ", " : "", kHistLimitUs[i]);
+    fprintf(w.f, "],\n  \"entries\": [");
+  } else {
+    fprintf(w.f, "module,name,submodule,zone,count,total_ms,avg_us,max_us,p50_us,p90_us,p99_us");
+    for (int i = 0; i < kProf_HistBuckets - 1; i++)
+      fprintf(w.f, ",lt%uus", kHistLimitUs[i]);
+    fprintf(w.f, ",ge%uus\n", kHistLimitUs[kProf_HistBuckets - 2]);
+  }
+  // The whole module first, then each submodule of it.
+  for (int m = 0; m < kProf_Modules; m++) {
+    const ProfStats *s = g_prof.modules[m];
+    if (!s)
+      continue;
+    for (int z = 0; z < kProfZone_Count; z++) {
+      ProfStats sum = { 0 };
+      for (int sm = 0; sm < 256; sm++)
+        ProfStats_Merge(&sum, &s[sm * kProfZone_Count + z]);
+      if (sum.count)
+        ReportWriter_Entry(&w, m, -1, z, &sum);
+    }
+    for (int sm = 0; sm < 256; sm++) {
+      for (int z = 0; z < kProfZone_Count; z++) {
+        if (s[sm * kProfZone_Count + z].count)
+          ReportWriter_Entry(&w, m, sm, z, &s[sm * kProfZone_Count + z]);
+      }
+    }
+  }
+  SDL_AtomicLock(&g_prof.audio_lock);
+  ProfStats audio = g_prof.audio;
+  SDL_AtomicUnlock(&g_prof.audio_lock);
+  if (audio.count)
+    ReportWriter_Entry(&w, -1, -1, kProfZone_Audio, &audio);
+  if (w.json) {
+    fprintf(w.f, "\n  ],\n  \"objects\": [");
+    w.first = true;
+    ReportWriter_Objects(&w);
+    fprintf(w.f, "\n  ]\n}\n");
+  }
+  fclose(w.f);
+  return w.json || WriteObjectsCsv(filename);
+}
+
+typedef struct TopObject {
+  uint64 total;
+  uint32 count;
+  uint8 kind, type;
+} TopObject;
+
+static int CompareTopObject(const void *a, const void *b) {
+  uint64 x = ((const TopObject *)a)->total, y = ((const TopObject *)b)->total;
+  return x < y ? 1 : x > y ? -1 : 0;
+}
+
+void Profiler_PrintTopObjects(int n) {
+  TopObject top[kProfObj_Count * 256];
+  int num = 0;
+  uint64 sum = 0;
+  for (int kind = 0; kind < kProfObj_Count; kind++) {
+    for (int type = 0; type < 256; type++) {
+      const ObjStats *s = &g_prof.objs[kind][type];
+      if (s->count) {
+        top[num++] = (TopObject){ s->total, s->count, kind, type };
+        sum += s->total;
+      }
+    }
+  }
+  if (!sum)
+    return;
+  qsort(top, num, sizeof(TopObject), &CompareTopObject);
+  double ms = g_prof.us_per_tick * 1e-3;
+  printf("%-12s %8s %10s %10s %6s\n", "object", "calls", "total ms", "avg us", "share");
+  for (int i = 0; i < num && i < n; i++) {
+    char name[16];
+    snprintf(name, sizeof(name), "%s %.2x", kObjKindNames[top[i].kind], top[i].type);
+    printf("%-12s %8u %10.3f %10.2f %5.1f%%\n", name, top[i].count, top[i].total * ms,
+           top[i].total * ms * 1e3 / top[i].count, top[i].total * 100.0 / sum);
+  }
+}
@@ -0,0 +1,68 @@
+#ifndef ZELDA3_PROFILER_H_
+#define ZELDA3_PROFILER_H_
+
+#include "types.h"
+
+// Measures how long the parts of each frame take, grouped by the module and
+// submodule the game was in when the frame started. Zones nest, so the time
+// of sprites includes ancillas and overlords, and logic includes everything
+// but ppu and audio.
+enum {
+  kProfZone_Logic,
+  kProfZone_Module,
+  kProfZone_Player,
+  kProfZone_Sprites,
+  kProfZone_Ancillas,
+  kProfZone_Overlords,
+  kProfZone_Nmi,
+  kProfZone_Ppu,
+  kProfZone_Audio,  // recorded per audio block, on the audio thread
+  kProfZone_Count,
+};
+
+// Kinds of objects whose handlers are timed one by one, per type and room.
+enum {
+  kProfObj_Sprite,
+  kProfObj_Ancilla,
+  kProfObj_Count,
+};
+
+// Rooms are either a dungeon room, or this plus an overworld area.
+enum {
+  kProfRoom_Overworld = 0x200,
+  kProfRoom_Count = 0x300,
+};
+
+extern bool g_profiler_enabled;
+
+void Profiler_SetEnabled(bool enabled);
+uint64 Profiler_Now(void);
+void Profiler_AddTicks(int zone, uint64 ticks);
+void Profiler_AddObjectTicks(int kind, uint8 type, uint64 ticks);
+
+static inline uint64 Profiler_Begin(void) {
+  return g_profiler_enabled ? Profiler_Now() : 0;
+}
+
+static inline void Profiler_End(int zone, uint64 start) {
+  if (start)
+    Profiler_AddTicks(zone, Profiler_Now() - start);
+}
+
+static inline void Profiler_EndObject(int kind, uint8 type, uint64 start) {
+  if (start)
+    Profiler_AddObjectTicks(kind, type, Profiler_Now() - start);
+}
+
+// Called at the start of every game frame, before the game logic runs.
+void Profiler_BeginFrame(uint8 module, uint8 submodule, uint16 room);
+// Draws the recent time per frame of each zone into an xrgb8888 buffer.
+void Profiler_DrawOverlay(uint8 *pixels, size_t pitch, bool big);
+// Writes the histograms of every module, as json if the filename ends
+// with .json and otherwise as csv. In the csv case the time of each
+// object type goes to a second file, named like the first plus _objects.
+bool Profiler_WriteReport(const char *filename);
+// Prints the |n| object types that took the most time.
+void Profiler_PrintTopObjects(int n);
+
+#endif  // ZELDA3_PROFILER_H_
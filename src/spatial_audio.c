@@ -3,8 +3,10 @@
 #include "variables.h"
 #include "features.h"
 #include "tile_detect.h"
+#include "overworld.h"
 #include "zelda_rtl.h"
 #include "assets.h"
+#include "spsc_ring.h"
 #include <string.h>
 #include <stdio.h>
 #include <stdarg.h>
@@ -21,8 +23,37 @@ typedef struct SpatialCue {
   bool active;
 } SpatialCue;
 
-// Snapshot: one cue per category
-static SpatialCue g_cue_snapshot[kSpatialCue_Count];
+// One-shot sounds that the scan starts
+enum {
+  kSpatialTrigger_Silence = 1 << 0,  // stop everything, not in a playable module
+  kSpatialTrigger_DangerEnter = 1 << 1,
+  kSpatialTrigger_DangerLeave = 1 << 2,
+  kSpatialTrigger_RoomChime = 1 << 3,
+  kSpatialTrigger_Terrain = 1 << 4,
+  kSpatialTrigger_Passage = 1 << 5,  // one bit per direction
+};
+
+// Everything the scan on the game thread hands to the mixer on the audio
+// thread. The scan updates g_scan_set and pushes a copy of it through
+// g_cue_ring each frame, the mixer applies them to g_mix_set.
+typedef struct SpatialCueSet {
+  SpatialCue cues[kSpatialCue_Count];  // one cue per category
+  int wall_interval[4];  // repeat interval per direction
+  int align_interval;    // samples between pings (varies with precision)
+  bool sword_range_active;
+  bool hole_warn_active;
+  bool blocked_active;
+  int16 hole_warn_dx, hole_warn_dy;  // direction of nearest danger hole
+  uint8 terrain;
+  uint16 triggers;
+  uint32 passage_inc1[4];  // note 1 phase increment
+  uint32 passage_inc2[4];  // note 2 phase increment
+  int passage_pan_L[4];    // left gain
+  int passage_pan_R[4];    // right gain
+} SpatialCueSet;
+
+static SpatialCueSet g_scan_set, g_mix_set;
+static SpscRing *g_cue_ring;
 
 // Oscillator state: persistent phase accumulators (never reset)
 static uint32 g_phase[kSpatialCue_Count];
@@ -68,7 +99,6 @@ static int g_blocked_timer;
 static uint32 g_blocked_decay;
 static uint32 g_blocked_phase;
 static uint32 g_blocked_phase_inc;
-static bool g_blocked_active;
 static uint16 g_prev_link_x, g_prev_link_y;
 static int g_blocked_frame_count;
 
@@ -134,10 +164,6 @@ static int g_outdoor_suppress_frames;  // suppress entrance TTS after exiting
 static int g_prev_beam_dist[4];      // previous frame narrow-beam wall distance per direction
 static int g_passage_pos[4];         // chime sample position, -1 = inactive
 static uint32 g_passage_phase[4];    // oscillator phase
-static uint32 g_passage_inc1[4];     // note 1 phase increment
-static uint32 g_passage_inc2[4];     // note 2 phase increment
-static int g_passage_pan_L[4];       // left gain
-static int g_passage_pan_R[4];       // right gain
 static int g_passage_chime_len;      // total chime duration in samples
 static uint32 g_d5_inc, g_d6_inc, g_d7_inc;  // D5/D6/D7 phase increments
 
@@ -145,13 +171,11 @@ static uint32 g_d5_inc, g_d6_inc, g_d7_inc;  // D5/D6/D7 phase increments
 static uint32 g_hole_envelope;
 static int g_hole_timer;
 static uint32 g_hole_decay;
-static uint32 g_hole_sweep;  // descending sweep counter
 
 // Liftable "swipe" (ascending chirp) state
 static uint32 g_lift_envelope;
 static int g_lift_timer;
 static uint32 g_lift_decay;
-static uint32 g_lift_sweep;  // ascending sweep counter
 
 // Chest "sparkle" (vibrato shimmer) state
 static uint32 g_chest_envelope;
@@ -159,7 +183,6 @@ static int g_chest_timer;
 static uint32 g_chest_decay;
 
 // NPC double-chime state
-static int g_npc_beep_pos;
 static uint32 g_npc_phase_inc2;  // E4 (330Hz) second note
 
 // Hole proximity warning ding (plays when moving near a hole)
@@ -170,14 +193,11 @@ static uint32 g_hole_warn_phase;
 static uint32 g_hole_warn_phase_inc_base;   // 1200Hz base
 static uint32 g_hole_warn_phase_inc_hi;     // 1400Hz (hole above)
 static uint32 g_hole_warn_phase_inc_lo;     // 1000Hz (hole below)
-static bool g_hole_warn_active;
-static int16 g_hole_warn_dx, g_hole_warn_dy; // direction of nearest danger hole
 
 // Enemy combat dings
 static uint32 g_sword_range_envelope, g_sword_range_phase;
 static int g_sword_range_timer;
 static uint32 g_sword_range_decay, g_sword_range_phase_inc;
-static bool g_sword_range_active;
 
 static uint32 g_danger_phase;
 static uint32 g_danger_phase_inc;
@@ -197,7 +217,6 @@ static int g_sword_range_beep_pos;
 // Alignment sonar ping (variable rate based on precision)
 static uint32 g_align_envelope;
 static int g_align_timer;
-static int g_align_interval;  // samples between pings (varies with precision)
 static uint32 g_align_decay;
 static uint32 g_align_phase;
 static uint32 g_align_phase_inc;
@@ -217,7 +236,6 @@ static const uint8 kHitboxYSize[32] = {
 static uint32 g_wall_envelope[4];
 static int g_wall_timer[4];
 static uint32 g_wall_decay;
-static int g_wall_interval[4];  // repeat interval per direction (set by scan)
 
 // Ledge envelope state
 static uint32 g_ledge_envelope;
@@ -289,6 +307,7 @@ static const uint16 kBaseFreq[kSpatialCue_Count] = {
 // Per-group volume control (0-100, default 100)
 static int g_cue_group_volume[kCueGroup_Count];
 static int g_scan_range = 96;  // was SCAN_RANGE macro
+#define SCAN_RANGE_MAX 192
 
 // Options menu state
 static bool g_options_active;
@@ -362,7 +381,10 @@ void SpatialAudio_Init(int sample_rate) {
   g_sample_rate = sample_rate;
   g_enabled = false;
   memset(g_phase, 0, sizeof(g_phase));
-  memset(g_cue_snapshot, 0, sizeof(g_cue_snapshot));
+  memset(&g_scan_set, 0, sizeof(g_scan_set));
+  memset(&g_mix_set, 0, sizeof(g_mix_set));
+  if (!g_cue_ring)
+    g_cue_ring = SpscRing_Create(sizeof(SpatialCueSet), 16);
 
   // Initialize cue group volumes to 100%
   for (int i = 0; i < kCueGroup_Count; i++)
@@ -389,7 +411,6 @@ void SpatialAudio_Init(int sample_rate) {
     g_wall_decay = (uint32)(powf(0.01f, 1.0f / ds) * 65536.0f);
     memset(g_wall_envelope, 0, sizeof(g_wall_envelope));
     memset(g_wall_timer, 0, sizeof(g_wall_timer));
-    memset(g_wall_interval, 0, sizeof(g_wall_interval));
   }
 
   // NPC double-chime: C4 (262Hz) then E4 (330Hz), 60ms each, 1.2s repeat
@@ -398,7 +419,6 @@ void SpatialAudio_Init(int sample_rate) {
     g_ding_decay = (uint32)(powf(0.01f, 1.0f / ds) * 65536.0f);
     g_ding_envelope = 0;
     g_ding_timer = 0;
-    g_npc_beep_pos = 0;
     g_npc_phase_inc2 = (uint32)((uint64)330 * 256 * 65536 / sample_rate);
   }
 
@@ -425,7 +445,6 @@ void SpatialAudio_Init(int sample_rate) {
   g_hole_decay = (uint32)(powf(0.01f, 1.0f / ds) * 65536.0f);
   g_hole_envelope = 0;
   g_hole_timer = 0;
-  g_hole_sweep = 0;
 
   // Hole proximity warning: 1200Hz base, +200 for up holes, -200 for down holes
   g_hole_warn_phase_inc_base = (uint32)((uint64)1200 * 256 * 65536 / sample_rate);
@@ -436,8 +455,6 @@ void SpatialAudio_Init(int sample_rate) {
   g_hole_warn_envelope = 0;
   g_hole_warn_timer = 0;
   g_hole_warn_phase = 0;
-  g_hole_warn_active = false;
-  g_hole_warn_dx = g_hole_warn_dy = 0;
 
   // Sword range double-beep: 880Hz then 1100Hz, 40ms each, repeats every 500ms
   g_sword_range_phase_inc = (uint32)((uint64)880 * 256 * 65536 / sample_rate);
@@ -446,7 +463,6 @@ void SpatialAudio_Init(int sample_rate) {
   g_sword_range_decay = (uint32)(powf(0.01f, 1.0f / ds) * 65536.0f);
   g_sword_range_envelope = 0; g_sword_range_timer = 0; g_sword_range_phase = 0;
   g_sword_range_beep_pos = 0;
-  g_sword_range_active = false;
 
   // Danger drill: 300Hz tone amplitude-modulated at 25Hz for drill effect
   g_danger_phase_inc = (uint32)((uint64)300 * 256 * 65536 / sample_rate);
@@ -466,7 +482,7 @@ void SpatialAudio_Init(int sample_rate) {
   ds = sample_rate * 30 / 1000;
   g_align_decay = (uint32)(powf(0.01f, 1.0f / ds) * 65536.0f);
   g_align_envelope = 0; g_align_timer = 0; g_align_phase = 0;
-  g_align_interval = 0; g_align_offset = SCAN_RANGE;
+  g_align_offset = SCAN_RANGE;
 
   // Blocked ding: 110Hz, 200ms decay
   g_blocked_phase_inc = (uint32)((uint64)110 * 256 * 65536 / sample_rate);
@@ -475,7 +491,6 @@ void SpatialAudio_Init(int sample_rate) {
   g_blocked_envelope = 0;
   g_blocked_timer = 0;
   g_blocked_phase = 0;
-  g_blocked_active = false;
   g_prev_link_x = g_prev_link_y = 0;
   g_blocked_frame_count = 0;
 
@@ -523,7 +538,7 @@ void SpatialAudio_Init(int sample_rate) {
   // Liftable "swipe": ascending chirp 200→600Hz over 120ms, 700ms repeat
   ds = sample_rate * 120 / 1000;
   g_lift_decay = (uint32)(powf(0.01f, 1.0f / ds) * 65536.0f);
-  g_lift_envelope = 0; g_lift_timer = 0; g_lift_sweep = 0;
+  g_lift_envelope = 0; g_lift_timer = 0;
 
   // Chest "sparkle": 523Hz + 8Hz vibrato, 200ms decay, 800ms repeat
   ds = sample_rate * 200 / 1000;
@@ -573,12 +588,29 @@ void SpatialAudio_Init(int sample_rate) {
 
 void SpatialAudio_Shutdown(void) {
   g_enabled = false;
+  SpscRing_Destroy(g_cue_ring);
+  g_cue_ring = NULL;
+}
+
+// Silences the positional cues right away. Holding the apu lock keeps the
+// mixer from running, so the queued cue sets can be thrown away too.
+static void ClearCues(void) {
+  ZeldaApuLock();
+  memset(g_scan_set.cues, 0, sizeof(g_scan_set.cues));
+  memset(g_mix_set.cues, 0, sizeof(g_mix_set.cues));
+  SpscRing_Reset(g_cue_ring);
+  ZeldaApuUnlock();
+}
+
+static void PushCues(void) {
+  SpscRing_Push(g_cue_ring, &g_scan_set);
+  g_scan_set.triggers = 0;
 }
 
 void SpatialAudio_Toggle(void) {
   g_enabled = !g_enabled;
   if (!g_enabled) {
-    memset(g_cue_snapshot, 0, sizeof(g_cue_snapshot));
+    ClearCues();
     if (g_legend_active) {
       g_legend_active = false;
       g_legend_demo_pos = -1;
@@ -643,9 +675,9 @@ void SpatialAudio_SpeakLocation(void) {
   if (!player_is_indoors && g_nearest_entrance_idx >= 0) {
     uint8 eid = kOverworld_Entrance_Id[g_nearest_entrance_idx];
     entrance = A11yEntranceName(eid);
-    if (g_cue_snapshot[kSpatialCue_Door].active) {
-      int edx = g_cue_snapshot[kSpatialCue_Door].dx;
-      int edy = g_cue_snapshot[kSpatialCue_Door].dy;
+    if (g_scan_set.cues[kSpatialCue_Door].active) {
+      int edx = g_scan_set.cues[kSpatialCue_Door].dx;
+      int edy = g_scan_set.cues[kSpatialCue_Door].dy;
       int ax = edx < 0 ? -edx : edx;
       int ay = edy < 0 ? -edy : edy;
       if (ax > ay)
@@ -656,11 +688,11 @@ void SpatialAudio_SpeakLocation(void) {
   }
 
   // Nearest NPC
-  bool has_npc = g_cue_snapshot[kSpatialCue_NPC].active;
+  bool has_npc = g_scan_set.cues[kSpatialCue_NPC].active;
   const char *npc_dir = NULL;
   if (has_npc) {
-    int ndx = g_cue_snapshot[kSpatialCue_NPC].dx;
-    int ndy = g_cue_snapshot[kSpatialCue_NPC].dy;
+    int ndx = g_scan_set.cues[kSpatialCue_NPC].dx;
+    int ndy = g_scan_set.cues[kSpatialCue_NPC].dy;
     int ax = ndx < 0 ? -ndx : ndx;
     int ay = ndy < 0 ? -ndy : ndy;
     if (ax > ay)
@@ -728,9 +760,9 @@ static int ClassifyTile(uint8 tile) {
 // Tiles that block movement and form corridor boundaries but already have
 // their own audio cues (water tremolo, ledge sweep, liftable tone).
 // These feed the passage detection beam without becoming wall cues.
-static bool IsBeamOpaque(int cat, uint8 tile, bool indoors) {
+// The outdoor deep water variant 0x0B is already classified as DeepWater.
+static bool IsBeamOpaque(int cat) {
   if (cat == kSpatialCue_DeepWater) return true;
-  if (!indoors && tile == 0x0B) return true;  // outdoor deep water variant
   if (cat == kSpatialCue_Ledge) return true;
   if (cat == kSpatialCue_Liftable) return true;
   return false;
@@ -1219,6 +1251,316 @@ static void AnnounceDungeonMap(void) {
 }
 #endif  // __APPLE__
 
+// --- Tile index ---
+
+// Instead of reading and classifying every tile around Link each frame, the
+// interesting tiles of the current room or overworld area are collected into
+// per-category lists sorted by row, and the scan only visits the tiles of
+// those lists that fall inside its window. The index is rebuilt when the tile
+// attributes it was made from change.
+enum {
+  kTileIndex_MaxSize = 128,  // tiles per side of a large overworld area
+  kTileIndex_AttrSize = 0x2000,
+  kTileIndex_MaxEntrances = 32,
+  kTileIndex_Wall = kSpatialCue_WallN,  // all walls, binned by direction at scan time
+  kScanWindow_MaxSize = SCAN_RANGE_MAX / 8 * 2 + 1,
+};
+
+typedef struct TileIndex {
+  bool valid;
+  bool indoors;
+  uint8 lower_level;
+  uint16 area;
+  uint16 base_x, base_y, mask_x, mask_y;
+  const uint16 *map16_to_map8;
+  const uint8 *map8_to_attr;
+  int width, height;
+  // Copy of the attributes the index was built from
+  uint8 attr[kTileIndex_AttrSize];
+  // Columns of the tiles of each category, row by row
+  uint16 row_start[kSpatialCue_Count][kTileIndex_MaxSize + 1];
+  uint8 cols[kTileIndex_MaxSize * kTileIndex_MaxSize];
+  // Overworld entrances of the area
+  int num_entrances;
+  uint16 entrance_pos[kTileIndex_MaxEntrances];
+  int entrance_idx[kTileIndex_MaxEntrances];
+} TileIndex;
+
+static TileIndex g_tile_index;
+
+static int TileIndex_Classify(uint8 tile, bool indoors) {
+  int cat = ClassifyTile(tile);
+  // Tile 0x0B is deep water only outdoors
+  if (cat < 0 && !indoors && tile == 0x0B) cat = kSpatialCue_DeepWater;
+  return cat == TILE_CLASS_WALL ? kTileIndex_Wall : cat;
+}
+
+// Index column of the tile at pixel x, or of the tile read for the
+// coordinates the scan passes to Overworld_GetTileAttributeAtLocation.
+static int TileIndex_Column(const TileIndex *ti, int px) {
+  uint16 x = (uint16)(px >> 3);
+  if (ti->indoors)
+    return x & 63;
+  return ((x - ti->base_x) & ti->mask_x) | (x & 1);
+}
+
+static int TileIndex_Row(const TileIndex *ti, int py) {
+  uint16 y = (uint16)py;
+  if (ti->indoors)
+    return (y >> 3) & 63;
+  return (((y - ti->base_y) & ti->mask_y) | (y & 8)) >> 3;
+}
+
+static uint8 TileIndex_ReadTile(const TileIndex *ti, int u, int v) {
+  if (ti->indoors) {
+    int base_offs = v * 64 + u;
+    // Read current layer first
+    uint8 tile = dung_bg2_attr_table[base_offs + (ti->lower_level ? 0x1000 : 0)];
+    // If current layer is just floor, check other layer for stairs/doors
+    if (ClassifyTile(tile) < 0) {
+      uint8 tile2 = dung_bg2_attr_table[base_offs + (ti->lower_level ? 0 : 0x1000)];
+      if (ClassifyTile(tile2) >= 0)
+        tile = tile2;
+    }
+    return tile;
+  }
+  // Pick coordinates that land on the map16 quadrant the column and row stand for
+  uint16 x = ti->base_x + (u & ~1) + ((u ^ ti->base_x) & 1);
+  uint16 y = ti->base_y + ((v << 3) & ~15) + (((v << 3) ^ ti->base_y) & 8);
+  return Overworld_GetTileAttributeAtLocation(x, y);
+}
+
+static void TileIndex_Build(TileIndex *ti) {
+  static int8 cats[kTileIndex_MaxSize * kTileIndex_MaxSize];
+  uint16 count[kSpatialCue_Count][kTileIndex_MaxSize];
+  memset(count, 0, sizeof(count));
+  for (int v = 0; v < ti->height; v++) {
+    for (int u = 0; u < ti->width; u++) {
+      int cat = TileIndex_Classify(TileIndex_ReadTile(ti, u, v), ti->indoors);
+      cats[v * ti->width + u] = (int8)cat;
+      if (cat >= 0)
+        count[cat][v]++;
+    }
+  }
+  int n = 0;
+  for (int c = 0; c < kSpatialCue_Count; c++) {
+    for (int v = 0; v < ti->height; v++) {
+      ti->row_start[c][v] = n;
+      n += count[c][v];
+    }
+    ti->row_start[c][ti->height] = n;
+  }
+  memset(count, 0, sizeof(count));
+  for (int v = 0; v < ti->height; v++) {
+    for (int u = 0; u < ti->width; u++) {
+      int cat = cats[v * ti->width + u];
+      if (cat >= 0)
+        ti->cols[ti->row_start[cat][v] + count[cat][v]++] = u;
+    }
+  }
+
+  // Pre-filter overworld entrances for the current area
+  ti->num_entrances = 0;
+  if (!ti->indoors) {
+    int total = kOverworld_Entrance_Pos_SIZE / 2;
+    for (int i = 0; i < total && ti->num_entrances < kTileIndex_MaxEntrances; i++) {
+      if (kOverworld_Entrance_Area[i] == ti->area) {
+        ti->entrance_pos[ti->num_entrances] = kOverworld_Entrance_Pos[i];
+        ti->entrance_idx[ti->num_entrances] = i;
+        ti->num_entrances++;
+      }
+    }
+  }
+  ti->valid = true;
+}
+
+// Rebuilds the index if Link moved to another room or area, changed layers,
+// or the attributes under it were modified.
+static void TileIndex_Update(bool indoors) {
+  TileIndex *ti = &g_tile_index;
+  const uint8 *attr = indoors ? dung_bg2_attr_table : (const uint8 *)overworld_tileattr;
+  bool same = ti->valid && ti->indoors == indoors;
+  if (indoors) {
+    same = same && ti->lower_level == link_is_on_lower_level;
+  } else {
+    same = same && ti->area == overworld_area_index &&
+           ti->base_x == overworld_offset_base_x && ti->base_y == overworld_offset_base_y &&
+           ti->mask_x == overworld_offset_mask_x && ti->mask_y == overworld_offset_mask_y &&
+           ti->map16_to_map8 == GetMap16toMap8Table() && ti->map8_to_attr == GetMap8toTileAttr();
+  }
+  if (same && memcmp(ti->attr, attr, kTileIndex_AttrSize) == 0)
+    return;
+  ti->indoors = indoors;
+  ti->lower_level = link_is_on_lower_level;
+  ti->area = overworld_area_index;
+  ti->base_x = overworld_offset_base_x;
+  ti->base_y = overworld_offset_base_y;
+  ti->mask_x = overworld_offset_mask_x;
+  ti->mask_y = overworld_offset_mask_y;
+  ti->map16_to_map8 = GetMap16toMap8Table();
+  ti->map8_to_attr = GetMap8toTileAttr();
+  if (indoors) {
+    ti->width = ti->height = 64;
+  } else {
+    ti->width = (ti->mask_x | 1) + 1;
+    ti->height = ((ti->mask_y | 8) + 8) >> 3;
+    assert(ti->width <= kTileIndex_MaxSize && ti->height <= kTileIndex_MaxSize);
+  }
+  memcpy(ti->attr, attr, kTileIndex_AttrSize);
+  TileIndex_Build(ti);
+}
+
+typedef struct DoorCandidate {
+  int order;  // position in the scan window, entrances before tiles
+  int dx, dy;
+  int entrance;
+} DoorCandidate;
+
+static int CompareDoorCandidates(const void *a, const void *b) {
+  return ((const DoorCandidate *)a)->order - ((const DoorCandidate *)b)->order;
+}
+
+// Keeps the nearest tile of each category, the first one in scan order if
+// several are equally near.
+static void OfferTileCue(SpatialCue *cues, uint32 *best_dist2, int *best_order,
+                         int cat, int dx, int dy, int order) {
+  uint32 d2 = (uint32)(dx * dx + dy * dy);
+  if (d2 < best_dist2[cat] || (d2 == best_dist2[cat] && order < best_order[cat])) {
+    best_dist2[cat] = d2;
+    best_order[cat] = order;
+    cues[cat].dx = (int16)dx;
+    cues[cat].dy = (int16)dy;
+    cues[cat].active = true;
+  }
+}
+
+// Tile scan: SCAN_RANGE radius, 8px step for full diagonal coverage. Finds the
+// nearest tile of each category, the overworld entrance Link is near, and the
+// narrow-beam wall distances used for passage detection.
+static void ScanTiles(uint16 lx, uint16 ly, bool indoors, SpatialCue *cues, uint32 *best_dist2, int *beam_dist) {
+  static DoorCandidate doors[kScanWindow_MaxSize * kScanWindow_MaxSize * 2];
+  TileIndex *ti = &g_tile_index;
+  int best_order[kSpatialCue_Count];
+  int steps = SCAN_RANGE / 8, size = steps * 2 + 1, num_doors = 0;
+  // Window columns reading each index column, in ascending order. Windows
+  // larger than the area read some columns twice.
+  int8 col_head[kTileIndex_MaxSize], col_next[kScanWindow_MaxSize];
+  int8 ent_col_head[64], ent_col_next[kScanWindow_MaxSize];
+  int8 ent_row_head[64], ent_row_next[kScanWindow_MaxSize];
+
+  TileIndex_Update(indoors);
+  memset(col_head, -1, sizeof(col_head));
+  memset(ent_col_head, -1, sizeof(ent_col_head));
+  memset(ent_row_head, -1, sizeof(ent_row_head));
+  for (int i = size - 1; i >= 0; i--) {
+    int px = (int)lx + 8 + (i - steps) * 8;
+    if (px < 0) continue;
+    int u = TileIndex_Column(ti, px);
+    col_next[i] = col_head[u], col_head[u] = i;
+    if (ti->num_entrances) {
+      // Entrances are matched against the raw coords, not the sprite center
+      uint16 xc = (uint16)((int)lx + (i - steps) * 8) >> 3;
+      int k = ((xc - overworld_offset_base_x) & overworld_offset_mask_x) >> 1;
+      ent_col_next[i] = ent_col_head[k], ent_col_head[k] = i;
+    }
+  }
+
+  // Overworld entrances
+  if (ti->num_entrances) {
+    for (int i = size - 1; i >= 0; i--) {
+      if ((int)ly + 12 + (i - steps) * 8 < 0) continue;
+      uint16 yc = (uint16)((int)ly + (i - steps) * 8) + 7;
+      int k = ((yc - overworld_offset_base_y) & overworld_offset_mask_y) >> 4;
+      ent_row_next[i] = ent_row_head[k], ent_row_head[k] = i;
+    }
+    for (int e = 0; e < ti->num_entrances; e++) {
+      uint16 pos = ti->entrance_pos[e];
+      if ((pos & 1) || (pos >> 7) >= 64) continue;
+      // Only the first entrance at a position counts
+      bool dup = false;
+      for (int j = 0; j < e; j++)
+        dup |= (ti->entrance_pos[j] == pos);
+      if (dup) continue;
+      for (int y = ent_row_head[pos >> 7]; y >= 0; y = ent_row_next[y]) {
+        for (int x = ent_col_head[(pos & 127) >> 1]; x >= 0; x = ent_col_next[x]) {
+          DoorCandidate *d = &doors[num_doors++];
+          d->order = (y * size + x) * 2;
+          d->dx = (x - steps) * 8;
+          d->dy = (y - steps) * 8;
+          d->entrance = ti->entrance_idx[e];
+        }
+      }
+    }
+  }
+
+  for (int c = 0; c < kSpatialCue_Count; c++)
+    best_order[c] = size * size;
+  for (int y = 0; y < size; y++) {
+    int py = (int)ly + 12 + (y - steps) * 8;
+    if (py < 0) continue;
+    int v = TileIndex_Row(ti, py);
+    for (int cat = 0; cat < kSpatialCue_Count; cat++) {
+      const uint8 *p = ti->cols + ti->row_start[cat][v], *pend = ti->cols + ti->row_start[cat][v + 1];
+      for (; p != pend; p++) {
+        for (int x = col_head[*p]; x >= 0; x = col_next[x]) {
+          int dx = (x - steps) * 8;
+          int dy = (y - steps) * 8;
+          int abs_dx = dx < 0 ? -dx : dx;
+          int abs_dy = dy < 0 ? -dy : dy;
+          int order = y * size + x;
+          int c = cat;
+
+          // Wall tiles and non-wall impassable tiles feed the passage detection beam.
+          // Only count tiles within ±16px perpendicular to the cardinal direction
+          if ((c == kTileIndex_Wall || IsBeamOpaque(c)) && (abs_dx > 0 || abs_dy > 0)) {
+            if (dy < 0 && abs_dx <= 16 && -dy < beam_dist[0]) beam_dist[0] = -dy;  // North
+            if (dy > 0 && abs_dx <= 16 &&  dy < beam_dist[1]) beam_dist[1] = dy;   // South
+            if (dx > 0 && abs_dy <= 16 &&  dx < beam_dist[2]) beam_dist[2] = dx;   // East
+            if (dx < 0 && abs_dy <= 16 && -dx < beam_dist[3]) beam_dist[3] = -dx;  // West
+          }
+
+          if (c == kTileIndex_Wall) {
+            // Bin wall tiles into directional quadrants
+            if (abs_dx == 0 && abs_dy == 0) continue;  // tile right on Link, skip
+            if (abs_dx >= abs_dy)
+              c = (dx >= 0) ? kSpatialCue_WallE : kSpatialCue_WallW;
+            else
+              c = (dy >= 0) ? kSpatialCue_WallS : kSpatialCue_WallN;
+          } else if (c == kSpatialCue_HoleL) {
+            // Split holes into left/right by dx relative to Link
+            c = (dx < 0) ? kSpatialCue_HoleL : kSpatialCue_HoleR;
+          } else if (c == kSpatialCue_Door) {
+            DoorCandidate *d = &doors[num_doors++];
+            d->order = order * 2 + 1;
+            d->dx = dx, d->dy = dy;
+            d->entrance = -1;
+            continue;
+          }
+          OfferTileCue(cues, best_dist2, best_order, c, dx, dy, order);
+        }
+      }
+    }
+  }
+
+  // Doors go through the candidates in scan order, as the nearest entrance is
+  // only remembered when it was the nearest door at that point of the scan.
+  qsort(doors, num_doors, sizeof(doors[0]), CompareDoorCandidates);
+  for (int i = 0; i < num_doors; i++) {
+    DoorCandidate *d = &doors[i];
+    uint32 d2 = (uint32)(d->dx * d->dx + d->dy * d->dy);
+    if (d2 < best_dist2[kSpatialCue_Door]) {
+      best_dist2[kSpatialCue_Door] = d2;
+      cues[kSpatialCue_Door].dx = (int16)d->dx;
+      cues[kSpatialCue_Door].dy = (int16)d->dy;
+      cues[kSpatialCue_Door].active = true;
+      if (d->entrance >= 0) {
+        g_nearest_entrance_idx = d->entrance;
+        g_nearest_entrance_dist2 = (int)d2;
+      }
+    }
+  }
+}
+
 void SpatialAudio_ScanFrame(void) {
   SpatialCue cues[kSpatialCue_Count];
   uint32 best_dist2[kSpatialCue_Count];
@@ -1248,28 +1590,18 @@ void SpatialAudio_ScanFrame(void) {
 
   uint8 mod = main_module_index;
   if (mod != 7 && mod != 9 && mod != 14) {
-    memset(g_cue_snapshot, 0, sizeof(g_cue_snapshot));
+    memset(g_scan_set.cues, 0, sizeof(g_scan_set.cues));
     // Kill all in-progress one-shot sounds (death, menu transitions, etc.)
-    g_sword_range_active = false;
-    g_sword_range_envelope = 0;
+    g_scan_set.sword_range_active = false;
     g_danger_active = false;
     g_danger_prev = false;
-    g_danger_drill_pos = -1;
-    g_danger_exit_pos = -1;
-    g_align_interval = 0;
-    g_align_envelope = 0;
-    g_hole_warn_active = false;
-    g_hole_warn_envelope = 0;
-    g_blocked_active = false;
-    g_blocked_envelope = 0;
-    g_room_chime_envelope = 0;
-    g_ledge_envelope = 0; g_ledge_timer = 0;
-    g_water_envelope = 0; g_water_timer = 0;
-    g_hazard_envelope = 0; g_hazard_timer = 0;
-    g_conveyor_timer = 0;
+    g_scan_set.align_interval = 0;
+    g_scan_set.hole_warn_active = false;
+    g_scan_set.blocked_active = false;
     g_terrain_type = kTerrain_Normal;
     g_prev_terrain_type = kTerrain_Normal;
-    g_terrain_pos = -1;
+    g_scan_set.triggers = kSpatialTrigger_Silence;
+    PushCues();
     return;
   }
 
@@ -1282,132 +1614,15 @@ void SpatialAudio_ScanFrame(void) {
     g_outdoor_suppress_frames = 60;
   g_was_indoors = indoors;
 
-  // Pre-filter overworld entrances for the current area
-  uint16 ow_entrance_pos[32];
-  int ow_entrance_orig_idx[32];
-  int num_ow_entrances = 0;
   g_nearest_entrance_idx = -1;
   g_nearest_entrance_dist2 = 0;
-  if (!indoors) {
-    int total = kOverworld_Entrance_Pos_SIZE / 2;
-    for (int i = 0; i < total && num_ow_entrances < 32; i++) {
-      if (kOverworld_Entrance_Area[i] == overworld_area_index) {
-        ow_entrance_pos[num_ow_entrances] = kOverworld_Entrance_Pos[i];
-        ow_entrance_orig_idx[num_ow_entrances] = i;
-        num_ow_entrances++;
-      }
-    }
-  }
 
   // Narrow-beam wall distances for passage detection
   // Only considers wall tiles within ±16px perpendicular band
   int beam_dist[4];  // N, S, E, W
   for (int i = 0; i < 4; i++) beam_dist[i] = SCAN_RANGE;
 
-  // Tile scan: 96px radius, 8px step for full diagonal coverage
-  int scan_steps = SCAN_RANGE / 8;
-  for (int tdy = -scan_steps; tdy <= scan_steps; tdy++) {
-    for (int tdx = -scan_steps; tdx <= scan_steps; tdx++) {
-      int px = (int)lx + 8 + tdx * 8;
-      int py = (int)ly + 12 + tdy * 8;
-      if (px < 0 || py < 0) continue;
-
-      // Check if this tile is an overworld entrance (use raw coords, not sprite center)
-      if (!indoors && num_ow_entrances > 0) {
-        uint16 raw_x = (uint16)((int)lx + tdx * 8);
-        uint16 raw_y = (uint16)((int)ly + tdy * 8);
-        uint16 xc = raw_x >> 3;
-        uint16 yc = raw_y + 7;
-        uint16 pos = ((yc - overworld_offset_base_y) & overworld_offset_mask_y) * 8 +
-                     ((xc - overworld_offset_base_x) & overworld_offset_mask_x);
-        for (int e = 0; e < num_ow_entrances; e++) {
-          if (pos == ow_entrance_pos[e]) {
-            int dx = tdx * 8;
-            int dy = tdy * 8;
-            uint32 d2 = (uint32)(dx * dx + dy * dy);
-            if (d2 < best_dist2[kSpatialCue_Door]) {
-              best_dist2[kSpatialCue_Door] = d2;
-              cues[kSpatialCue_Door].dx = (int16)dx;
-              cues[kSpatialCue_Door].dy = (int16)dy;
-              cues[kSpatialCue_Door].active = true;
-              g_nearest_entrance_idx = ow_entrance_orig_idx[e];
-              g_nearest_entrance_dist2 = (int)d2;
-            }
-            break;
-          }
-        }
-      }
-
-      uint8 tile;
-      if (indoors) {
-        int tx = (px >> 3) & 63;
-        int ty = (py >> 3) & 63;
-        int base_offs = ty * 64 + tx;
-        // Read current layer first
-        int offs = base_offs + (link_is_on_lower_level ? 0x1000 : 0);
-        tile = dung_bg2_attr_table[offs];
-        // If current layer is just floor, check other layer for stairs/doors
-        if (ClassifyTile(tile) < 0) {
-          int offs2 = base_offs + (link_is_on_lower_level ? 0 : 0x1000);
-          uint8 tile2 = dung_bg2_attr_table[offs2];
-          if (ClassifyTile(tile2) >= 0)
-            tile = tile2;
-        }
-      } else {
-        tile = Overworld_GetTileAttributeAtLocation((uint16)(px >> 3), (uint16)py);
-      }
-
-      int cat = ClassifyTile(tile);
-      // Tile 0x0B is deep water only outdoors
-      if (cat < 0 && !indoors && tile == 0x0B) cat = kSpatialCue_DeepWater;
-      if (cat < 0 && cat != TILE_CLASS_WALL) continue;
-
-      int dx = tdx * 8;
-      int dy = tdy * 8;
-
-      // Bin wall tiles into directional quadrants
-      if (cat == TILE_CLASS_WALL) {
-        int abs_dx = dx < 0 ? -dx : dx;
-        int abs_dy = dy < 0 ? -dy : dy;
-        if (abs_dx == 0 && abs_dy == 0) continue;  // tile right on Link, skip
-        if (abs_dx >= abs_dy)
-          cat = (dx >= 0) ? kSpatialCue_WallE : kSpatialCue_WallW;
-        else
-          cat = (dy >= 0) ? kSpatialCue_WallS : kSpatialCue_WallN;
-
-        // Narrow-beam wall tracking for passage detection
-        // Only count tiles within ±16px perpendicular to the cardinal direction
-        if (dy < 0 && abs_dx <= 16 && -dy < beam_dist[0]) beam_dist[0] = -dy;  // North
-        if (dy > 0 && abs_dx <= 16 &&  dy < beam_dist[1]) beam_dist[1] = dy;   // South
-        if (dx > 0 && abs_dy <= 16 &&  dx < beam_dist[2]) beam_dist[2] = dx;   // East
-        if (dx < 0 && abs_dy <= 16 && -dx < beam_dist[3]) beam_dist[3] = -dx;  // West
-      }
-
-      // Non-wall impassable tiles also feed the passage detection beam
-      if (IsBeamOpaque(cat, tile, indoors)) {
-        int abs_dx = dx < 0 ? -dx : dx;
-        int abs_dy = dy < 0 ? -dy : dy;
-        if (abs_dx > 0 || abs_dy > 0) {
-          if (dy < 0 && abs_dx <= 16 && -dy < beam_dist[0]) beam_dist[0] = -dy;
-          if (dy > 0 && abs_dx <= 16 &&  dy < beam_dist[1]) beam_dist[1] = dy;
-          if (dx > 0 && abs_dy <= 16 &&  dx < beam_dist[2]) beam_dist[2] = dx;
-          if (dx < 0 && abs_dy <= 16 && -dx < beam_dist[3]) beam_dist[3] = -dx;
-        }
-      }
-
-      // Split holes into left/right by dx relative to Link
-      if (cat == kSpatialCue_HoleL)
-        cat = (dx < 0) ? kSpatialCue_HoleL : kSpatialCue_HoleR;
-
-      uint32 d2 = (uint32)(dx * dx + dy * dy);
-      if (d2 < best_dist2[cat]) {
-        best_dist2[cat] = d2;
-        cues[cat].dx = (int16)dx;
-        cues[cat].dy = (int16)dy;
-        cues[cat].active = true;
-      }
-    }
-  }
+  ScanTiles(lx, ly, indoors, cues, best_dist2, beam_dist);
 
   // Sprite scan: 16 slots, extended range
   int nearest_enemy_dist = SCAN_RANGE;
@@ -1466,17 +1681,14 @@ void SpatialAudio_ScanFrame(void) {
   // Combat indicators based on nearest enemy
   bool has_enemy = cues[kSpatialCue_Enemy].active;
   // Sword range: within 28px — you can hit them
-  g_sword_range_active = has_enemy && (nearest_enemy_dist <= 28);
+  g_scan_set.sword_range_active = has_enemy && (nearest_enemy_dist <= 28);
   // Danger: dynamic per-sprite based on hitbox + approach speed
   g_danger_active = any_in_danger;
   // Detect transitions: entering → drill, leaving → exit chime
-  if (g_danger_active && !g_danger_prev) {
-    g_danger_drill_pos = 0;   // start drill
-    g_danger_exit_pos = -1;   // cancel any exit chime
-  } else if (!g_danger_active && g_danger_prev) {
-    g_danger_exit_pos = 0;    // start exit chime
-    g_danger_drill_pos = -1;  // cancel drill
-  }
+  if (g_danger_active && !g_danger_prev)
+    g_scan_set.triggers |= kSpatialTrigger_DangerEnter;
+  else if (!g_danger_active && g_danger_prev)
+    g_scan_set.triggers |= kSpatialTrigger_DangerLeave;
   g_danger_prev = g_danger_active;
 
   // Alignment sonar: check if nearly lined up on X or Y axis with nearest enemy
@@ -1489,21 +1701,21 @@ void SpatialAudio_ScanFrame(void) {
       g_align_offset = off;
       // Variable ping rate: closer to aligned = faster pings
       if (off <= 4)
-        g_align_interval = g_sample_rate / 10;   // every 100ms — locked on
+        g_scan_set.align_interval = g_sample_rate / 10;   // every 100ms — locked on
       else if (off <= 8)
-        g_align_interval = g_sample_rate / 5;    // every 200ms
+        g_scan_set.align_interval = g_sample_rate / 5;    // every 200ms
       else
-        g_align_interval = g_sample_rate * 2 / 5; // every 400ms — getting close
+        g_scan_set.align_interval = g_sample_rate * 2 / 5; // every 400ms — getting close
     } else {
       g_align_offset = SCAN_RANGE;
-      g_align_interval = 0;
+      g_scan_set.align_interval = 0;
     }
   } else {
     g_align_offset = SCAN_RANGE;
-    g_align_interval = 0;
+    g_scan_set.align_interval = 0;
   }
 
-  memcpy(g_cue_snapshot, cues, sizeof(g_cue_snapshot));
+  memcpy(g_scan_set.cues, cues, sizeof(cues));
 
   // Terrain underfoot tracking: read tile at Link's sprite center
   {
@@ -1533,30 +1745,8 @@ void SpatialAudio_ScanFrame(void) {
     g_terrain_type = terrain;
     if (terrain != g_prev_terrain_type) {
       g_prev_terrain_type = terrain;
-      // Trigger one-shot terrain tone (not for Normal or Spike return)
-      if (terrain == kTerrain_Grass) {
-        g_terrain_phase_inc = (uint32)((uint64)200 * 256 * 65536 / g_sample_rate);
-        int ds = g_sample_rate * 100 / 1000;
-        g_terrain_decay = (uint32)(powf(0.01f, 1.0f / ds) * 65536.0f);
-        g_terrain_len = ds;
-        g_terrain_pos = 0; g_terrain_phase = 0;
-        g_terrain_envelope = 65536; g_terrain_am = false;
-      } else if (terrain == kTerrain_ShallowWater) {
-        g_terrain_phase_inc = (uint32)((uint64)280 * 256 * 65536 / g_sample_rate);
-        int ds = g_sample_rate * 120 / 1000;
-        g_terrain_decay = (uint32)(powf(0.01f, 1.0f / ds) * 65536.0f);
-        g_terrain_len = ds;
-        g_terrain_pos = 0; g_terrain_phase = 0;
-        g_terrain_envelope = 65536; g_terrain_am = true;
-      } else if (terrain == kTerrain_Ice) {
-        g_terrain_phase_inc = (uint32)((uint64)1000 * 256 * 65536 / g_sample_rate);
-        int ds = g_sample_rate * 60 / 1000;
-        g_terrain_decay = (uint32)(powf(0.01f, 1.0f / ds) * 65536.0f);
-        g_terrain_len = ds;
-        g_terrain_pos = 0; g_terrain_phase = 0;
-        g_terrain_envelope = 65536; g_terrain_am = false;
-      }
-      // kTerrain_Normal and kTerrain_Spike: no tone
+      g_scan_set.terrain = terrain;
+      g_scan_set.triggers |= kSpatialTrigger_Terrain;
     }
   }
 
@@ -1576,14 +1766,14 @@ void SpatialAudio_ScanFrame(void) {
   // Compute wall click intervals (only for facing direction)
   for (int w = 0; w < 4; w++) {
     int c = kSpatialCue_WallN + w;
-    if (w == facing_wall && g_cue_snapshot[c].active) {
-      int wdx = g_cue_snapshot[c].dx;
-      int wdy = g_cue_snapshot[c].dy;
+    if (w == facing_wall && g_scan_set.cues[c].active) {
+      int wdx = g_scan_set.cues[c].dx;
+      int wdy = g_scan_set.cues[c].dy;
       int dist = (int)isqrt32((uint32)(wdx * wdx + wdy * wdy));
       int ms = 60 + (dist * 190 / SCAN_RANGE);
-      g_wall_interval[w] = g_sample_rate * ms / 1000;
+      g_scan_set.wall_interval[w] = g_sample_rate * ms / 1000;
     } else {
-      g_wall_interval[w] = 0;
+      g_scan_set.wall_interval[w] = 0;
     }
   }
 
@@ -1614,12 +1804,11 @@ void SpatialAudio_ScanFrame(void) {
         }
 
         if (trigger) {
-          g_passage_pos[w] = 0;
-          g_passage_phase[w] = 0;
-          g_passage_inc1[w] = inc1;
-          g_passage_inc2[w] = inc2;
-          g_passage_pan_L[w] = panL;
-          g_passage_pan_R[w] = panR;
+          g_scan_set.triggers |= kSpatialTrigger_Passage << w;
+          g_scan_set.passage_inc1[w] = inc1;
+          g_scan_set.passage_inc2[w] = inc2;
+          g_scan_set.passage_pan_L[w] = panL;
+          g_scan_set.passage_pan_R[w] = panR;
         }
       }
     }
@@ -1630,11 +1819,11 @@ void SpatialAudio_ScanFrame(void) {
   uint16 cur_dung_room = dungeon_room_index;
   if (!indoors) {
     if (cur_ow_screen != g_prev_ow_screen && g_prev_ow_screen != 0xFFFF)
-      g_room_chime_envelope = 65536;
+      g_scan_set.triggers |= kSpatialTrigger_RoomChime;
     g_prev_ow_screen = cur_ow_screen;
   } else {
     if (cur_dung_room != g_prev_dung_room && g_prev_dung_room != 0xFFFF)
-      g_room_chime_envelope = 65536;
+      g_scan_set.triggers |= kSpatialTrigger_RoomChime;
     g_prev_dung_room = cur_dung_room;
   }
 
@@ -1654,9 +1843,9 @@ void SpatialAudio_ScanFrame(void) {
         }
       }
     }
-    g_hole_warn_active = link_moving && (hole_dist <= 16);
-    g_hole_warn_dx = (int16)nearest_dx;
-    g_hole_warn_dy = (int16)nearest_dy;
+    g_scan_set.hole_warn_active = link_moving && (hole_dist <= 16);
+    g_scan_set.hole_warn_dx = (int16)nearest_dx;
+    g_scan_set.hole_warn_dy = (int16)nearest_dy;
   }
 
   // Blocked detection
@@ -1664,276 +1853,417 @@ void SpatialAudio_ScanFrame(void) {
   bool pos_stuck = (lx == g_prev_link_x && ly == g_prev_link_y);
   if (pressing_dir && pos_stuck && (mod == 7 || mod == 9)) {
     g_blocked_frame_count++;
-    g_blocked_active = (g_blocked_frame_count >= 3);
+    g_scan_set.blocked_active = (g_blocked_frame_count >= 3);
   } else {
     g_blocked_frame_count = 0;
-    g_blocked_active = false;
+    g_scan_set.blocked_active = false;
   }
   g_prev_link_x = lx;
   g_prev_link_y = ly;
+
+  PushCues();
 }
 
-void SpatialAudio_MixAudio(int16 *buf, int samples, int channels) {
-  if (!g_enabled || channels != 2) return;
+// Trigger one-shot terrain tone (not for Normal or Spike return)
+static void StartTerrainTone(int terrain) {
+  if (terrain == kTerrain_Grass) {
+    g_terrain_phase_inc = (uint32)((uint64)200 * 256 * 65536 / g_sample_rate);
+    int ds = g_sample_rate * 100 / 1000;
+    g_terrain_decay = (uint32)(powf(0.01f, 1.0f / ds) * 65536.0f);
+    g_terrain_len = ds;
+    g_terrain_pos = 0; g_terrain_phase = 0;
+    g_terrain_envelope = 65536; g_terrain_am = false;
+  } else if (terrain == kTerrain_ShallowWater) {
+    g_terrain_phase_inc = (uint32)((uint64)280 * 256 * 65536 / g_sample_rate);
+    int ds = g_sample_rate * 120 / 1000;
+    g_terrain_decay = (uint32)(powf(0.01f, 1.0f / ds) * 65536.0f);
+    g_terrain_len = ds;
+    g_terrain_pos = 0; g_terrain_phase = 0;
+    g_terrain_envelope = 65536; g_terrain_am = true;
+  } else if (terrain == kTerrain_Ice) {
+    g_terrain_phase_inc = (uint32)((uint64)1000 * 256 * 65536 / g_sample_rate);
+    int ds = g_sample_rate * 60 / 1000;
+    g_terrain_decay = (uint32)(powf(0.01f, 1.0f / ds) * 65536.0f);
+    g_terrain_len = ds;
+    g_terrain_pos = 0; g_terrain_phase = 0;
+    g_terrain_envelope = 65536; g_terrain_am = false;
+  }
+  // kTerrain_Normal and kTerrain_Spike: no tone
+}
 
-  for (int s = 0; s < samples; s++) {
-    int32 mix_L = 0, mix_R = 0;
-
-    // NPC double-chime: position-based pattern (beep1 60ms, gap 40ms, beep2 60ms, silence)
-    // Total pattern: 160ms, repeat every 1.2s
-    if (g_ding_timer <= 0) { g_ding_timer = g_sample_rate * 12 / 10; g_npc_beep_pos = 0; }
-    g_ding_timer--;
-    g_npc_beep_pos++;
-
-    if (g_enemy_timer <= 0) { g_enemy_envelope = 65536; g_enemy_timer = g_sample_rate / 5; }
-    g_enemy_timer--;
-    g_enemy_envelope = (uint32)((uint64)g_enemy_envelope * g_enemy_decay >> 16);
-
-    if (g_door_timer <= 0) { g_door_envelope = 65536; g_door_timer = g_sample_rate * 2 / 5; }
-    g_door_timer--;
-    g_door_envelope = (uint32)((uint64)g_door_envelope * g_door_decay >> 16);
-
-    if (g_stair_timer <= 0) { g_stair_envelope = 65536; g_stair_timer = g_sample_rate * 3 / 10; }
-    g_stair_timer--;
-    g_stair_envelope = (uint32)((uint64)g_stair_envelope * g_stair_decay >> 16);
-    // Sweep counter: wraps every 0.75 seconds
-    g_stair_sweep++;
-    if (g_stair_sweep >= (uint32)(g_sample_rate * 3 / 4))
-      g_stair_sweep = 0;
-
-    if (g_hole_timer <= 0) { g_hole_envelope = 65536; g_hole_timer = g_sample_rate / 2; g_hole_sweep = 0; }
-    g_hole_timer--;
-    g_hole_envelope = (uint32)((uint64)g_hole_envelope * g_hole_decay >> 16);
-    g_hole_sweep++;
-
-    // Liftable "swipe": 120ms decay, 700ms repeat
-    if (g_lift_timer <= 0) { g_lift_envelope = 65536; g_lift_timer = g_sample_rate * 700 / 1000; g_lift_sweep = 0; }
-    g_lift_timer--;
-    g_lift_envelope = (uint32)((uint64)g_lift_envelope * g_lift_decay >> 16);
-    g_lift_sweep++;
-
-    // Chest "sparkle": 200ms decay, 800ms repeat
-    if (g_chest_timer <= 0) { g_chest_envelope = 65536; g_chest_timer = g_sample_rate * 800 / 1000; }
-    g_chest_timer--;
-    g_chest_envelope = (uint32)((uint64)g_chest_envelope * g_chest_decay >> 16);
-
-    // Wall click envelopes (4 directions, variable repeat rate)
-    for (int w = 0; w < 4; w++) {
-      if (g_wall_interval[w] > 0) {
-        if (g_wall_timer[w] <= 0) {
-          g_wall_envelope[w] = 65536;
-          g_wall_timer[w] = g_wall_interval[w];
-        }
-      }
-      if (g_wall_timer[w] > 0) g_wall_timer[w]--;
-      g_wall_envelope[w] = (uint32)((uint64)g_wall_envelope[w] * g_wall_decay >> 16);
-    }
-
-    // Ledge envelope: 80ms decay, 350ms repeat
-    if (g_ledge_timer <= 0) { g_ledge_envelope = 65536; g_ledge_timer = g_sample_rate * 350 / 1000; }
-    g_ledge_timer--;
-    g_ledge_envelope = (uint32)((uint64)g_ledge_envelope * g_ledge_decay >> 16);
-    g_ledge_sweep++;
-    if (g_ledge_sweep >= (uint32)(g_sample_rate * 350 / 1000))
-      g_ledge_sweep = 0;
-
-    // Deep water envelope: 250ms decay, 600ms repeat
-    if (g_water_timer <= 0) { g_water_envelope = 65536; g_water_timer = g_sample_rate * 600 / 1000; }
-    g_water_timer--;
-    g_water_envelope = (uint32)((uint64)g_water_envelope * g_water_decay >> 16);
-
-    // Hazard envelope: 40ms decay, 150ms repeat
-    if (g_hazard_timer <= 0) { g_hazard_envelope = 65536; g_hazard_timer = g_sample_rate * 150 / 1000; }
-    g_hazard_timer--;
-    g_hazard_envelope = (uint32)((uint64)g_hazard_envelope * g_hazard_decay >> 16);
-
-    // Conveyor timer
-    if (g_conveyor_timer <= 0) g_conveyor_timer = g_conveyor_cycle_len;
-    g_conveyor_timer--;
-
-    for (int c = 0; c < kSpatialCue_Count; c++) {
-      if (!g_cue_snapshot[c].active) continue;
-
-      int dx = g_cue_snapshot[c].dx;
-      int dy = g_cue_snapshot[c].dy;
-
-      uint32 d2 = (uint32)(dx * dx + dy * dy);
-      int dist = (int)isqrt32(d2);
-      if (dist >= SCAN_RANGE) continue;
-      int volume = (SCAN_RANGE - dist) * 256 / SCAN_RANGE;
-
-      // Per-category envelope
-      if (c >= kSpatialCue_WallN && c <= kSpatialCue_WallW) {
-        int w = c - kSpatialCue_WallN;
-        volume = (int)((uint32)volume * g_wall_envelope[w] >> 16);
-      } else if (c == kSpatialCue_NPC) {
-        // Double-chime: beep1 60ms, gap 40ms, beep2 60ms, silence until repeat
-        int beep1_len = g_sample_rate * 60 / 1000;
-        int gap_end = beep1_len + g_sample_rate * 40 / 1000;
-        int beep2_end = gap_end + beep1_len;
-        if (g_npc_beep_pos < beep1_len) {
-          int env = (beep1_len - g_npc_beep_pos) * 65536 / beep1_len;
-          volume = (int)((uint32)volume * env >> 16);
-        } else if (g_npc_beep_pos >= gap_end && g_npc_beep_pos < beep2_end) {
-          int p = g_npc_beep_pos - gap_end;
-          int env = (beep1_len - p) * 65536 / beep1_len;
-          volume = (int)((uint32)volume * env >> 16);
-        } else {
-          volume = 0;
-        }
-      } else if (c == kSpatialCue_Enemy) {
-        int base = volume / 3;
-        int ding = (int)((uint32)(volume * 2 / 3) * g_enemy_envelope >> 16);
-        volume = (base + ding) * 2;
-        if (volume > 512) volume = 512;
-      } else if (c == kSpatialCue_Door) {
-        int base = volume / 3;
-        int ding = (int)((uint32)(volume * 2 / 3) * g_door_envelope >> 16);
-        volume = (base + ding) * 2;
-        if (volume > 512) volume = 512;
-      } else if (c == kSpatialCue_StairUp || c == kSpatialCue_StairDown) {
-        int base = volume / 3;
-        int ding = (int)((uint32)(volume * 2 / 3) * g_stair_envelope >> 16);
-        volume = (base + ding) * 2;
-        if (volume > 512) volume = 512;
-      } else if (c == kSpatialCue_HoleL || c == kSpatialCue_HoleR) {
-        int base = volume / 3;
-        int ding = (int)((uint32)(volume * 2 / 3) * g_hole_envelope >> 16);
-        volume = (base + ding) * 2;
-        if (volume > 512) volume = 512;
-      } else if (c == kSpatialCue_Liftable) {
-        volume = (int)((uint32)volume * g_lift_envelope >> 16);
-      } else if (c == kSpatialCue_Chest) {
-        volume = (int)((uint32)volume * g_chest_envelope >> 16);
-      } else if (c == kSpatialCue_Ledge) {
-        volume = (int)((uint32)volume * g_ledge_envelope >> 16);
-      } else if (c == kSpatialCue_DeepWater) {
-        // 4Hz tremolo (amplitude modulation)
-        int am_period = g_sample_rate / 4;
-        int am_pos = s % am_period;
-        int am_frac = am_pos * 256 / am_period;
-        int am_sin = g_sine_table[am_frac & 0xFF];
-        int am_mult = 128 + (am_sin >> 8);  // 0-256 range
-        volume = (int)((uint32)volume * g_water_envelope >> 16);
-        volume = volume * am_mult >> 8;
-      } else if (c == kSpatialCue_Hazard) {
-        volume = (int)((uint32)volume * g_hazard_envelope >> 16);
-      } else if (c == kSpatialCue_Conveyor) {
-        // Double-pulse pattern: two 30ms pulses separated by 30ms gap, then silence
-        int pulse_len = g_sample_rate * 30 / 1000;
-        int pos_in_cycle = g_conveyor_cycle_len - g_conveyor_timer;
-        bool pulse_on = (pos_in_cycle < pulse_len) ||
-                        (pos_in_cycle >= pulse_len * 2 && pos_in_cycle < pulse_len * 3);
-        if (!pulse_on) volume = 0;
-      }
+// Takes over a cue set from the scan, runs on the audio thread.
+static void ApplyCueSet(const SpatialCueSet *set) {
+  uint32 t = set->triggers;
+  g_mix_set = *set;
+  if (t & kSpatialTrigger_Silence) {
+    g_sword_range_envelope = 0;
+    g_danger_drill_pos = -1;
+    g_danger_exit_pos = -1;
+    g_align_envelope = 0;
+    g_hole_warn_envelope = 0;
+    g_blocked_envelope = 0;
+    g_room_chime_envelope = 0;
+    g_ledge_envelope = 0; g_ledge_timer = 0;
+    g_water_envelope = 0; g_water_timer = 0;
+    g_hazard_envelope = 0; g_hazard_timer = 0;
+    g_conveyor_timer = 0;
+    g_terrain_pos = -1;
+  }
+  if (t & kSpatialTrigger_DangerEnter) {
+    g_danger_drill_pos = 0;   // start drill
+    g_danger_exit_pos = -1;   // cancel any exit chime
+  } else if (t & kSpatialTrigger_DangerLeave) {
+    g_danger_exit_pos = 0;    // start exit chime
+    g_danger_drill_pos = -1;  // cancel drill
+  }
+  if (t & kSpatialTrigger_Terrain)
+    StartTerrainTone(set->terrain);
+  for (int w = 0; w < 4; w++) {
+    if (t & (kSpatialTrigger_Passage << w)) {
+      g_passage_pos[w] = 0;
+      g_passage_phase[w] = 0;
+    }
+  }
+  if (t & kSpatialTrigger_RoomChime)
+    g_room_chime_envelope = 65536;
+}
 
-      // Apply per-group volume
-      int grp = CueToGroup(c);
-      if (grp >= 0)
-        volume = volume * g_cue_group_volume[grp] / 100;
-
-      int gain_L, gain_R;
-      if (c >= kSpatialCue_WallN && c <= kSpatialCue_WallW) {
-        // Hard-pan wall cues by direction for clear spatial distinction
-        switch (c) {
-        case kSpatialCue_WallE: gain_L = 32;  gain_R = 224; break;  // right
-        case kSpatialCue_WallW: gain_L = 224; gain_R = 32;  break;  // left
-        default:                gain_L = 128; gain_R = 128; break;  // N/S center
-        }
-      } else {
-        int clamped_dx = dx < -64 ? -64 : (dx > 64 ? 64 : dx);
-        gain_L = (64 - clamped_dx) * 2;
-        gain_R = (64 + clamped_dx) * 2;
-      }
+// The mixer works on blocks of samples. The repeating dings are advanced over
+// the block first, then each audible cue renders its envelope and oscillator
+// for the whole block, so distance, pan and pitch are worked out once per cue
+// instead of once per sample, and cues that are out of range cost nothing.
+enum {
+  kSpatialBlock = 64,
+};
 
-      int semi = dy / 16;
-      if (semi < -4) semi = -4;
-      if (semi > 4) semi = 4;
-      uint32 adj_inc = (uint32)((uint64)g_phase_inc[c] * g_pitch_mult[semi + 4] >> 15);
-
-      // Per-cue waveform synthesis
-      int16 raw;
-      if (c == kSpatialCue_StairUp || c == kSpatialCue_StairDown) {
-        // Stairs: continuous pitch sweep (up=rising, down=falling)
-        uint32 sweep_period = (uint32)(g_sample_rate * 3 / 4);
-        uint32 frac;
-        if (c == kSpatialCue_StairUp)
-          frac = (g_stair_sweep * 65536) / sweep_period;
-        else
-          frac = ((sweep_period - g_stair_sweep) * 65536) / sweep_period;
-        uint32 inc = adj_inc + (uint32)((uint64)adj_inc * frac >> 16);
-        raw = g_sine_table[(g_phase[c] >> 16) & 0xFF];
-        g_phase[c] += inc;
-      } else if (c == kSpatialCue_Ledge) {
-        // Descending sweep: 600→300Hz per ding (sweep over 350ms cycle)
-        uint32 sweep_period = (uint32)(g_sample_rate * 350 / 1000);
-        uint32 frac = ((sweep_period - g_ledge_sweep) * 65536) / sweep_period;
-        uint32 inc = adj_inc / 2 + (uint32)((uint64)(adj_inc / 2) * frac >> 16);
-        raw = g_sine_table[(g_phase[c] >> 16) & 0xFF];
-        g_phase[c] += inc;
-      } else if (c == kSpatialCue_Hazard) {
-        // Full-wave rectified sine: abs(sin) creates harsh buzz
-        raw = g_sine_table[(g_phase[c] >> 16) & 0xFF];
-        g_phase[c] += adj_inc;
-        if (raw < 0) raw = -raw;
-      } else if (c == kSpatialCue_Enemy) {
-        // Square wave at 440Hz — harsh, menacing character
-        int phase_idx = (g_phase[c] >> 16) & 0xFF;
-        raw = (phase_idx < 128) ? 8000 : -8000;
-        g_phase[c] += adj_inc;
-      } else if (c == kSpatialCue_NPC) {
-        // Double-chime: C4 then E4, position selects which note
-        int beep1_len = g_sample_rate * 60 / 1000;
-        int gap_end = beep1_len + g_sample_rate * 40 / 1000;
-        if (g_npc_beep_pos >= gap_end) {
-          // Second note: E4 (330Hz)
-          raw = g_sine_table[(g_phase[c] >> 16) & 0xFF];
-          g_phase[c] += g_npc_phase_inc2;
-        } else {
-          // First note: C4 (262Hz) — uses base phase_inc
-          raw = g_sine_table[(g_phase[c] >> 16) & 0xFF];
-          g_phase[c] += adj_inc;
-        }
-      } else if (c == kSpatialCue_Liftable) {
-        // Ascending chirp: 200→600Hz over 120ms sweep period
-        uint32 sweep_len = (uint32)(g_sample_rate * 120 / 1000);
-        uint32 sw = g_lift_sweep < sweep_len ? g_lift_sweep : sweep_len;
-        // frac: 0→65536 over sweep_len => freq goes 1x→3x base (200→600Hz)
-        uint32 frac = (sw * 65536) / sweep_len;
-        uint32 inc = adj_inc + (uint32)((uint64)(adj_inc * 2) * frac >> 16);
-        raw = g_sine_table[(g_phase[c] >> 16) & 0xFF];
-        g_phase[c] += inc;
-      } else if (c == kSpatialCue_Chest) {
-        // Vibrato shimmer: 523Hz with 8Hz ±30Hz wobble
-        uint32 vib_period = (uint32)(g_sample_rate / 8);
-        uint32 vib_pos = g_chest_timer > 0 ? (uint32)(g_sample_rate * 800 / 1000 - g_chest_timer) % vib_period : 0;
-        int vib_frac = (int)(vib_pos * 256 / vib_period);
-        int vib_mod = g_sine_table[vib_frac & 0xFF];  // -16383..16383
-        // ±30Hz wobble as fraction of base: 30/523 ≈ 0.057 → ~3735 in 16.16
-        uint32 inc = (uint32)((int64)adj_inc + ((int64)adj_inc * vib_mod / 16383 * 30 / 523));
-        raw = g_sine_table[(g_phase[c] >> 16) & 0xFF];
-        g_phase[c] += inc;
-      } else if (c == kSpatialCue_HoleL || c == kSpatialCue_HoleR) {
-        // Descending sweep: 300→150Hz over 200ms
-        uint32 sweep_len = (uint32)(g_sample_rate * 200 / 1000);
-        uint32 sw = g_hole_sweep < sweep_len ? g_hole_sweep : sweep_len;
-        // frac: 65536→0 (descending) => freq goes from adj_inc to adj_inc/2
-        uint32 frac = ((sweep_len - sw) * 65536) / sweep_len;
-        uint32 inc = adj_inc / 2 + (uint32)((uint64)(adj_inc / 2) * frac >> 16);
-        raw = g_sine_table[(g_phase[c] >> 16) & 0xFF];
-        g_phase[c] += inc;
+typedef struct SpatialBlock {
+  int start, n;  // which samples of the output buffer
+  int32 mix_L[kSpatialBlock], mix_R[kSpatialBlock];
+  // Per sample envelopes of the repeating dings, and the number of samples
+  // since they restarted
+  uint32 wall_env[4][kSpatialBlock];
+  uint32 enemy_env[kSpatialBlock], door_env[kSpatialBlock], stair_env[kSpatialBlock];
+  uint32 hole_env[kSpatialBlock], lift_env[kSpatialBlock], chest_env[kSpatialBlock];
+  uint32 ledge_env[kSpatialBlock], water_env[kSpatialBlock], hazard_env[kSpatialBlock];
+  uint32 npc_age[kSpatialBlock], hole_age[kSpatialBlock], lift_age[kSpatialBlock];
+  uint32 chest_age[kSpatialBlock], conveyor_age[kSpatialBlock];
+} SpatialBlock;
+
+// A positional cue that is audible during this callback.
+typedef struct CueVoice {
+  int cue;
+  int volume;        // from the distance
+  int group_volume;
+  int gain_L, gain_R;
+  uint32 inc;        // phase increment adjusted for the height
+} CueVoice;
+
+static SpatialBlock g_block;
+
+static void DecayEnvelope(uint32 *envelope, uint32 decay, int n, uint32 *env) {
+  uint32 e = *envelope;
+  if (env) {
+    for (int i = 0; i < n; i++)
+      env[i] = e = (uint32)((uint64)e * decay >> 16);
+  } else {
+    for (int i = 0; i < n && e != 0; i++)
+      e = (uint32)((uint64)e * decay >> 16);
+  }
+  *envelope = e;
+}
+
+// Advances a ding that restarts every |period| samples and decays by |decay|
+// each sample. The envelope and the samples since the restart are stored in
+// |env| and |age| if some cue needs them.
+static void RunDing(uint32 *envelope, int *timer, int period, uint32 decay, int n, uint32 *env, uint32 *age) {
+  int t = *timer;
+  for (int i = 0; i < n;) {
+    if (t <= 0) { *envelope = 65536; t = period; }
+    int m = IntMin(n - i, t);
+    if (age) {
+      for (int k = 0; k < m; k++)
+        age[i + k] = period - t + k + 1;
+    }
+    DecayEnvelope(envelope, decay, m, env ? env + i : NULL);
+    t -= m;
+    i += m;
+  }
+  *timer = t;
+}
+
+static void RunDings(SpatialBlock *b, const bool *audible) {
+  int n = b->n, rate = g_sample_rate;
+#define NEED(c, arr) (audible[c] ? (arr) : NULL)
+  for (int w = 0; w < 4; w++) {
+    uint32 *env = NEED(kSpatialCue_WallN + w, b->wall_env[w]);
+    if (g_mix_set.wall_interval[w] > 0) {
+      RunDing(&g_wall_envelope[w], &g_wall_timer[w], g_mix_set.wall_interval[w], g_wall_decay, n, env, NULL);
+    } else {
+      g_wall_timer[w] = IntMax(g_wall_timer[w] - n, 0);
+      DecayEnvelope(&g_wall_envelope[w], g_wall_decay, n, env);
+    }
+  }
+  // The NPC double-chime only uses the position in its 1.2s pattern
+  RunDing(&g_ding_envelope, &g_ding_timer, rate * 12 / 10, 0, n, NULL, NEED(kSpatialCue_NPC, b->npc_age));
+  RunDing(&g_enemy_envelope, &g_enemy_timer, rate / 5, g_enemy_decay, n, NEED(kSpatialCue_Enemy, b->enemy_env), NULL);
+  RunDing(&g_door_envelope, &g_door_timer, rate * 2 / 5, g_door_decay, n, NEED(kSpatialCue_Door, b->door_env), NULL);
+  RunDing(&g_stair_envelope, &g_stair_timer, rate * 3 / 10, g_stair_decay, n,
+          audible[kSpatialCue_StairUp] || audible[kSpatialCue_StairDown] ? b->stair_env : NULL, NULL);
+  bool hole = audible[kSpatialCue_HoleL] || audible[kSpatialCue_HoleR];
+  RunDing(&g_hole_envelope, &g_hole_timer, rate / 2, g_hole_decay, n, hole ? b->hole_env : NULL, hole ? b->hole_age : NULL);
+  // Liftable "swipe": 120ms decay, 700ms repeat
+  RunDing(&g_lift_envelope, &g_lift_timer, rate * 700 / 1000, g_lift_decay, n,
+          NEED(kSpatialCue_Liftable, b->lift_env), NEED(kSpatialCue_Liftable, b->lift_age));
+  // Chest "sparkle": 200ms decay, 800ms repeat
+  RunDing(&g_chest_envelope, &g_chest_timer, rate * 800 / 1000, g_chest_decay, n,
+          NEED(kSpatialCue_Chest, b->chest_env), NEED(kSpatialCue_Chest, b->chest_age));
+  // Ledge: 80ms decay, 350ms repeat
+  RunDing(&g_ledge_envelope, &g_ledge_timer, rate * 350 / 1000, g_ledge_decay, n, NEED(kSpatialCue_Ledge, b->ledge_env), NULL);
+  // Deep water: 250ms decay, 600ms repeat
+  RunDing(&g_water_envelope, &g_water_timer, rate * 600 / 1000, g_water_decay, n, NEED(kSpatialCue_DeepWater, b->water_env), NULL);
+  // Hazard: 40ms decay, 150ms repeat
+  RunDing(&g_hazard_envelope, &g_hazard_timer, rate * 150 / 1000, g_hazard_decay, n, NEED(kSpatialCue_Hazard, b->hazard_env), NULL);
+  uint32 conveyor_envelope = 0;
+  RunDing(&conveyor_envelope, &g_conveyor_timer, g_conveyor_cycle_len, 0, n, NULL, NEED(kSpatialCue_Conveyor, b->conveyor_age));
+#undef NEED
+}
+
+// Ding that fades from full volume down to a third of it.
+static inline int DingVolume(int volume, uint32 env) {
+  int base = volume / 3;
+  int ding = (int)((uint32)(volume * 2 / 3) * env >> 16);
+  volume = (base + ding) * 2;
+  return volume > 512 ? 512 : volume;
+}
+
+// Volume of a cue for each sample of the block.
+static void CueVolume(const CueVoice *v, const SpatialBlock *b, int32 *vol) {
+  int n = b->n, volume = v->volume;
+  switch (v->cue) {
+  case kSpatialCue_WallN: case kSpatialCue_WallS: case kSpatialCue_WallE: case kSpatialCue_WallW: {
+    const uint32 *env = b->wall_env[v->cue - kSpatialCue_WallN];
+    for (int i = 0; i < n; i++)
+      vol[i] = (int)((uint32)volume * env[i] >> 16);
+    break;
+  }
+  case kSpatialCue_NPC: {
+    // Double-chime: beep1 60ms, gap 40ms, beep2 60ms, silence until repeat
+    int beep1_len = g_sample_rate * 60 / 1000;
+    int gap_end = beep1_len + g_sample_rate * 40 / 1000;
+    int beep2_end = gap_end + beep1_len;
+    for (int i = 0; i < n; i++) {
+      int pos = b->npc_age[i];
+      if (pos < beep1_len) {
+        int env = (beep1_len - pos) * 65536 / beep1_len;
+        vol[i] = (int)((uint32)volume * env >> 16);
+      } else if (pos >= gap_end && pos < beep2_end) {
+        int env = (beep1_len - (pos - gap_end)) * 65536 / beep1_len;
+        vol[i] = (int)((uint32)volume * env >> 16);
       } else {
-        raw = g_sine_table[(g_phase[c] >> 16) & 0xFF];
-        g_phase[c] += adj_inc;
+        vol[i] = 0;
       }
+    }
+    break;
+  }
+  case kSpatialCue_Enemy: case kSpatialCue_Door: case kSpatialCue_StairUp: case kSpatialCue_StairDown:
+  case kSpatialCue_HoleL: case kSpatialCue_HoleR: {
+    const uint32 *env = v->cue == kSpatialCue_Enemy ? b->enemy_env : v->cue == kSpatialCue_Door ? b->door_env :
+                        v->cue >= kSpatialCue_StairUp && v->cue <= kSpatialCue_StairDown ? b->stair_env : b->hole_env;
+    for (int i = 0; i < n; i++)
+      vol[i] = DingVolume(volume, env[i]);
+    break;
+  }
+  case kSpatialCue_Liftable: case kSpatialCue_Chest: case kSpatialCue_Ledge: case kSpatialCue_Hazard: {
+    const uint32 *env = v->cue == kSpatialCue_Liftable ? b->lift_env : v->cue == kSpatialCue_Chest ? b->chest_env :
+                        v->cue == kSpatialCue_Ledge ? b->ledge_env : b->hazard_env;
+    for (int i = 0; i < n; i++)
+      vol[i] = (int)((uint32)volume * env[i] >> 16);
+    break;
+  }
+  case kSpatialCue_DeepWater: {
+    // 4Hz tremolo (amplitude modulation)
+    int am_period = g_sample_rate / 4;
+    for (int i = 0; i < n; i++) {
+      int am_frac = (b->start + i) % am_period * 256 / am_period;
+      int am_mult = 128 + (g_sine_table[am_frac & 0xFF] >> 8);  // 0-256 range
+      vol[i] = (int)((uint32)volume * b->water_env[i] >> 16) * am_mult >> 8;
+    }
+    break;
+  }
+  case kSpatialCue_Conveyor: {
+    // Double-pulse pattern: two 30ms pulses separated by 30ms gap, then silence
+    int pulse_len = g_sample_rate * 30 / 1000;
+    for (int i = 0; i < n; i++) {
+      int pos_in_cycle = b->conveyor_age[i];
+      bool pulse_on = (pos_in_cycle < pulse_len) ||
+                      (pos_in_cycle >= pulse_len * 2 && pos_in_cycle < pulse_len * 3);
+      vol[i] = pulse_on ? volume : 0;
+    }
+    break;
+  }
+  default:
+    for (int i = 0; i < n; i++)
+      vol[i] = volume;
+    break;
+  }
+}
+
+// Waveform of a cue for each sample of the block.
+static void CueOscillator(const CueVoice *v, const SpatialBlock *b, int16 *raw) {
+  int n = b->n, c = v->cue;
+  uint32 phase = g_phase[c], adj_inc = v->inc;
+  switch (c) {
+  case kSpatialCue_StairUp: case kSpatialCue_StairDown: {
+    // Stairs: continuous pitch sweep (up=rising, down=falling)
+    uint32 sweep_period = (uint32)(g_sample_rate * 3 / 4);
+    uint32 sweep = g_stair_sweep;
+    for (int i = 0; i < n; i++) {
+      if (++sweep >= sweep_period)
+        sweep = 0;
+      uint32 frac = ((c == kSpatialCue_StairUp ? sweep : sweep_period - sweep) * 65536) / sweep_period;
+      raw[i] = g_sine_table[(phase >> 16) & 0xFF];
+      phase += adj_inc + (uint32)((uint64)adj_inc * frac >> 16);
+    }
+    break;
+  }
+  case kSpatialCue_Ledge: {
+    // Descending sweep: 600→300Hz per ding (sweep over 350ms cycle)
+    uint32 sweep_period = (uint32)(g_sample_rate * 350 / 1000);
+    uint32 sweep = g_ledge_sweep;
+    for (int i = 0; i < n; i++) {
+      if (++sweep >= sweep_period)
+        sweep = 0;
+      uint32 frac = ((sweep_period - sweep) * 65536) / sweep_period;
+      raw[i] = g_sine_table[(phase >> 16) & 0xFF];
+      phase += adj_inc / 2 + (uint32)((uint64)(adj_inc / 2) * frac >> 16);
+    }
+    break;
+  }
+  case kSpatialCue_Hazard:
+    // Full-wave rectified sine: abs(sin) creates harsh buzz
+    for (int i = 0; i < n; i++, phase += adj_inc) {
+      int16 r = g_sine_table[(phase >> 16) & 0xFF];
+      raw[i] = r < 0 ? -r : r;
+    }
+    break;
+  case kSpatialCue_Enemy:
+    // Square wave at 440Hz — harsh, menacing character
+    for (int i = 0; i < n; i++, phase += adj_inc)
+      raw[i] = ((phase >> 16) & 0xFF) < 128 ? 8000 : -8000;
+    break;
+  case kSpatialCue_NPC: {
+    // Double-chime: C4 then E4, position selects which note
+    int gap_end = g_sample_rate * 60 / 1000 + g_sample_rate * 40 / 1000;
+    for (int i = 0; i < n; i++) {
+      raw[i] = g_sine_table[(phase >> 16) & 0xFF];
+      phase += (int)b->npc_age[i] >= gap_end ? g_npc_phase_inc2 : adj_inc;
+    }
+    break;
+  }
+  case kSpatialCue_Liftable: {
+    // Ascending chirp: 200→600Hz over 120ms sweep period
+    uint32 sweep_len = (uint32)(g_sample_rate * 120 / 1000);
+    for (int i = 0; i < n; i++) {
+      uint32 sw = b->lift_age[i] < sweep_len ? b->lift_age[i] : sweep_len;
+      // frac: 0→65536 over sweep_len => freq goes 1x→3x base (200→600Hz)
+      uint32 frac = (sw * 65536) / sweep_len;
+      raw[i] = g_sine_table[(phase >> 16) & 0xFF];
+      phase += adj_inc + (uint32)((uint64)(adj_inc * 2) * frac >> 16);
+    }
+    break;
+  }
+  case kSpatialCue_Chest: {
+    // Vibrato shimmer: 523Hz with 8Hz ±30Hz wobble
+    uint32 vib_period = (uint32)(g_sample_rate / 8);
+    uint32 period = (uint32)(g_sample_rate * 800 / 1000);
+    for (int i = 0; i < n; i++) {
+      uint32 vib_pos = b->chest_age[i] < period ? b->chest_age[i] % vib_period : 0;
+      int vib_frac = (int)(vib_pos * 256 / vib_period);
+      int vib_mod = g_sine_table[vib_frac & 0xFF];  // -16383..16383
+      // ±30Hz wobble as fraction of base: 30/523 ≈ 0.057 → ~3735 in 16.16
+      raw[i] = g_sine_table[(phase >> 16) & 0xFF];
+      phase += (uint32)((int64)adj_inc + ((int64)adj_inc * vib_mod / 16383 * 30 / 523));
+    }
+    break;
+  }
+  case kSpatialCue_HoleL: case kSpatialCue_HoleR: {
+    // Descending sweep: 300→150Hz over 200ms
+    uint32 sweep_len = (uint32)(g_sample_rate * 200 / 1000);
+    for (int i = 0; i < n; i++) {
+      uint32 sw = b->hole_age[i] < sweep_len ? b->hole_age[i] : sweep_len;
+      // frac: 65536→0 (descending) => freq goes from adj_inc to adj_inc/2
+      uint32 frac = ((sweep_len - sw) * 65536) / sweep_len;
+      raw[i] = g_sine_table[(phase >> 16) & 0xFF];
+      phase += adj_inc / 2 + (uint32)((uint64)(adj_inc / 2) * frac >> 16);
+    }
+    break;
+  }
+  default:
+    for (int i = 0; i < n; i++, phase += adj_inc)
+      raw[i] = g_sine_table[(phase >> 16) & 0xFF];
+    break;
+  }
+  g_phase[c] = phase;
+}
+
+static void MixCue(SpatialBlock *b, const CueVoice *v) {
+  int32 vol[kSpatialBlock];
+  int16 raw[kSpatialBlock];
+  CueVolume(v, b, vol);
+  CueOscillator(v, b, raw);
+  int group_volume = v->group_volume, gain_L = v->gain_L, gain_R = v->gain_R;
+  for (int i = 0; i < b->n; i++) {
+    int32 scaled = (int32)raw[i] * (vol[i] * group_volume / 100) >> 8;
+    b->mix_L[i] += scaled * gain_L >> 8;
+    b->mix_R[i] += scaled * gain_R >> 8;
+  }
+}
 
-      int32 scaled = (int32)raw * volume >> 8;
-      mix_L += scaled * gain_L >> 8;
-      mix_R += scaled * gain_R >> 8;
+// Works out which cues can be heard, and their volume, pan and pitch, which
+// stay the same for the whole callback.
+static int SetupCueVoices(CueVoice *voices, bool *audible) {
+  int count = 0;
+  for (int c = 0; c < kSpatialCue_Count; c++) {
+    audible[c] = false;
+    if (!g_mix_set.cues[c].active) continue;
+    int dx = g_mix_set.cues[c].dx;
+    int dy = g_mix_set.cues[c].dy;
+    int dist = (int)isqrt32((uint32)(dx * dx + dy * dy));
+    if (dist >= SCAN_RANGE) continue;
+    CueVoice *v = &voices[count++];
+    audible[c] = true;
+    v->cue = c;
+    v->volume = (SCAN_RANGE - dist) * 256 / SCAN_RANGE;
+    int grp = CueToGroup(c);
+    v->group_volume = grp >= 0 ? g_cue_group_volume[grp] : 100;
+    if (c >= kSpatialCue_WallN && c <= kSpatialCue_WallW) {
+      // Hard-pan wall cues by direction for clear spatial distinction
+      switch (c) {
+      case kSpatialCue_WallE: v->gain_L = 32;  v->gain_R = 224; break;  // right
+      case kSpatialCue_WallW: v->gain_L = 224; v->gain_R = 32;  break;  // left
+      default:                v->gain_L = 128; v->gain_R = 128; break;  // N/S center
+      }
+    } else {
+      int clamped_dx = dx < -64 ? -64 : (dx > 64 ? 64 : dx);
+      v->gain_L = (64 - clamped_dx) * 2;
+      v->gain_R = (64 + clamped_dx) * 2;
     }
+    int semi = dy / 16;
+    if (semi < -4) semi = -4;
+    if (semi > 4) semi = 4;
+    v->inc = (uint32)((uint64)g_phase_inc[c] * g_pitch_mult[semi + 4] >> 15);
+  }
+  return count;
+}
 
-    // Blocked ding
-    if (g_blocked_active) {
+// Low thud while walking into something.
+static void MixBlocked(SpatialBlock *b) {
+  if (!g_mix_set.blocked_active && g_blocked_envelope == 0) {
+    g_blocked_timer = IntMax(g_blocked_timer - b->n, 0);
+    return;
+  }
+  for (int i = 0; i < b->n; i++) {
+    if (g_mix_set.blocked_active) {
       if (g_blocked_timer <= 0) {
         g_blocked_envelope = 65536;
         g_blocked_timer = g_sample_rate / 2;
@@ -1946,12 +2276,21 @@ void SpatialAudio_MixAudio(int16 *buf, int samples, int channels) {
       g_blocked_phase += g_blocked_phase_inc;
       int32 scaled = (int32)raw * (int)(g_blocked_envelope >> 8) >> 8;
       scaled = scaled * g_cue_group_volume[kCueGroup_Combat] / 100;
-      mix_L += scaled;
-      mix_R += scaled;
+      b->mix_L[i] += scaled;
+      b->mix_R[i] += scaled;
     }
+  }
+}
 
-    // Hole proximity warning ding — pitch encodes up/down, panning encodes left/right
-    if (g_hole_warn_active) {
+// Hole proximity warning ding, pitch encodes up/down, panning encodes left/right.
+static void MixHoleWarning(SpatialBlock *b) {
+  if (!g_mix_set.hole_warn_active && g_hole_warn_envelope <= 100) {
+    g_hole_warn_timer = IntMax(g_hole_warn_timer - b->n, 0);
+    DecayEnvelope(&g_hole_warn_envelope, g_hole_warn_decay, b->n, NULL);
+    return;
+  }
+  for (int i = 0; i < b->n; i++) {
+    if (g_mix_set.hole_warn_active) {
       if (g_hole_warn_timer <= 0) {
         g_hole_warn_envelope = 65536;
         g_hole_warn_timer = g_sample_rate / 4;  // repeat every 250ms
@@ -1962,9 +2301,9 @@ void SpatialAudio_MixAudio(int16 *buf, int samples, int channels) {
     if (g_hole_warn_envelope > 100) {
       // Pick phase increment based on hole direction: up=high, down=low, level=base
       uint32 warn_inc;
-      if (g_hole_warn_dy < -4)
+      if (g_mix_set.hole_warn_dy < -4)
         warn_inc = g_hole_warn_phase_inc_hi;   // hole above → high pitch
-      else if (g_hole_warn_dy > 4)
+      else if (g_mix_set.hole_warn_dy > 4)
         warn_inc = g_hole_warn_phase_inc_lo;   // hole below → low pitch
       else
         warn_inc = g_hole_warn_phase_inc_base;  // hole at same level
@@ -1973,18 +2312,24 @@ void SpatialAudio_MixAudio(int16 *buf, int samples, int channels) {
       int32 scaled = (int32)raw * (int)(g_hole_warn_envelope >> 8) >> 8;
       scaled = scaled * g_cue_group_volume[kCueGroup_Holes] / 100;
       // Pan based on hole's horizontal direction
-      int cdx = g_hole_warn_dx < -16 ? -16 : (g_hole_warn_dx > 16 ? 16 : g_hole_warn_dx);
+      int cdx = g_mix_set.hole_warn_dx < -16 ? -16 : (g_mix_set.hole_warn_dx > 16 ? 16 : g_mix_set.hole_warn_dx);
       int wL = (16 - cdx) * 8;  // 0-256 range
       int wR = (16 + cdx) * 8;
-      mix_L += scaled * wL >> 8;
-      mix_R += scaled * wR >> 8;
+      b->mix_L[i] += scaled * wL >> 8;
+      b->mix_R[i] += scaled * wR >> 8;
     }
+  }
+}
 
-    // Combat indicators
-
-    // Sword range: ascending double-beep (880Hz then 1100Hz)
-    // Pattern: [beep1 40ms] [gap 20ms] [beep2 40ms] [silence until 500ms]
-    if (g_sword_range_active) {
+// Sword range: ascending double-beep (880Hz then 1100Hz)
+// Pattern: [beep1 40ms] [gap 20ms] [beep2 40ms] [silence until 500ms]
+static void MixSwordRange(SpatialBlock *b) {
+  if (!g_mix_set.sword_range_active) {
+    g_sword_range_timer = IntMax(g_sword_range_timer - b->n, 0);
+    return;
+  }
+  for (int i = 0; i < b->n; i++) {
+    if (g_mix_set.sword_range_active) {
       if (g_sword_range_timer <= 0) {
         g_sword_range_timer = g_sample_rate / 2;  // repeat every 500ms
         g_sword_range_beep_pos = 0;
@@ -1999,8 +2344,8 @@ void SpatialAudio_MixAudio(int16 *buf, int samples, int channels) {
         int vol = 65536 - (g_sword_range_beep_pos * 65536 / beep1_end);
         int32 scaled = (int32)raw * (vol >> 8) >> 8;
         scaled = scaled * g_cue_group_volume[kCueGroup_Combat] / 100;
-        mix_L += scaled;
-        mix_R += scaled;
+        b->mix_L[i] += scaled;
+        b->mix_R[i] += scaled;
       } else if (g_sword_range_beep_pos >= gap_end && g_sword_range_beep_pos < beep2_end) {
         // Second beep: 1100Hz (higher = ascending)
         int pos_in_beep = g_sword_range_beep_pos - gap_end;
@@ -2010,14 +2355,20 @@ void SpatialAudio_MixAudio(int16 *buf, int samples, int channels) {
         int vol = 65536 - (pos_in_beep * 65536 / beep_len);
         int32 scaled = (int32)raw * (vol >> 8) >> 8;
         scaled = scaled * g_cue_group_volume[kCueGroup_Combat] / 100;
-        mix_L += scaled;
-        mix_R += scaled;
+        b->mix_L[i] += scaled;
+        b->mix_R[i] += scaled;
       }
       g_sword_range_beep_pos++;
     }
     if (g_sword_range_timer > 0) g_sword_range_timer--;
+  }
+}
 
-    // Danger drill: rapid amplitude-modulated buzz on entering danger zone
+// Danger drill: rapid amplitude-modulated buzz on entering danger zone
+static void MixDangerDrill(SpatialBlock *b) {
+  if (g_danger_drill_pos < 0 || g_danger_drill_pos >= g_danger_drill_len)
+    return;
+  for (int i = 0; i < b->n; i++) {
     if (g_danger_drill_pos >= 0 && g_danger_drill_pos < g_danger_drill_len) {
       // 300Hz tone modulated on/off at 25Hz (toggle every 20ms)
       int mod_period = g_sample_rate / 25;
@@ -2030,13 +2381,19 @@ void SpatialAudio_MixAudio(int16 *buf, int samples, int channels) {
         int vol = (g_danger_drill_len - g_danger_drill_pos) * 256 / g_danger_drill_len;
         int32 scaled = (int32)raw * vol >> 8;
         scaled = scaled * g_cue_group_volume[kCueGroup_Combat] / 100;
-        mix_L += scaled;
-        mix_R += scaled;
+        b->mix_L[i] += scaled;
+        b->mix_R[i] += scaled;
       }
       g_danger_drill_pos++;
     }
+  }
+}
 
-    // Danger exit chime: E4 then B3 (descending) when leaving danger zone
+// Danger exit chime: E4 then B3 (descending) when leaving danger zone
+static void MixDangerExit(SpatialBlock *b) {
+  if (g_danger_exit_pos < 0 || g_danger_exit_pos >= g_danger_exit_len)
+    return;
+  for (int i = 0; i < b->n; i++) {
     if (g_danger_exit_pos >= 0 && g_danger_exit_pos < g_danger_exit_len) {
       int note_len = g_sample_rate * 40 / 1000;   // 40ms per note
       int gap_end = note_len + g_sample_rate * 40 / 1000;  // 40ms gap
@@ -2058,17 +2415,26 @@ void SpatialAudio_MixAudio(int16 *buf, int samples, int channels) {
       }
       if (raw) {
         int32 dr = (int32)raw * g_cue_group_volume[kCueGroup_Combat] / 100;
-        mix_L += dr;
-        mix_R += dr;
+        b->mix_L[i] += dr;
+        b->mix_R[i] += dr;
       }
       g_danger_exit_pos++;
     }
+  }
+}
 
-    // Alignment sonar ping — variable rate based on precision
-    if (g_align_interval > 0) {
+// Alignment sonar ping, variable rate based on precision
+static void MixAlignPing(SpatialBlock *b) {
+  if (g_mix_set.align_interval <= 0 && g_align_envelope <= 100) {
+    g_align_timer = IntMax(g_align_timer - b->n, 0);
+    DecayEnvelope(&g_align_envelope, g_align_decay, b->n, NULL);
+    return;
+  }
+  for (int i = 0; i < b->n; i++) {
+    if (g_mix_set.align_interval > 0) {
       if (g_align_timer <= 0) {
         g_align_envelope = 65536;
-        g_align_timer = g_align_interval;
+        g_align_timer = g_mix_set.align_interval;
       }
     }
     if (g_align_timer > 0) g_align_timer--;
@@ -2078,21 +2444,35 @@ void SpatialAudio_MixAudio(int16 *buf, int samples, int channels) {
       g_align_phase += g_align_phase_inc;
       int32 scaled = (int32)raw * (int)(g_align_envelope >> 8) >> 8;
       scaled = scaled * g_cue_group_volume[kCueGroup_Combat] / 100;
-      mix_L += scaled;
-      mix_R += scaled;
+      b->mix_L[i] += scaled;
+      b->mix_R[i] += scaled;
     }
+  }
+}
 
-    // Room change chime
+// Room change chime
+static void MixRoomChime(SpatialBlock *b) {
+  if (g_room_chime_envelope <= 100) {
+    DecayEnvelope(&g_room_chime_envelope, g_room_chime_decay, b->n, NULL);
+    return;
+  }
+  for (int i = 0; i < b->n; i++) {
     if (g_room_chime_envelope > 100) {
       int16 raw = g_sine_table[(g_room_chime_phase >> 16) & 0xFF];
       g_room_chime_phase += g_room_chime_phase_inc;
       int32 scaled = (int32)raw * (int)(g_room_chime_envelope >> 8) >> 8;
-      mix_L += scaled;
-      mix_R += scaled;
+      b->mix_L[i] += scaled;
+      b->mix_R[i] += scaled;
     }
     g_room_chime_envelope = (uint32)((uint64)g_room_chime_envelope * g_room_chime_decay >> 16);
+  }
+}
 
-    // Passage chimes: double-note when a lateral wall disappears
+// Passage chimes: double-note when a lateral wall disappears
+static void MixPassageChimes(SpatialBlock *b) {
+  if (g_passage_pos[0] < 0 && g_passage_pos[1] < 0 && g_passage_pos[2] < 0 && g_passage_pos[3] < 0)
+    return;
+  for (int i = 0; i < b->n; i++) {
     for (int pw = 0; pw < 4; pw++) {
       if (g_passage_pos[pw] < 0 || g_passage_pos[pw] >= g_passage_chime_len) {
         if (g_passage_pos[pw] >= g_passage_chime_len) g_passage_pos[pw] = -1;
@@ -2104,25 +2484,31 @@ void SpatialAudio_MixAudio(int16 *buf, int samples, int channels) {
       int16 raw = 0;
       if (g_passage_pos[pw] < note1_end) {
         raw = g_sine_table[(g_passage_phase[pw] >> 16) & 0xFF];
-        g_passage_phase[pw] += g_passage_inc1[pw];
+        g_passage_phase[pw] += g_mix_set.passage_inc1[pw];
         int fade = (note1_end - g_passage_pos[pw]) * 256 / note1_end;
         raw = (int16)((int32)raw * fade >> 8);
       } else if (g_passage_pos[pw] >= gap_end && g_passage_pos[pw] < note2_end) {
         raw = g_sine_table[(g_passage_phase[pw] >> 16) & 0xFF];
-        g_passage_phase[pw] += g_passage_inc2[pw];
+        g_passage_phase[pw] += g_mix_set.passage_inc2[pw];
         int pos_in = g_passage_pos[pw] - gap_end;
         int note2_len = note2_end - gap_end;
         int fade = (note2_len - pos_in) * 256 / note2_len;
         raw = (int16)((int32)raw * fade >> 8);
       }
       if (raw) {
-        mix_L += (int32)raw * g_passage_pan_L[pw] >> 8;
-        mix_R += (int32)raw * g_passage_pan_R[pw] >> 8;
+        b->mix_L[i] += (int32)raw * g_mix_set.passage_pan_L[pw] >> 8;
+        b->mix_R[i] += (int32)raw * g_mix_set.passage_pan_R[pw] >> 8;
       }
       g_passage_pos[pw]++;
     }
+  }
+}
 
-    // Terrain transition tone (center-panned, decaying sine)
+// Terrain transition tone (center-panned, decaying sine)
+static void MixTerrainTone(SpatialBlock *b) {
+  if (g_terrain_pos < 0 || g_terrain_pos >= g_terrain_len)
+    return;
+  for (int i = 0; i < b->n; i++) {
     if (g_terrain_pos >= 0 && g_terrain_pos < g_terrain_len) {
       int16 raw = g_sine_table[(g_terrain_phase >> 16) & 0xFF];
       g_terrain_phase += g_terrain_phase_inc;
@@ -2137,13 +2523,19 @@ void SpatialAudio_MixAudio(int16 *buf, int samples, int channels) {
       }
       int32 scaled = (int32)raw * vol >> 8;
       scaled = scaled * g_cue_group_volume[kCueGroup_Terrain] / 100;
-      mix_L += scaled;
-      mix_R += scaled;
+      b->mix_L[i] += scaled;
+      b->mix_R[i] += scaled;
       g_terrain_envelope = (uint32)((uint64)g_terrain_envelope * g_terrain_decay >> 16);
       g_terrain_pos++;
     }
+  }
+}
 
-    // Legend demo sound synthesis
+// Legend demo sound synthesis
+static void MixLegendDemo(SpatialBlock *b) {
+  if (!g_legend_active || g_legend_demo_pos < 0 || g_legend_demo_pos >= g_sample_rate)
+    return;
+  for (int i = 0; i < b->n; i++) {
     if (g_legend_active && g_legend_demo_pos >= 0) {
       int demo_len = g_sample_rate;  // 1 second max demo
       if (g_legend_demo_pos < demo_len) {
@@ -2442,14 +2834,54 @@ void SpatialAudio_MixAudio(int16 *buf, int samples, int channels) {
         }
         }
         int32 demo_scaled = (int32)demo_raw * demo_vol >> 8;
-        mix_L += demo_scaled;
-        mix_R += demo_scaled;
+        b->mix_L[i] += demo_scaled;
+        b->mix_R[i] += demo_scaled;
         g_legend_demo_pos++;
       }
     }
+  }
+}
 
-    buf[s * 2 + 0] += (int16)(mix_L >> 1);
-    buf[s * 2 + 1] += (int16)(mix_R >> 1);
+void SpatialAudio_MixAudio(int16 *buf, int samples, int channels) {
+  if (!g_enabled || channels != 2) return;
+
+  SpatialCueSet set;
+  while (SpscRing_Pop(g_cue_ring, &set))
+    ApplyCueSet(&set);
+
+  CueVoice voices[kSpatialCue_Count];
+  bool audible[kSpatialCue_Count];
+  int num_voices = SetupCueVoices(voices, audible);
+
+  SpatialBlock *b = &g_block;
+  for (b->start = 0; b->start < samples; b->start += b->n) {
+    b->n = IntMin(samples - b->start, kSpatialBlock);
+    memset(b->mix_L, 0, sizeof(b->mix_L));
+    memset(b->mix_R, 0, sizeof(b->mix_R));
+
+    RunDings(b, audible);
+    for (int i = 0; i < num_voices; i++)
+      MixCue(b, &voices[i]);
+    // Sweep counters: wrap every 0.75 and 0.35 seconds
+    g_stair_sweep = (g_stair_sweep + b->n) % (uint32)(g_sample_rate * 3 / 4);
+    g_ledge_sweep = (g_ledge_sweep + b->n) % (uint32)(g_sample_rate * 350 / 1000);
+
+    MixBlocked(b);
+    MixHoleWarning(b);
+    MixSwordRange(b);
+    MixDangerDrill(b);
+    MixDangerExit(b);
+    MixAlignPing(b);
+    MixRoomChime(b);
+    MixPassageChimes(b);
+    MixTerrainTone(b);
+    MixLegendDemo(b);
+
+    int16 *dst = buf + b->start * 2;
+    for (int i = 0; i < b->n; i++) {
+      dst[i * 2 + 0] += (int16)(b->mix_L[i] >> 1);
+      dst[i * 2 + 1] += (int16)(b->mix_R[i] >> 1);
+    }
   }
 }
 
@@ -2476,7 +2908,7 @@ void SpatialAudio_ToggleLegend(void) {
     g_legend_index = 0;
     g_legend_demo_pos = -1;
     // Clear spatial cues so they don't play during legend
-    memset(g_cue_snapshot, 0, sizeof(g_cue_snapshot));
+    ClearCues();
 #if defined(__APPLE__) || defined(_WIN32)
     SpeechSynthesis_Speak(A11y(kA11y_LegendOpen));
 #endif
@@ -2602,7 +3034,7 @@ void SpatialAudio_ToggleOptions(void) {
   if (g_options_active) {
     g_options_index = 0;
     g_options_menu = 0;
-    memset(g_cue_snapshot, 0, sizeof(g_cue_snapshot));
+    ClearCues();
 #if defined(__APPLE__) || defined(_WIN32)
     SpeechSynthesis_Speak(A11y(kA11y_OptionsOpen));
 #endif
@@ -2678,7 +3110,7 @@ void SpatialAudio_OptionsAdjust(int dir) {
     } else if (g_options_index == kSoundSetup_DetectionRange) {
       int range = g_scan_range + dir * 16;
       if (range < 32) range = 32;
-      if (range > 192) range = 192;
+      if (range > SCAN_RANGE_MAX) range = SCAN_RANGE_MAX;
       g_scan_range = range;
 #if defined(__APPLE__) || defined(_WIN32)
       snprintf(buf, sizeof(buf), "%d", range);
@@ -2785,7 +3217,7 @@ int SpatialAudio_GetScanRange(void) {
 
 void SpatialAudio_SetScanRange(int range) {
   if (range < 32) range = 32;
-  if (range > 192) range = 192;
+  if (range > SCAN_RANGE_MAX) range = SCAN_RANGE_MAX;
   g_scan_range = range;
 }
 
@@ -2858,7 +3290,7 @@ void SpatialAudio_LoadSettings(void) {
 
     if (strcmp(key, "scan_range") == 0) {
       int r = atoi(val);
-      if (r >= 32 && r <= 192) g_scan_range = r;
+      if (r >= 32 && r <= SCAN_RANGE_MAX) g_scan_range = r;
       continue;
     }
 
@@ -1192,6 +1192,11 @@ SpcPlayer *SpcPlayer_Create() {
   return p;
 }
 
+void SpcPlayer_Destroy(SpcPlayer *p) {
+  dsp_free(p->dsp);
+  free(p);
+}
+
 void SpcPlayer_Initialize(SpcPlayer *p) {
   Interrupt_Reset(p);
   Spc_Loop_Part1(p);
@@ -1237,14 +1242,33 @@ void SpcPlayer_GenerateSamples(SpcPlayer *p) {
 
     p->timer_cycles += n;
 
-    for (int i = 0; i < n; i++)
-      dsp_cycle(p->dsp);
+    dsp_cycleBlock(p->dsp, n);
 
     if (p->dsp->sampleOffset == 534)
       break;
   }
 }
 
+// Advances the player by the same amount of time as SpcPlayer_GenerateSamples,
+// but without running the dsp. Used to fast forward the game.
+void SpcPlayer_RunWithoutSamples(SpcPlayer *p) {
+  assert(p->timer_cycles <= 64);
+
+  int n = 534 - p->dsp->sampleOffset;
+  for (;;) {
+    if (p->timer_cycles >= 64) {
+      Spc_Loop_Part2(p, p->timer_cycles >> 6);
+      Spc_Loop_Part1(p);
+      p->timer_cycles &= 63;
+    }
+    int m = IntMin(n, 64 - p->timer_cycles);
+    p->timer_cycles += m;
+    n -= m;
+    if (n == 0)
+      break;
+  }
+}
+
 void SpcPlayer_Upload(SpcPlayer *p, const uint8_t *data) {
   Dsp_Write(p, EVOLL, 0);
   Dsp_Write(p, EVOLR, 0);
@@ -1267,6 +1291,7 @@ void SpcPlayer_Upload(SpcPlayer *p, const uint8_t *data) {
   p->port3_active = 0;
   p->is_chan_on = 0;
   p->input_ports[0] = p->input_ports[1] = p->input_ports[2] = p->input_ports[3] = 0;
+  dsp_buildBrrCache(p->dsp);
 }
 
 // =======================================
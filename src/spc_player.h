@@ -138,7 +138,9 @@ typedef struct SpcPlayer {
 } SpcPlayer;
 
 SpcPlayer *SpcPlayer_Create();
+void SpcPlayer_Destroy(SpcPlayer *p);
 void SpcPlayer_GenerateSamples(SpcPlayer *p);
+void SpcPlayer_RunWithoutSamples(SpcPlayer *p);
 void SpcPlayer_Initialize(SpcPlayer *p);
 void SpcPlayer_Upload(SpcPlayer *p, const uint8_t *data);
 void SpcPlayer_CopyVariablesFromRam(SpcPlayer *p);
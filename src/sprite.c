@@ -13,6 +13,7 @@
 #include "tile_detect.h"
 #include "sprite_main.h"
 #include "assets.h"
+#include "profiler.h"
 static const uint16 kOamGetBufferPos_Tab0[6] = {0x171, 0x201, 0x31, 0xc1, 0x141, 0x1d1};
 static const uint16 kOamGetBufferPos_Tab1[48] = {
    0x30,  0x50,  0x80,  0xb0,  0xe0, 0x110, 0x140, 0x170, 0x1d0, 0x1d4, 0x1dc, 0x1e0, 0x1e4, 0x1ec, 0x1f0, 0x1f8,
@@ -1108,6 +1109,7 @@ void Sprite_SpawnSecret(int k) {  // 868264
 }
 
 void Sprite_Main() {  // 868328
+  uint64 prof = Profiler_Begin();
   if (!player_is_indoors) {
     ancilla_floor[0] = 0;
     ancilla_floor[1] = 0;
@@ -1147,6 +1149,7 @@ void Sprite_Main() {  // 868328
   ExecuteCachedSprites();
   if (load_chr_halfslot_even_odd)
     byte_7E0FC6 = load_chr_halfslot_even_odd;
+  Profiler_End(kProfZone_Sprites, prof);
 }
 
 void Oam_ResetRegionBases() {  // 8683d3
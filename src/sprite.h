@@ -1,14 +1,8 @@
 #pragma once
 #include "types.h"
+#include "zelda_rtl.h"
 #include "variables.h"
 
-
-typedef struct PrepOamCoordsRet {
-  uint16 x, y;
-  uint8 r4;
-  uint8 flags;
-} PrepOamCoordsRet;
-
 typedef struct SpriteHitBox {
   uint8 r0_xlo;
   uint8 r8_xhi;
@@ -8,6 +8,7 @@
 #include "dungeon.h"
 #include "player.h"
 #include "misc.h"
+#include "profiler.h"
 
 #define byte_7FFE01 (*(uint8*)(g_ram+0x1FE01))
 static const int8 kSpriteKeese_Tab2[16] = {0, 8, 11, 14, 16, 14, 11, 8, 0, -8, -11, -14, -16, -14, -11, -8};
@@ -8256,7 +8257,9 @@ void SpritePrep_KeySetItemDrop(int k) {  // 869267
 
 void SpriteActive_Main(int k) {  // 869271
   uint8 type = sprite_type[k];
+  uint64 prof = Profiler_Begin();
   kSpriteActiveRoutines[type](k);
+  Profiler_EndObject(kProfObj_Sprite, type, prof);
 }
 
 void Sprite_09_GiantMoldorm(int k) {  // 869469
@@ -0,0 +1,74 @@
+#include "spsc_ring.h"
+#include "util.h"
+#include <stdlib.h>
+#include <string.h>
+#include <SDL.h>
+
+struct SpscRing {
+  // The indexes count up forever and get masked when used, so that full
+  // and empty can be told apart. Kept on separate cache lines.
+  SDL_atomic_t head;  // written by the producer
+  uint8 pad0[60];
+  SDL_atomic_t tail;  // written by the consumer
+  uint8 pad1[60];
+  uint32 mask;
+  size_t elem_size;
+  uint8 *data;
+};
+
+SpscRing *SpscRing_Create(size_t elem_size, uint32 capacity) {
+  uint32 n = 1;
+  while (n < capacity)
+    n <<= 1;
+  SpscRing *r = (SpscRing *)calloc(1, sizeof(SpscRing));
+  if (!r || !(r->data = (uint8 *)malloc(elem_size * n)))
+    Die("memory allocation failed");
+  r->mask = n - 1;
+  r->elem_size = elem_size;
+  return r;
+}
+
+void SpscRing_Destroy(SpscRing *r) {
+  if (r) {
+    free(r->data);
+    free(r);
+  }
+}
+
+bool SpscRing_Push(SpscRing *r, const void *elem) {
+  uint32 head = (uint32)SDL_AtomicGet(&r->head);
+  if (head - (uint32)SDL_AtomicGet(&r->tail) > r->mask)
+    return false;
+  memcpy(r->data + (head & r->mask) * r->elem_size, elem, r->elem_size);
+  SDL_AtomicSet(&r->head, (int)(head + 1));
+  return true;
+}
+
+const void *SpscRing_Peek(SpscRing *r) {
+  uint32 tail = (uint32)SDL_AtomicGet(&r->tail);
+  if (tail == (uint32)SDL_AtomicGet(&r->head))
+    return NULL;
+  return r->data + (tail & r->mask) * r->elem_size;
+}
+
+void SpscRing_Skip(SpscRing *r) {
+  SDL_AtomicAdd(&r->tail, 1);
+}
+
+bool SpscRing_Pop(SpscRing *r, void *elem) {
+  const void *p = SpscRing_Peek(r);
+  if (!p)
+    return false;
+  memcpy(elem, p, r->elem_size);
+  SpscRing_Skip(r);
+  return true;
+}
+
+uint32 SpscRing_Count(SpscRing *r) {
+  return (uint32)SDL_AtomicGet(&r->head) - (uint32)SDL_AtomicGet(&r->tail);
+}
+
+void SpscRing_Reset(SpscRing *r) {
+  SDL_AtomicSet(&r->head, 0);
+  SDL_AtomicSet(&r->tail, 0);
+}
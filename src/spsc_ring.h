@@ -0,0 +1,28 @@
+#ifndef ZELDA3_SPSC_RING_H_
+#define ZELDA3_SPSC_RING_H_
+
+#include "types.h"
+
+// Fixed size queue between exactly one producer thread and one consumer
+// thread. Neither side ever waits for the other. Several threads may take
+// the consumer role, or the producer may call Skip to drop the oldest
+// element, only if they serialize that with a lock of their own, like the
+// apu ring does with ZeldaApuLock.
+typedef struct SpscRing SpscRing;
+
+// |capacity| is rounded up to a power of two.
+SpscRing *SpscRing_Create(size_t elem_size, uint32 capacity);
+void SpscRing_Destroy(SpscRing *r);
+// Producer side. Returns false and drops |elem| if the ring is full.
+// Dropping the oldest one instead is up to the caller, see above.
+bool SpscRing_Push(SpscRing *r, const void *elem);
+// Consumer side. Peek returns the oldest element or NULL if empty, it stays
+// valid until it's removed with Skip.
+const void *SpscRing_Peek(SpscRing *r);
+void SpscRing_Skip(SpscRing *r);
+bool SpscRing_Pop(SpscRing *r, void *elem);
+uint32 SpscRing_Count(SpscRing *r);
+// Empties the ring. Only valid while neither side is using it.
+void SpscRing_Reset(SpscRing *r);
+
+#endif  // ZELDA3_SPSC_RING_H_
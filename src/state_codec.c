@@ -0,0 +1,168 @@
+#include "state_codec.h"
+#include <stdlib.h>
+#include <string.h>
+
+enum {
+  kStateCodec_HeaderSize = 8,
+  kStateCodec_Flag_Delta = 1,
+  kStateCodec_HashBits = 14,
+  kStateCodec_MinMatch = 4,
+  kStateCodec_MaxOffset = 0xffff,
+};
+
+// Each sequence is a token byte with the number of literals in the high nibble
+// and the match length - 4 in the low nibble, 15 meaning that more length bytes
+// follow. Then come the literals, and unless it's the last sequence a 16-bit
+// offset and the extra match length bytes.
+static uint8 *WriteLength(uint8 *op, size_t n) {
+  for (; n >= 255; n -= 255)
+    *op++ = 255;
+  *op++ = (uint8)n;
+  return op;
+}
+
+static uint8 *WriteSequence(uint8 *op, const uint8 *lit, size_t lit_len, size_t offset, size_t match_len) {
+  size_t ml = match_len ? match_len - kStateCodec_MinMatch : 0;
+  *op++ = (uint8)((lit_len < 15 ? lit_len : 15) << 4 | (ml < 15 ? ml : 15));
+  if (lit_len >= 15)
+    op = WriteLength(op, lit_len - 15);
+  memcpy(op, lit, lit_len);
+  op += lit_len;
+  if (match_len) {
+    *op++ = (uint8)offset;
+    *op++ = (uint8)(offset >> 8);
+    if (ml >= 15)
+      op = WriteLength(op, ml - 15);
+  }
+  return op;
+}
+
+static inline uint32 Load32(const uint8 *p) {
+  uint32 v;
+  memcpy(&v, p, 4);
+  return v;
+}
+
+static uint8 *LzCompress(uint8 *op, const uint8 *src, size_t n) {
+  uint32 table[1 << kStateCodec_HashBits] = { 0 };
+  size_t anchor = 0, i = 1;
+  while (i + kStateCodec_MinMatch <= n) {
+    uint32 v = Load32(src + i);
+    uint32 h = (v * 2654435761u) >> (32 - kStateCodec_HashBits);
+    size_t cand = table[h];
+    table[h] = (uint32)i;
+    if (i - cand > kStateCodec_MaxOffset || Load32(src + cand) != v) {
+      // Skip ahead faster through data that doesn't compress
+      i += 1 + ((i - anchor) >> 6);
+      continue;
+    }
+    size_t len = kStateCodec_MinMatch;
+    while (i + len < n && src[cand + len] == src[i + len])
+      len++;
+    while (i > anchor && cand > 0 && src[i - 1] == src[cand - 1])
+      i--, cand--, len++;
+    op = WriteSequence(op, src + anchor, i - anchor, i - cand, len);
+    i += len;
+    anchor = i;
+  }
+  return WriteSequence(op, src + anchor, n - anchor, 0, 0);
+}
+
+static bool ReadLength(const uint8 **ipp, const uint8 *iend, size_t *len) {
+  const uint8 *ip = *ipp;
+  uint8 t;
+  do {
+    if (ip == iend)
+      return false;
+    *len += t = *ip++;
+  } while (t == 255);
+  *ipp = ip;
+  return true;
+}
+
+static bool LzDecompress(uint8 *dst, size_t n, const uint8 *ip, const uint8 *iend) {
+  uint8 *op = dst, *oend = dst + n;
+  while (ip < iend) {
+    uint8 token = *ip++;
+    size_t lit_len = token >> 4;
+    if (lit_len == 15 && !ReadLength(&ip, iend, &lit_len))
+      return false;
+    if (lit_len > (size_t)(iend - ip) || lit_len > (size_t)(oend - op))
+      return false;
+    memcpy(op, ip, lit_len);
+    op += lit_len, ip += lit_len;
+    if (ip == iend)
+      break;
+    if (iend - ip < 2)
+      return false;
+    size_t offset = ip[0] | ip[1] << 8;
+    ip += 2;
+    size_t len = token & 15;
+    if (len == 15 && !ReadLength(&ip, iend, &len))
+      return false;
+    len += kStateCodec_MinMatch;
+    if (offset == 0 || offset > (size_t)(op - dst) || len > (size_t)(oend - op))
+      return false;
+    const uint8 *m = op - offset;
+    if (offset == 1) {
+      memset(op, *m, len);
+    } else if (offset >= len) {
+      memcpy(op, m, len);
+    } else {
+      for (size_t i = 0; i < len; i++)
+        op[i] = m[i];
+    }
+    op += len;
+  }
+  return op == oend;
+}
+
+size_t StateCodec_MaxCompressedSize(size_t size) {
+  return kStateCodec_HeaderSize + size + size / 255 + 16;
+}
+
+size_t StateCodec_CompressBuffer(uint8 *dst, const uint8 *data, size_t size, const uint8 *ref, uint8 *tmp) {
+  if (ref) {
+    for (size_t i = 0; i < size; i++)
+      tmp[i] = data[i] ^ ref[i];
+    data = tmp;
+  }
+  uint32 hdr[2] = { (uint32)size, ref ? kStateCodec_Flag_Delta : 0 };
+  memcpy(dst, hdr, sizeof(hdr));
+  return LzCompress(dst + kStateCodec_HeaderSize, data, size) - dst;
+}
+
+void StateCodec_Compress(ByteArray *out, const uint8 *data, size_t size, const uint8 *ref) {
+  uint8 *tmp = NULL;
+  if (ref && !(tmp = malloc(size)))
+    Die("memory allocation failed");
+  size_t start = out->size;
+  ByteArray_Resize(out, start + StateCodec_MaxCompressedSize(size));
+  out->size = start + StateCodec_CompressBuffer(out->data + start, data, size, ref, tmp);
+  free(tmp);
+}
+
+size_t StateCodec_GetSize(const uint8 *src, size_t src_size) {
+  uint32 hdr[2];
+  if (src_size < kStateCodec_HeaderSize)
+    return 0;
+  memcpy(hdr, src, sizeof(hdr));
+  return hdr[0];
+}
+
+bool StateCodec_Decompress(uint8 *dst, const uint8 *src, size_t src_size, const uint8 *ref, size_t ref_size) {
+  uint32 hdr[2];
+  if (src_size < kStateCodec_HeaderSize)
+    return false;
+  memcpy(hdr, src, sizeof(hdr));
+  bool delta = (hdr[1] & kStateCodec_Flag_Delta) != 0;
+  if (delta && (ref == NULL || ref_size != hdr[0]))
+    return false;
+  if (!LzDecompress(dst, hdr[0], src + kStateCodec_HeaderSize, src + src_size))
+    return false;
+  if (delta) {
+    for (size_t i = 0; i < hdr[0]; i++)
+      dst[i] ^= ref[i];
+  }
+  return true;
+}
@@ -0,0 +1,25 @@
+#ifndef ZELDA3_STATE_CODEC_H_
+#define ZELDA3_STATE_CODEC_H_
+
+#include "types.h"
+#include "util.h"
+
+// Compression for snapshots of the snes state. The data is first xored with a
+// reference snapshot (or nothing), which leaves mostly zeros, and then
+// compressed with a simple lz77.
+
+// Appends a compressed copy of |data| to |out|. If |ref| is not NULL it must be
+// |size| bytes long, and it's needed again to decompress.
+void StateCodec_Compress(ByteArray *out, const uint8 *data, size_t size, const uint8 *ref);
+// Worst case size of a compressed block.
+size_t StateCodec_MaxCompressedSize(size_t size);
+// Like StateCodec_Compress but doesn't allocate. |dst| has room for StateCodec_MaxCompressedSize
+// bytes and |tmp| for |size| bytes. Returns the compressed size.
+size_t StateCodec_CompressBuffer(uint8 *dst, const uint8 *data, size_t size, const uint8 *ref, uint8 *tmp);
+// Returns the uncompressed size, or 0 if it's not a valid block.
+size_t StateCodec_GetSize(const uint8 *src, size_t src_size);
+// Decompresses into |dst|, which has room for StateCodec_GetSize bytes. Returns false
+// if the data is corrupt or |ref| isn't usable for it.
+bool StateCodec_Decompress(uint8 *dst, const uint8 *src, size_t src_size, const uint8 *ref, size_t ref_size);
+
+#endif  // ZELDA3_STATE_CODEC_H_
@@ -0,0 +1,88 @@
+#include "thread_pool.h"
+#include "tracer.h"
+#include <SDL.h>
+
+static SDL_Thread *g_threads[kThreadPool_MaxThreads];
+static int g_num_threads;
+static SDL_sem *g_start_sem, *g_done_sem;
+static bool g_quit;
+
+typedef struct ThreadPoolJob {
+  ThreadPoolFunc *func;
+  void *ctx;
+  int count;
+  SDL_atomic_t next_index;
+} ThreadPoolJob;
+
+// Set while a ThreadPool_Run has the workers. The job itself lives on the
+// stack of that call.
+static SDL_atomic_t g_busy;
+static ThreadPoolJob *g_job;
+
+static void ThreadPool_DoWork(ThreadPoolJob *job) {
+  int i;
+  while ((i = SDL_AtomicAdd(&job->next_index, 1)) < job->count)
+    job->func(job->ctx, i);
+}
+
+static int SDLCALL ThreadPool_Worker(void *data) {
+  Tracer_SetThreadName("worker");
+  for (;;) {
+    SDL_SemWait(g_start_sem);
+    if (g_quit)
+      return 0;
+    ThreadPool_DoWork(g_job);
+    SDL_SemPost(g_done_sem);
+  }
+}
+
+void ThreadPool_Init(int num_threads) {
+  num_threads = IntMin(num_threads, kThreadPool_MaxThreads);
+  if (num_threads <= g_num_threads)
+    return;
+  if (!g_start_sem) {
+    g_start_sem = SDL_CreateSemaphore(0);
+    g_done_sem = SDL_CreateSemaphore(0);
+    if (!g_start_sem || !g_done_sem)
+      Die("Unable to create semaphore");
+  }
+  for (; g_num_threads < num_threads; g_num_threads++) {
+    g_threads[g_num_threads] = SDL_CreateThread(&ThreadPool_Worker, "worker", NULL);
+    if (!g_threads[g_num_threads])
+      Die("Unable to create thread");
+  }
+}
+
+void ThreadPool_Shutdown(void) {
+  g_quit = true;
+  for (int i = 0; i < g_num_threads; i++)
+    SDL_SemPost(g_start_sem);
+  for (int i = 0; i < g_num_threads; i++)
+    SDL_WaitThread(g_threads[i], NULL);
+  g_num_threads = 0;
+  g_quit = false;
+}
+
+int ThreadPool_GetNumThreads(void) {
+  return g_num_threads;
+}
+
+void ThreadPool_Run(ThreadPoolFunc *func, void *ctx, int count) {
+  ThreadPoolJob job = { func, ctx, count };
+  SDL_AtomicSet(&job.next_index, 0);
+  // If another thread, or the job that called us, already has the workers,
+  // run everything on this thread instead of waiting for them.
+  if (!SDL_AtomicCAS(&g_busy, 0, 1)) {
+    ThreadPool_DoWork(&job);
+    return;
+  }
+  int n = IntMin(g_num_threads, count - 1);
+  g_job = &job;
+  for (int i = 0; i < n; i++)
+    SDL_SemPost(g_start_sem);
+  ThreadPool_DoWork(&job);
+  for (int i = 0; i < n; i++)
+    SDL_SemWait(g_done_sem);
+  g_job = NULL;
+  SDL_AtomicSet(&g_busy, 0);
+}
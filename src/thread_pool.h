@@ -0,0 +1,22 @@
+#ifndef ZELDA3_THREAD_POOL_H_
+#define ZELDA3_THREAD_POOL_H_
+
+#include "types.h"
+
+enum {
+  kThreadPool_MaxThreads = 16,
+};
+
+typedef void ThreadPoolFunc(void *ctx, int index);
+
+// Makes sure at least |num_threads| workers exist, in addition to the calling thread.
+void ThreadPool_Init(int num_threads);
+void ThreadPool_Shutdown(void);
+int ThreadPool_GetNumThreads(void);
+// Calls |func| once for each index in [0, count) spread out over the workers
+// and the calling thread. Returns when all calls are done. Only one call has
+// the workers at a time, calls made meanwhile run on their own thread.
+// Can be called from any thread, also from inside |func|.
+void ThreadPool_Run(ThreadPoolFunc *func, void *ctx, int count);
+
+#endif  // ZELDA3_THREAD_POOL_H_
@@ -0,0 +1,133 @@
+#include <stdio.h>
+#include <SDL.h>
+
+#include "tracer.h"
+
+enum {
+  kTracer_ChunkEvents = 1 << 16,
+  // Stop recording on a thread after this many chunks, about 100MB.
+  kTracer_MaxChunks = 64,
+};
+
+typedef struct TraceEvent {
+  const char *name;
+  uint64 ticks;
+  char phase;
+} TraceEvent;
+
+// Only the owning thread writes to a chunk. It publishes each event by
+// bumping |count| after the event is written, so it can be read at any time.
+typedef struct TraceChunk {
+  SDL_atomic_t count;
+  void *next;
+  TraceEvent events[kTracer_ChunkEvents];
+} TraceChunk;
+
+typedef struct TraceThread {
+  struct TraceThread *next;
+  int tid;
+  const char *name;
+  int num_chunks;
+  uint32 dropped;
+  TraceChunk *first, *last;
+} TraceThread;
+
+bool g_tracer_enabled;
+static uint64 g_tracer_start;
+static void *g_tracer_threads;
+static SDL_atomic_t g_tracer_next_tid;
+static THREAD_LOCAL TraceThread *g_trace_thread;
+static THREAD_LOCAL const char *g_trace_thread_name;
+
+void Tracer_Start(void) {
+  g_tracer_start = SDL_GetPerformanceCounter();
+  g_tracer_enabled = true;
+}
+
+void Tracer_SetThreadName(const char *name) {
+  g_trace_thread_name = name;
+  if (g_trace_thread)
+    g_trace_thread->name = name;
+}
+
+static TraceThread *Tracer_AddThread(void) {
+  TraceThread *t = calloc(1, sizeof(TraceThread));
+  if (!t)
+    Die("memory allocation failed");
+  t->tid = SDL_AtomicAdd(&g_tracer_next_tid, 1) + 1;
+  t->name = g_trace_thread_name;
+  do {
+    t->next = SDL_AtomicGetPtr((void **)&g_tracer_threads);
+  } while (!SDL_AtomicCASPtr((void **)&g_tracer_threads, t->next, t));
+  return g_trace_thread = t;
+}
+
+static TraceChunk *Tracer_AddChunk(TraceThread *t) {
+  if (t->num_chunks == kTracer_MaxChunks)
+    return NULL;
+  TraceChunk *c = malloc(sizeof(TraceChunk));
+  if (!c)
+    return NULL;
+  SDL_AtomicSet(&c->count, 0);
+  c->next = NULL;
+  t->num_chunks++;
+  if (t->last)
+    SDL_AtomicSetPtr((void **)&t->last->next, c);
+  else
+    SDL_AtomicSetPtr((void **)&t->first, c);
+  return t->last = c;
+}
+
+void Tracer_AddEvent(const char *name, char phase) {
+  uint64 ticks = SDL_GetPerformanceCounter();
+  TraceThread *t = g_trace_thread ? g_trace_thread : Tracer_AddThread();
+  TraceChunk *c = t->last;
+  int n = c ? SDL_AtomicGet(&c->count) : kTracer_ChunkEvents;
+  if (n == kTracer_ChunkEvents) {
+    if (!(c = Tracer_AddChunk(t))) {
+      t->dropped++;
+      return;
+    }
+    n = 0;
+  }
+  TraceEvent *e = &c->events[n];
+  e->name = name;
+  e->ticks = ticks;
+  e->phase = phase;
+  SDL_AtomicSet(&c->count, n + 1);
+}
+
+bool Tracer_Write(const char *filename) {
+  FILE *f = fopen(filename, "w");
+  if (!f) {
+    fprintf(stderr, "Unable to write %s\n", filename);
+    return false;
+  }
+  double us_per_tick = 1e6 / (double)SDL_GetPerformanceFrequency();
+  bool first = true;
+  fprintf(f, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [");
+  for (TraceThread *t = SDL_AtomicGetPtr((void **)&g_tracer_threads); t; t = t->next) {
+    char name[32];
+    if (t->name)
+      snprintf(name, sizeof(name), "%s", t->name);
+    else
+      snprintf(name, sizeof(name), "thread %d", t->tid);
+    fprintf(f, "%s\n{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %d, \"args\": {\"name\": \"%s\"}}",
+            first ? "" : ",", t->tid, name);
+    first = false;
+    if (t->dropped)
+      fprintf(stderr, "%s: dropped %u events on %s, the buffer was full\n", filename, t->dropped, name);
+    for (TraceChunk *c = SDL_AtomicGetPtr((void **)&t->first); c; c = SDL_AtomicGetPtr(&c->next)) {
+      int n = SDL_AtomicGet(&c->count);
+      for (int i = 0; i < n; i++) {
+        const TraceEvent *e = &c->events[i];
+        double ts = (int64)(e->ticks - g_tracer_start) * us_per_tick;
+        fprintf(f, ",\n{\"name\": \"%s\", \"ph\": \"%c\", \"ts\": %.3f, \"pid\": 1, \"tid\": %d%s}",
+                e->name, e->phase, ts, t->tid, e->phase == 'i' ? ", \"s\": \"t\"" : "");
+      }
+    }
+  }
+  fprintf(f, "\n]}\n");
+  fclose(f);
+  return true;
+}
@@ -0,0 +1,35 @@
+#ifndef ZELDA3_TRACER_H_
+#define ZELDA3_TRACER_H_
+
+#include "types.h"
+
+// Records spans of time on every thread and writes them as Chrome trace_event
+// json, which chrome://tracing and https://ui.perfetto.dev can open. Each
+// thread appends to its own buffer, so recording never takes a lock.
+// |name| must be a string that stays valid, usually a literal.
+
+extern bool g_tracer_enabled;
+
+void Tracer_Start(void);
+// Names the calling thread in the trace. Can be called before Tracer_Start.
+void Tracer_SetThreadName(const char *name);
+void Tracer_AddEvent(const char *name, char phase);
+// Writes everything recorded so far. The other threads should be stopped.
+bool Tracer_Write(const char *filename);
+
+static inline void Tracer_Begin(const char *name) {
+  if (g_tracer_enabled)
+    Tracer_AddEvent(name, 'B');
+}
+
+static inline void Tracer_End(const char *name) {
+  if (g_tracer_enabled)
+    Tracer_AddEvent(name, 'E');
+}
+
+static inline void Tracer_Instant(const char *name) {
+  if (g_tracer_enabled)
+    Tracer_AddEvent(name, 'i');
+}
+
+#endif  // ZELDA3_TRACER_H_
@@ -32,11 +32,20 @@ typedef unsigned int uint;
 #define NORETURN __declspec(noreturn)
 #define FORCEINLINE __forceinline
 #define NOINLINE __declspec(noinline)
+#define THREAD_LOCAL __declspec(thread)
 #else
 #define countof(a) (sizeof(a)/sizeof(*(a)))
 #define NORETURN
 #define FORCEINLINE inline
 #define NOINLINE
+#ifdef __TINYC__
+// tcc has no thread local storage, so all threads share the current game
+// there. Code that can't do without it checks NO_THREAD_LOCAL.
+#define THREAD_LOCAL
+#define NO_THREAD_LOCAL
+#else
+#define THREAD_LOCAL _Thread_local
+#endif
 #endif
 
 #ifdef _DEBUG
@@ -2,6 +2,12 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdarg.h>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
 char *NextDelim(char **s, int sep) {
   char *r = *s;
@@ -56,6 +62,57 @@ uint8 *ReadWholeFile(const char *name, size_t *length) {
   return buffer;
 }
 
+// Maps the file into memory instead of reading it, so the pages come straight
+// from the page cache and are shared between processes. The mapping is private,
+// so writing to it changes only the written pages of this process. Falls back to
+// ReadWholeFile where mapping isn't available. Release it with UnmapWholeFile.
+uint8 *MapWholeFile(const char *name, size_t *length) {
+#ifndef _WIN32
+  FILE *f = fopen(name, "rb");
+  if (f == NULL)
+    return NULL;
+  struct stat st;
+  void *p = MAP_FAILED;
+  if (fstat(fileno(f), &st) == 0 && st.st_size > 0) {
+    p = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fileno(f), 0);
+    if (p == MAP_FAILED) {
+      // Read it into anonymous memory instead, so it's unmapped the same way
+      p = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON, -1, 0);
+      if (p != MAP_FAILED && fread(p, 1, st.st_size, f) != (size_t)st.st_size) {
+        munmap(p, st.st_size);
+        p = MAP_FAILED;
+      }
+    }
+  }
+  fclose(f);
+  if (p == MAP_FAILED)
+    return NULL;
+  if (length) *length = st.st_size;
+  return p;
+#else
+  return ReadWholeFile(name, length);
+#endif
+}
+
+void UnmapWholeFile(uint8 *data, size_t length) {
+  if (data == NULL)
+    return;
+#ifndef _WIN32
+  munmap(data, length);
+#else
+  free(data);
+#endif
+}
+
+// Starts reading a part of a mapped file in the background.
+void PrefetchMappedData(const void *data, size_t size) {
+#if !defined(_WIN32) && defined(MADV_WILLNEED)
+  uintptr_t page = (uintptr_t)sysconf(_SC_PAGESIZE);
+  uintptr_t start = (uintptr_t)data & ~(page - 1);
+  madvise((void *)start, (uintptr_t)data + size - start, MADV_WILLNEED);
+#endif
+}
+
 char *NextLineStripComments(char **s) {
   char *p = *s;
   if (p == NULL)
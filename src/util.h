@@ -24,6 +24,9 @@ void ByteArray_AppendData(ByteArray *arr, const uint8 *data, size_t data_size);
 void ByteArray_AppendByte(ByteArray *arr, uint8 v);
 
 uint8 *ReadWholeFile(const char *name, size_t *length);
+uint8 *MapWholeFile(const char *name, size_t *length);
+void UnmapWholeFile(uint8 *data, size_t length);
+void PrefetchMappedData(const void *data, size_t size);
 char *NextDelim(char **s, int sep);
 char *NextLineStripComments(char **s);
 char *NextPossiblyQuotedString(char **s);
@@ -60,6 +60,7 @@ static void RestoreMySnapshot(Snapshot *s) {
   memcpy(g_zenv.ram, s->ram, 0x20000);
   memcpy(g_zenv.sram, s->sram, 0x2000);
   memcpy(g_zenv.ppu->vram, s->vram, sizeof(uint16) * 0x8000);
+  ZeldaMarkVramDirty(0, 0x8000);
 }
 
 static void RestoreSnapshot(Snapshot *s) {
@@ -72,6 +73,7 @@ static void RestoreSnapshot(Snapshot *s) {
   memcpy(g_snes->ram, s->ram, 0x20000);
   memcpy(g_snes->cart->ram, s->sram, g_snes->cart->ramSize);
   memcpy(g_snes->ppu->vram, s->vram, sizeof(uint16) * 0x8000);
+  PpuMarkVramDirty(g_snes->ppu, 0, 0x8000);
 }
 
 static bool g_fail;
@@ -317,7 +319,11 @@ static void RunEmulatedSnesFrame(Snes *snes, int run_what) {
 // Copy state into the emulator, we can skip dsp/apu because 
 // we're not emulating that.
 static void EmuSynchronizeWholeState() {
+  // The bg cache belongs to a single ppu, so start over with an empty one
+  ppu_freeBgCache(g_snes->ppu);
   *g_snes->ppu = *g_zenv.ppu;
+  g_snes->ppu->bgCache = NULL;
+  g_snes->ppu->vram = g_snes->ppu->vramData;
   memcpy(g_snes->ram, g_zenv.ram, 0x20000);
   memcpy(g_snes->cart->ram, g_zenv.sram, 0x2000);
   memcpy(g_snes->dma->channel, g_zenv.dma->channel, sizeof(Dma) - offsetof(Dma, channel));
@@ -11,12 +11,16 @@
 #include "util.h"
 #include "audio.h"
 #include "assets.h"
-ZeldaEnv g_zenv;
-uint8 g_ram[131072];
-
-uint32 g_wanted_zelda_features;
+#include "thread_pool.h"
+#include "state_codec.h"
+#include "profiler.h"
+#include "tracer.h"
+static ZeldaEnv g_zenv_main;
+THREAD_LOCAL ZeldaEnv *g_zenv_cur = &g_zenv_main;
 
 static void Startup_InitializeMemory();
+static void ZeldaRtlState_Init(struct ZeldaRtlState *st);
+static void ZeldaRtlState_Destroy(struct ZeldaRtlState *st);
 
 typedef struct SimpleHdma {
   const uint8 *table;
@@ -60,8 +64,52 @@ static const uint8 kMapModeHdma1[7] = {0xf0, AT_WORD(0xdee7), 0xf0, AT_WORD(0xdf
 static const uint8 kAttractIndirectHdmaTab[7] = {0xf0, AT_WORD(0x1b00), 0xf0, AT_WORD(0x1be0), 0};
 static const uint8 kHdmaTableForPrayingScene[7] = {0xf8, AT_WORD(0x1b00), 0xf8, AT_WORD(0x1bf0), 0};
 
+typedef struct ZeldaRtlState {
+  // When rendering with multiple threads, the hdma and irq register writes
+  // of a frame are first collected here, then replayed by each band.
+  PpuRegWrite *ppu_reg_writes;
+  int ppu_reg_writes_count, ppu_reg_writes_capacity;
+  int ppu_record_line;
+  // The bands share the vram of the frame start, so a frame that writes to
+  // vram while drawing is drawn on one thread instead.
+  bool ppu_record_wrote_vram;
+  int ppu_render_threads;
+  Ppu *ppu_frame_start;
+  Ppu *ppu_bands[kThreadPool_MaxThreads + 1];
+
+  int frame_ctr_dbg;
+  uint32 replay_keyframe_interval;
+  struct StateRecorder *recorder;
+} ZeldaRtlState;
+
+#define g_ppu_reg_writes (g_zenv.rtl->ppu_reg_writes)
+#define g_ppu_reg_writes_count (g_zenv.rtl->ppu_reg_writes_count)
+#define g_ppu_record_wrote_vram (g_zenv.rtl->ppu_record_wrote_vram)
+#define g_ppu_record_line (g_zenv.rtl->ppu_record_line)
+#define g_ppu_render_threads (g_zenv.rtl->ppu_render_threads)
+#define g_ppu_frame_start (g_zenv.rtl->ppu_frame_start)
+#define g_ppu_bands (g_zenv.rtl->ppu_bands)
+#define frame_ctr_dbg (g_zenv.rtl->frame_ctr_dbg)
+#define g_replay_keyframe_interval (g_zenv.rtl->replay_keyframe_interval)
+#define state_recorder (*g_zenv.rtl->recorder)
+
 void zelda_ppu_write(uint32_t adr, uint8_t val) {
   assert(adr >= INIDISP && adr <= STAT78);
+  if (g_ppu_record_line >= 0) {
+    ZeldaRtlState *st = g_zenv.rtl;
+    if (st->ppu_reg_writes_count == st->ppu_reg_writes_capacity) {
+      st->ppu_reg_writes_capacity = IntMax(st->ppu_reg_writes_capacity * 2, 4096);
+      st->ppu_reg_writes = realloc(st->ppu_reg_writes, st->ppu_reg_writes_capacity * sizeof(PpuRegWrite));
+      if (!st->ppu_reg_writes)
+        Die("memory allocation failed");
+    }
+    if (adr == VMDATAL || adr == VMDATAH)
+      g_ppu_record_wrote_vram = true;
+    PpuRegWrite *w = &g_ppu_reg_writes[g_ppu_reg_writes_count++];
+    w->line = g_ppu_record_line;
+    w->adr = (uint8)adr;
+    w->val = val;
+  }
   ppu_write(g_zenv.ppu, (uint8)adr, val);
 }
 
@@ -70,6 +118,10 @@ void zelda_ppu_write_word(uint32_t adr, uint16_t val) {
   zelda_ppu_write(adr + 1, val >> 8);
 }
 
+void ZeldaMarkVramDirty(uint32 addr, uint32 num_words) {
+  PpuMarkVramDirty(g_zenv.ppu, addr, num_words);
+}
+
 static const uint8 *SimpleHdma_GetPtr(uint32 p) {
   switch (p) {
 
@@ -172,8 +224,44 @@ static void ConfigurePpuSideSpace() {
   PpuSetExtraSideSpace(g_zenv.ppu, extra_left, extra_right, extra_bottom);
 }
 
+void ZeldaSetRenderThreads(int num_threads) {
+  num_threads = IntMin(num_threads, countof(g_ppu_bands));
+  g_ppu_render_threads = num_threads > 1 ? num_threads : 0;
+  if (!g_ppu_render_threads)
+    return;
+  ThreadPool_Init(num_threads - 1);
+  if (!g_ppu_frame_start)
+    g_ppu_frame_start = ppu_init();
+  for (int i = 0; i < num_threads; i++) {
+    if (!g_ppu_bands[i])
+      g_ppu_bands[i] = ppu_init();
+  }
+}
+
+typedef struct PpuBandsCtx {
+  ZeldaEnv *env;
+  int num_bands;
+  int height;
+} PpuBandsCtx;
+
+static void ZeldaDrawPpuBand(void *ctx_in, int band) {
+  PpuBandsCtx *ctx = (PpuBandsCtx *)ctx_in;
+  // Workers draw for whichever game called ThreadPool_Run.
+  ZeldaEnv_MakeCurrent(ctx->env);
+  Ppu *ppu = g_ppu_bands[band];
+  Tracer_Begin("ppu band");
+  // line 0 doesn't draw anything
+  int line_start = 1 + band * ctx->height / ctx->num_bands;
+  int line_end = 1 + (band + 1) * ctx->height / ctx->num_bands;
+  ppu_copyRenderStateShared(ppu, g_ppu_frame_start);
+  ppu_runLines(ppu, g_ppu_reg_writes, g_ppu_reg_writes_count, line_start, line_end);
+  Tracer_End("ppu band");
+}
+
 void ZeldaDrawPpuFrame(uint8 *pixel_buffer, size_t pitch, uint32 render_flags) {
   SimpleHdma hdma_chans[2];
+  uint64 prof = Profiler_Begin();
+  Tracer_Begin("ppu");
 
   PpuBeginDrawing(g_zenv.ppu, pixel_buffer, pitch, render_flags);
 
@@ -198,8 +286,17 @@ void ZeldaDrawPpuFrame(uint8 *pixel_buffer, size_t pitch, uint32 render_flags) {
     ConfigurePpuSideSpace();
 
   int height = render_flags & kPpuRenderFlags_Height240 ? 240 : 224;
+  bool threaded = (g_ppu_render_threads != 0);
+
+  if (threaded) {
+    ppu_copyRenderState(g_ppu_frame_start, g_zenv.ppu);
+    g_ppu_reg_writes_count = 0;
+    g_ppu_record_wrote_vram = false;
+  }
 
   for (int i = 0; i <= height; i++) {
+    if (threaded)
+      g_ppu_record_line = i;
     if (i == 128 && irq_flag) {
       zelda_ppu_write(BG3HOFS, selectfile_var8);
       zelda_ppu_write(BG3HOFS, selectfile_var8 >> 8);
@@ -210,10 +307,25 @@ void ZeldaDrawPpuFrame(uint8 *pixel_buffer, size_t pitch, uint32 render_flags) {
         zelda_snes_dummy_write(NMITIMEN, 0x81);
       }
     }
-    ppu_runLine(g_zenv.ppu, i);
+    if (threaded)
+      g_ppu_record_line = i + 1;
+    else
+      ppu_runLine(g_zenv.ppu, i);
     SimpleHdma_DoLine(&hdma_chans[0]);
     SimpleHdma_DoLine(&hdma_chans[1]);
   }
+
+  if (threaded) {
+    g_ppu_record_line = -1;
+    if (g_ppu_record_wrote_vram) {
+      ppu_runLines(g_ppu_frame_start, g_ppu_reg_writes, g_ppu_reg_writes_count, 1, height + 1);
+    } else {
+      PpuBandsCtx ctx = { g_zenv_cur, g_ppu_render_threads, height };
+      ThreadPool_Run(&ZeldaDrawPpuBand, &ctx, ctx.num_bands);
+    }
+  }
+  Tracer_End("ppu");
+  Profiler_End(kProfZone_Ppu, prof);
 }
 
 void HdmaSetup(uint32 addr6, uint32 addr7, uint8 transfer_unit, uint8 reg6, uint8 reg7, uint8 indirect_bank) {
@@ -257,7 +369,9 @@ static void ClearOamBuffer() {  // 80841e
 static void ZeldaRunGameLoop() {
   frame_counter++;
   ClearOamBuffer();
+  uint64 prof = Profiler_Begin();
   Module_MainRouting();
+  Profiler_End(kProfZone_Module, prof);
   NMI_PrepareSprites();
   nmi_boolean = 0;
 }
@@ -268,12 +382,41 @@ void ZeldaInitialize() {
   g_zenv.ram = g_ram;
   g_zenv.sram = (uint8*)calloc(8192, 1);
   g_zenv.vram = g_zenv.ppu->vram;
+  g_zenv.rtl = (ZeldaRtlState *)calloc(1, sizeof(ZeldaRtlState));
+  if (!g_zenv.sram || !g_zenv.rtl)
+    Die("memory allocation failed");
+  ZeldaRtlState_Init(g_zenv.rtl);
   g_zenv.player = SpcPlayer_Create();
   SpcPlayer_Initialize(g_zenv.player);
+  ZeldaAudioInitialize();
   dma_reset(g_zenv.dma);
   ppu_reset(g_zenv.ppu);
 }
 
+ZeldaEnv *ZeldaEnv_Create() {
+  ZeldaEnv *env = (ZeldaEnv *)calloc(1, sizeof(ZeldaEnv)), *old = g_zenv_cur;
+  if (!env)
+    Die("memory allocation failed");
+  g_zenv_cur = env;
+  ZeldaInitialize();
+  g_zenv_cur = old;
+  return env;
+}
+
+void ZeldaEnv_Destroy(ZeldaEnv *env) {
+  ZeldaEnv *old = g_zenv_cur;
+  assert(env != &g_zenv_main);
+  g_zenv_cur = env;
+  ZeldaAudioDestroy();
+  g_zenv_cur = old;
+  ZeldaRtlState_Destroy(env->rtl);
+  SpcPlayer_Destroy(env->player);
+  ppu_free(env->ppu);
+  dma_free(env->dma);
+  free(env->sram);
+  free(env);
+}
+
 static void ZeldaRunPolyLoop() {
   if (intro_did_run_step && !nmi_flag_update_polyhedral) {
     Poly_RunFrame();
@@ -283,6 +426,10 @@ static void ZeldaRunPolyLoop() {
 }
 
 void ZeldaRunFrameInternal(uint16 input, int run_what) {
+  Profiler_BeginFrame(main_module_index, submodule_index,
+                      player_is_indoors ? dungeon_room_index : kProfRoom_Overworld | overworld_screen_index);
+  uint64 prof = Profiler_Begin();
+  Tracer_Begin("logic");
   if (animated_tile_data_src == 0)
     ZeldaInitializationCode();
 
@@ -291,6 +438,8 @@ void ZeldaRunFrameInternal(uint16 input, int run_what) {
   if (run_what & 1)
     ZeldaRunGameLoop();
   Interrupt_NMI(input);
+  Tracer_End("logic");
+  Profiler_End(kProfZone_Logic, prof);
 }
 
 
@@ -300,7 +449,7 @@ static int IncrementCrystalCountdown(uint8 *a, int v) {
   return t >> 8;
 }
 
-int frame_ctr_dbg;
+// Comparing against the emulator, like rewinding, is only done for the main game.
 static uint8 *g_emu_memory_ptr;
 static ZeldaRunFrameFunc *g_emu_runframe;
 static ZeldaSyncAllFunc *g_emu_syncall;
@@ -361,6 +510,19 @@ void loadFunc(void *ctx, void *data, size_t data_size) {
   st->p += data_size;
 }
 
+static void countFunc(void *ctx, void *data, size_t data_size) {
+  *(size_t *)ctx += data_size;
+}
+
+static void InternalSaveLoad(SaveLoadFunc *func, void *ctx);
+
+// Size of the snapshots written by SaveSnesState.
+static size_t SnesStateSize() {
+  size_t size = 0;
+  InternalSaveLoad(&countFunc, &size);
+  return size;
+}
+
 static void InternalSaveLoad(SaveLoadFunc *func, void *ctx) {
   uint8 junk[58] = { 0 };
   func(ctx, junk, 27);
@@ -423,15 +585,103 @@ typedef struct StateRecorder {
 
   ByteArray log;
   ByteArray base_snapshot;
+
+  // Snapshots taken while replaying, compressed and stored back to back in
+  // |keyframes|, described by the StateRecorderKeyframe entries in |keyframe_index|.
+  ByteArray keyframe_index;
+  ByteArray keyframes;
 } StateRecorder;
 
-static StateRecorder state_recorder;
+// Everything needed to resume a replay at |frame| without replaying it from the start.
+typedef struct StateRecorderKeyframe {
+  uint32 frame;
+  uint32 replay_pos, replay_pos_last_complete;
+  uint32 replay_next_cmd_at;
+  uint32 frames_since_last;
+  uint16 last_inputs;
+  uint8 replay_cmd;
+  uint8 timer_cycles;  // not part of the snes state
+  uint32 snapshot_offset, snapshot_size;
+} StateRecorderKeyframe;
+
+// The parts of StateRecorder that change from frame to frame.
+typedef struct StateRecorderPos {
+  uint32 log_size;
+  uint32 frames_since_last, total_frames;
+  uint32 replay_pos, replay_pos_last_complete;
+  uint32 replay_frame_counter;
+  uint32 replay_next_cmd_at;
+  uint16 last_inputs;
+  uint8 replay_cmd;
+  bool replay_mode;
+} StateRecorderPos;
 
 void StateRecorder_Init(StateRecorder *sr) {
   memset(sr, 0, sizeof(*sr));
 }
 
+static void ZeldaRtlState_Init(ZeldaRtlState *st) {
+  st->ppu_record_line = -1;
+  st->recorder = (StateRecorder *)calloc(1, sizeof(StateRecorder));
+  if (!st->recorder)
+    Die("memory allocation failed");
+}
+
+static void ZeldaRtlState_Destroy(ZeldaRtlState *st) {
+  StateRecorder *sr = st->recorder;
+  ByteArray_Destroy(&sr->log);
+  ByteArray_Destroy(&sr->base_snapshot);
+  ByteArray_Destroy(&sr->keyframe_index);
+  ByteArray_Destroy(&sr->keyframes);
+  free(sr);
+  free(st->ppu_reg_writes);
+  if (st->ppu_frame_start)
+    ppu_free(st->ppu_frame_start);
+  for (int i = 0; i < countof(st->ppu_bands); i++) {
+    if (st->ppu_bands[i])
+      ppu_free(st->ppu_bands[i]);
+  }
+  free(st);
+}
+
+static StateRecorderKeyframe *StateRecorder_GetKeyframes(StateRecorder *sr, size_t *num) {
+  *num = sr->keyframe_index.size / sizeof(StateRecorderKeyframe);
+  return (StateRecorderKeyframe *)sr->keyframe_index.data;
+}
+
+// Snapshots are compressed as a delta against the base snapshot when possible.
+static const uint8 *StateRecorder_DeltaRef(StateRecorder *sr, size_t size) {
+  return sr->base_snapshot.size == size ? sr->base_snapshot.data : NULL;
+}
+
+// Keyframes loaded from a file were already decoded once by
+// StateRecorder_ValidateKeyframes, so this can only fail on a bug.
+static void StateRecorder_DecompressSnapshot(ByteArray *dst, const uint8 *src, size_t src_size, const ByteArray *ref) {
+  ByteArray_Resize(dst, StateCodec_GetSize(src, src_size));
+  if (!StateCodec_Decompress(dst->data, src, src_size, ref->data, ref->size))
+    Die("Corrupt snapshot in save file");
+}
+
+static void StateRecorder_ClearKeyframes(StateRecorder *sr) {
+  sr->keyframe_index.size = 0;
+  sr->keyframes.size = 0;
+}
+
+// Drops keyframes that are past the end of the log, or that were taken after
+// the last command and would miss anything appended to the log.
+static void StateRecorder_TrimKeyframes(StateRecorder *sr) {
+  size_t n;
+  StateRecorderKeyframe *kf = StateRecorder_GetKeyframes(sr, &n);
+  while (n && (kf[n - 1].frame >= sr->total_frames || kf[n - 1].replay_pos > sr->log.size ||
+               kf[n - 1].replay_next_cmd_at == 0xffffffff))
+    n--;
+  sr->keyframe_index.size = n * sizeof(StateRecorderKeyframe);
+  sr->keyframes.size = n ? kf[n - 1].snapshot_offset + kf[n - 1].snapshot_size : 0;
+}
+
 void StateRecorder_RecordCmd(StateRecorder *sr, uint8 cmd) {
+  if (sr->keyframe_index.size)
+    StateRecorder_TrimKeyframes(sr);
   int frames = sr->frames_since_last;
   sr->frames_since_last = 0;
   int x = (cmd < 0xc0) ? 0xf : 0x1;
@@ -481,53 +731,255 @@ void ReadFromFile(FILE *f, void *data, size_t n) {
     Die("fread failed\n");
 }
 
-void StateRecorder_Load(StateRecorder *sr, FILE *f, bool replay_mode) {
-  // todo: fix robustness on invalid data.
+// Called at the start of each replayed frame.
+static void StateRecorder_MaybeAddKeyframe(StateRecorder *sr) {
+  uint32 frame = sr->replay_frame_counter;
+  if (g_replay_keyframe_interval == 0 || frame == 0 || frame % g_replay_keyframe_interval != 0)
+    return;
+  size_t n;
+  StateRecorderKeyframe *kf = StateRecorder_GetKeyframes(sr, &n);
+  if (n && kf[n - 1].frame >= frame)
+    return;
+  StateRecorderKeyframe k;
+  memset(&k, 0, sizeof(k));
+  k.frame = frame;
+  k.replay_pos = sr->replay_pos;
+  k.replay_pos_last_complete = sr->replay_pos_last_complete;
+  k.replay_next_cmd_at = sr->replay_next_cmd_at;
+  k.frames_since_last = sr->frames_since_last;
+  k.last_inputs = sr->last_inputs;
+  k.replay_cmd = sr->replay_cmd;
+  k.snapshot_offset = (uint32)sr->keyframes.size;
+  ByteArray arr = { 0 };
+  // The audio thread keeps running the spc player, so read both at once.
+  ZeldaApuLock();
+  k.timer_cycles = g_zenv.player->timer_cycles;
+  SaveSnesState(&saveFunc, &arr);
+  ZeldaApuUnlock();
+  StateCodec_Compress(&sr->keyframes, arr.data, arr.size, StateRecorder_DeltaRef(sr, arr.size));
+  ByteArray_Destroy(&arr);
+  k.snapshot_size = (uint32)(sr->keyframes.size - k.snapshot_offset);
+  ByteArray_AppendData(&sr->keyframe_index, (uint8 *)&k, sizeof(k));
+}
+
+// Version 2 files store the keyframes uncompressed.
+static void StateRecorder_CompressKeyframes(StateRecorder *sr) {
+  size_t n;
+  StateRecorderKeyframe *kf = StateRecorder_GetKeyframes(sr, &n);
+  ByteArray raw = sr->keyframes;
+  memset(&sr->keyframes, 0, sizeof(sr->keyframes));
+  for (size_t i = 0; i < n; i++) {
+    if (kf[i].snapshot_offset > raw.size || kf[i].snapshot_size > raw.size - kf[i].snapshot_offset) {
+      // Keep only the keyframes before the broken one
+      sr->keyframe_index.size = i * sizeof(StateRecorderKeyframe);
+      break;
+    }
+    uint32 offset = (uint32)sr->keyframes.size;
+    StateCodec_Compress(&sr->keyframes, raw.data + kf[i].snapshot_offset, kf[i].snapshot_size,
+                        StateRecorder_DeltaRef(sr, kf[i].snapshot_size));
+    kf[i].snapshot_offset = offset;
+    kf[i].snapshot_size = (uint32)(sr->keyframes.size - offset);
+  }
+  ByteArray_Destroy(&raw);
+}
+
+static void StateRecorder_LoadKeyframe(StateRecorder *sr, const StateRecorderKeyframe *k) {
+  sr->replay_mode = true;
+  sr->replay_frame_counter = k->frame;
+  sr->replay_pos = k->replay_pos;
+  sr->replay_pos_last_complete = k->replay_pos_last_complete;
+  sr->replay_next_cmd_at = k->replay_next_cmd_at;
+  sr->frames_since_last = k->frames_since_last;
+  sr->last_inputs = k->last_inputs;
+  sr->replay_cmd = k->replay_cmd;
+  ByteArray arr = { 0 };
+  StateRecorder_DecompressSnapshot(&arr, sr->keyframes.data + k->snapshot_offset, k->snapshot_size, &sr->base_snapshot);
+  LoadFuncState state = { arr.data, arr.data + arr.size };
+  ZeldaApuLock();
+  LoadSnesState(&loadFunc, &state);
+  g_zenv.player->timer_cycles = k->timer_cycles;
+  ZeldaApuUnlock();
+  assert(state.p == state.pend);
+  ByteArray_Destroy(&arr);
+}
+
+// Goes back to the start of the recording and replays it from there.
+static void StateRecorder_RestartReplay(StateRecorder *sr) {
+  sr->replay_mode = true;
+  sr->replay_next_cmd_at = 0;
+  sr->frames_since_last = 0;
+  sr->last_inputs = 0;
+  sr->replay_pos = sr->replay_pos_last_complete = 0;
+  sr->replay_frame_counter = 0;
+  // Load snapshot from |base_snapshot_|, or reset if empty.
+  if (sr->base_snapshot.size) {
+    LoadFuncState state = { sr->base_snapshot.data, sr->base_snapshot.data + sr->base_snapshot.size };
+    LoadSnesState(&loadFunc, &state);
+    assert(state.p == state.pend);
+  } else {
+    ZeldaReset(false);
+  }
+}
+
+// Keyframes are stored as 8 words each, in the same byte order as the header.
+enum {
+  kKeyframe_Words = 8,
+};
+
+static void StateRecorderKeyframe_Pack(const StateRecorderKeyframe *k, uint32 *w) {
+  w[0] = k->frame;
+  w[1] = k->replay_pos;
+  w[2] = k->replay_pos_last_complete;
+  w[3] = k->replay_next_cmd_at;
+  w[4] = k->frames_since_last;
+  w[5] = k->last_inputs | k->replay_cmd << 16 | k->timer_cycles << 24;
+  w[6] = k->snapshot_offset;
+  w[7] = k->snapshot_size;
+}
+
+static void StateRecorderKeyframe_Unpack(StateRecorderKeyframe *k, const uint32 *w) {
+  memset(k, 0, sizeof(*k));
+  k->frame = w[0];
+  k->replay_pos = w[1];
+  k->replay_pos_last_complete = w[2];
+  k->replay_next_cmd_at = w[3];
+  k->frames_since_last = w[4];
+  k->last_inputs = (uint16)w[5];
+  k->replay_cmd = (uint8)(w[5] >> 16);
+  k->timer_cycles = (uint8)(w[5] >> 24);
+  k->snapshot_offset = w[6];
+  k->snapshot_size = w[7];
+}
+
+// Reads |size| bytes into |dst|. Sizes larger than the whole file are
+// rejected before allocating anything.
+static bool ReadArrayFromFile(FILE *f, ByteArray *dst, size_t size, size_t file_size) {
+  if (size > file_size)
+    return false;
+  ByteArray_Resize(dst, size);
+  return fread(dst->data, 1, size, f) == size;
+}
+
+// Reads a snapshot of |size| bytes from the file, decompressing it if needed.
+// Returns false if it's truncated, corrupt or doesn't unpack to |want_size| bytes.
+static bool ReadSnapshotFromFile(FILE *f, ByteArray *dst, size_t size, bool compressed, const ByteArray *ref,
+                                 size_t want_size, size_t file_size) {
+  if (!compressed)
+    return size == want_size && ReadArrayFromFile(f, dst, size, file_size);
+  ByteArray arr = { 0 };
+  bool ok = ReadArrayFromFile(f, &arr, size, file_size) && StateCodec_GetSize(arr.data, arr.size) == want_size;
+  if (ok) {
+    ByteArray_Resize(dst, want_size);
+    ok = StateCodec_Decompress(dst->data, arr.data, arr.size, ref->data, ref->size);
+  }
+  ByteArray_Destroy(&arr);
+  return ok;
+}
+
+// Checks that every keyframe read from a file points inside the log and the
+// keyframe data, and unpacks to a whole snapshot. Compressed ones are decoded
+// once here, so seeking to them later can't run into a corrupt stream.
+static bool StateRecorder_ValidateKeyframes(const ByteArray *index, const ByteArray *keyframes, const ByteArray *log,
+                                            const ByteArray *base, uint32 total_frames, bool compressed,
+                                            size_t snes_size) {
+  const StateRecorderKeyframe *kf = (const StateRecorderKeyframe *)index->data;
+  size_t n = index->size / sizeof(StateRecorderKeyframe);
+  ByteArray tmp = { 0 };
+  bool ok = true;
+  for (size_t i = 0; ok && i < n; i++) {
+    const StateRecorderKeyframe *k = &kf[i];
+    const uint8 *data = keyframes->data + k->snapshot_offset;
+    if (k->snapshot_offset > keyframes->size || k->snapshot_size > keyframes->size - k->snapshot_offset ||
+        k->replay_pos > log->size || k->replay_pos_last_complete > log->size ||
+        k->frame > total_frames || (i != 0 && k->frame <= kf[i - 1].frame)) {
+      ok = false;
+    } else if (!compressed) {
+      ok = (k->snapshot_size == snes_size);
+    } else if (StateCodec_GetSize(data, k->snapshot_size) != snes_size) {
+      ok = false;
+    } else {
+      ByteArray_Resize(&tmp, snes_size);
+      ok = StateCodec_Decompress(tmp.data, data, k->snapshot_size, base->data, base->size);
+    }
+  }
+  ByteArray_Destroy(&tmp);
+  return ok;
+}
+
+// Returns false and leaves everything as it was if the file is truncated or corrupt.
+bool StateRecorder_Load(StateRecorder *sr, FILE *f, bool replay_mode) {
   uint32 hdr[8] = { 0 };
-  ReadFromFile(f, hdr, sizeof(hdr));
+  uint32 ext_hdr[4] = { 0 };  // num keyframes, keyframes size, base snapshot size, snapshot size
+  ByteArray index = { 0 }, log = { 0 }, base = { 0 }, keyframes = { 0 }, state = { 0 }, no_ref = { 0 };
+  size_t snes_size = SnesStateSize();
+  long start = ftell(f);
+  fseek(f, 0, SEEK_END);
+  size_t file_size = (size_t)(ftell(f) - start);
+  fseek(f, start, SEEK_SET);
+
+  // Version 2 adds keyframes and version 3 compresses all snapshots.
+  // ext_hdr and the keyframe index follow right after the header.
+  // hdr[6], the uncompressed snapshot size, is only used before version 3.
+  bool ok = fread(hdr, 1, sizeof(hdr), f) == sizeof(hdr) && hdr[0] >= 1 && hdr[0] <= 3;
+  bool compressed = hdr[0] >= 3;
+  size_t ext_hdr_size = hdr[0] >= 3 ? 16 : hdr[0] == 2 ? 8 : 0;
+  ok = ok && fread(ext_hdr, 1, ext_hdr_size, f) == ext_hdr_size;
+  ok = ok && ext_hdr[0] <= file_size / (kKeyframe_Words * 4);
+  if (ok) {
+    ByteArray_Resize(&index, ext_hdr[0] * sizeof(StateRecorderKeyframe));
+    for (uint32 i = 0; ok && i < ext_hdr[0]; i++) {
+      uint32 w[kKeyframe_Words];
+      ok = fread(w, 1, sizeof(w), f) == sizeof(w);
+      StateRecorderKeyframe_Unpack((StateRecorderKeyframe *)index.data + i, w);
+    }
+  }
+  ok = ok && ReadArrayFromFile(f, &log, hdr[2], file_size);
+  if (ok && (hdr[5] & 1))
+    ok = ReadSnapshotFromFile(f, &base, compressed ? ext_hdr[2] : hdr[6], compressed, &no_ref, snes_size, file_size);
+  ok = ok && ReadArrayFromFile(f, &keyframes, ext_hdr[1], file_size);
+  ok = ok && StateRecorder_ValidateKeyframes(&index, &keyframes, &log, &base, hdr[1], compressed, snes_size);
+  if (ok && !replay_mode)
+    ok = ReadSnapshotFromFile(f, &state, compressed ? ext_hdr[3] : hdr[6], compressed, &base, snes_size, file_size);
+  if (!ok) {
+    ByteArray_Destroy(&index);
+    ByteArray_Destroy(&log);
+    ByteArray_Destroy(&base);
+    ByteArray_Destroy(&keyframes);
+    ByteArray_Destroy(&state);
+    return false;
+  }
 
-  assert(hdr[0] == 1);
+  ByteArray_Destroy(&sr->keyframe_index);
+  ByteArray_Destroy(&sr->log);
+  ByteArray_Destroy(&sr->base_snapshot);
+  ByteArray_Destroy(&sr->keyframes);
+  sr->keyframe_index = index;
+  sr->log = log;
+  sr->base_snapshot = base;
+  sr->keyframes = keyframes;
+  if (!compressed)
+    StateRecorder_CompressKeyframes(sr);
 
   sr->total_frames = hdr[1];
-  ByteArray_Resize(&sr->log, hdr[2]);
-  ReadFromFile(f, sr->log.data, sr->log.size);
   sr->last_inputs = hdr[3];
   sr->frames_since_last = hdr[4];
-
-  ByteArray_Resize(&sr->base_snapshot, (hdr[5] & 1) ? hdr[6] : 0);
-  ReadFromFile(f, sr->base_snapshot.data, sr->base_snapshot.size);
-
   sr->replay_next_cmd_at = 0;
 
   sr->replay_mode = replay_mode;
   if (replay_mode) {
-    sr->frames_since_last = 0;
-    sr->last_inputs = 0;
-    sr->replay_pos = sr->replay_pos_last_complete = 0;
-    sr->replay_frame_counter = 0;
-    // Load snapshot from |base_snapshot_|, or reset if empty.
-
-    if (sr->base_snapshot.size) {
-      LoadFuncState state = { sr->base_snapshot.data, sr->base_snapshot.data + sr->base_snapshot.size };
-      LoadSnesState(&loadFunc, &state);
-      assert(state.p == state.pend);
-    } else {
-      ZeldaReset(false);
-    }
+    StateRecorder_RestartReplay(sr);
   } else {
     // Resume replay from the saved position?
     sr->replay_pos = sr->replay_pos_last_complete = hdr[5] >> 1;
     sr->replay_frame_counter = hdr[7];
     sr->replay_mode = (sr->replay_frame_counter != 0);
 
-    ByteArray arr = { 0 };
-    ByteArray_Resize(&arr, hdr[6]);
-    ReadFromFile(f, arr.data, arr.size);
-    LoadFuncState state = { arr.data, arr.data + arr.size };
-    LoadSnesState(&loadFunc, &state);
-    ByteArray_Destroy(&arr);
-    assert(state.p == state.pend);
+    LoadFuncState st = { state.data, state.data + state.size };
+    LoadSnesState(&loadFunc, &st);
+    assert(st.p == st.pend);
+    ByteArray_Destroy(&state);
   }
+  return true;
 }
 
 void StateRecorder_Save(StateRecorder *sr, FILE *f) {
@@ -536,13 +988,12 @@ void StateRecorder_Save(StateRecorder *sr, FILE *f) {
   SaveSnesState(&saveFunc, &arr);
   assert(sr->base_snapshot.size == 0 || sr->base_snapshot.size == arr.size);
 
-  hdr[0] = 1;
+  hdr[0] = 3;
   hdr[1] = sr->total_frames;
   hdr[2] = (uint32)sr->log.size;
   hdr[3] = sr->last_inputs;
   hdr[4] = sr->frames_since_last;
   hdr[5] = sr->base_snapshot.size ? 1 : 0;
-  hdr[6] = (uint32)arr.size;
   // If saving while in replay mode, also need to persist
   // sr->replay_pos_last_complete and sr->replay_frame_counter
   // so the replaying can be resumed.
@@ -550,16 +1001,34 @@ void StateRecorder_Save(StateRecorder *sr, FILE *f) {
     hdr[5] |= sr->replay_pos_last_complete << 1;
     hdr[7] = sr->replay_frame_counter;
   }
+  ByteArray base = { 0 }, state = { 0 };
+  if (sr->base_snapshot.size)
+    StateCodec_Compress(&base, sr->base_snapshot.data, sr->base_snapshot.size, NULL);
+  StateCodec_Compress(&state, arr.data, arr.size, StateRecorder_DeltaRef(sr, arr.size));
+  uint32 ext_hdr[4] = {
+    (uint32)(sr->keyframe_index.size / sizeof(StateRecorderKeyframe)), (uint32)sr->keyframes.size,
+    (uint32)base.size, (uint32)state.size
+  };
   fwrite(hdr, 1, sizeof(hdr), f);
+  fwrite(ext_hdr, 1, sizeof(ext_hdr), f);
+  for (size_t i = 0; i < ext_hdr[0]; i++) {
+    uint32 w[kKeyframe_Words];
+    StateRecorderKeyframe_Pack((StateRecorderKeyframe *)sr->keyframe_index.data + i, w);
+    fwrite(w, 1, sizeof(w), f);
+  }
   fwrite(sr->log.data, 1, hdr[2], f);
-  fwrite(sr->base_snapshot.data, 1, sr->base_snapshot.size, f);
-  fwrite(arr.data, 1, arr.size, f);
+  fwrite(base.data, 1, base.size, f);
+  fwrite(sr->keyframes.data, 1, sr->keyframes.size, f);
+  fwrite(state.data, 1, state.size, f);
 
+  ByteArray_Destroy(&state);
+  ByteArray_Destroy(&base);
   ByteArray_Destroy(&arr);
 }
 
 void StateRecorder_ClearKeyLog(StateRecorder *sr) {
   printf("Clearing key log!\n");
+  StateRecorder_ClearKeyframes(sr);
   sr->base_snapshot.size = 0;
   SaveSnesState(&saveFunc, &sr->base_snapshot);
   ByteArray old_log = sr->log;
@@ -645,12 +1114,44 @@ uint16 StateRecorder_ReadNextReplayState(StateRecorder *sr) {
   return sr->last_inputs;
 }
 
+static void StateRecorder_GetPos(StateRecorder *sr, StateRecorderPos *pos) {
+  pos->log_size = (uint32)sr->log.size;
+  pos->frames_since_last = sr->frames_since_last;
+  pos->total_frames = sr->total_frames;
+  pos->replay_pos = sr->replay_pos;
+  pos->replay_pos_last_complete = sr->replay_pos_last_complete;
+  pos->replay_frame_counter = sr->replay_frame_counter;
+  pos->replay_next_cmd_at = sr->replay_next_cmd_at;
+  pos->last_inputs = sr->last_inputs;
+  pos->replay_cmd = sr->replay_cmd;
+  pos->replay_mode = sr->replay_mode;
+}
+
+// Goes back to an earlier position. The log only grows while recording, so
+// going back just discards what was recorded after it.
+static void StateRecorder_SetPos(StateRecorder *sr, const StateRecorderPos *pos) {
+  assert(pos->log_size <= sr->log.size);
+  sr->log.size = pos->log_size;
+  sr->frames_since_last = pos->frames_since_last;
+  sr->total_frames = pos->total_frames;
+  sr->replay_pos = pos->replay_pos;
+  sr->replay_pos_last_complete = pos->replay_pos_last_complete;
+  sr->replay_frame_counter = pos->replay_frame_counter;
+  sr->replay_next_cmd_at = pos->replay_next_cmd_at;
+  sr->last_inputs = pos->last_inputs;
+  sr->replay_cmd = pos->replay_cmd;
+  sr->replay_mode = pos->replay_mode;
+  if (sr->keyframe_index.size)
+    StateRecorder_TrimKeyframes(sr);
+}
+
 void StateRecorder_StopReplay(StateRecorder *sr) {
   if (!sr->replay_mode)
     return;
   sr->replay_mode = false;
   sr->total_frames = sr->replay_frame_counter;
   sr->log.size = sr->replay_pos_last_complete;
+  StateRecorder_TrimKeyframes(sr);
 }
 
 #ifdef _DEBUG
@@ -696,6 +1197,7 @@ bool ZeldaRunFrame(int inputs) {
 
   // Either copy state or apply state
   if (is_replay) {
+    StateRecorder_MaybeAddKeyframe(&state_recorder);
     inputs = StateRecorder_ReadNextReplayState(&state_recorder);
   } else {
     //    input_state = InputStateReadFromFile();
@@ -775,6 +1277,151 @@ void ZeldaSetLanguage(const char *language) {
 }
 
 
+enum {
+  kRewind_Interval = 4,
+  kRewind_MaxEntries = 16384,
+  kRewind_MinMemory = 4 << 20,
+};
+
+typedef struct RewindEntry {
+  // Position in the arena of the compressed snapshot
+  uint32 offset, size;
+  // The state that the snapshot goes back to
+  StateRecorderPos pos;
+  uint8 timer_cycles;
+} RewindEntry;
+
+// Each entry holds the xor between a snapshot and the one before it, so starting
+// from the newest snapshot in |head| it's possible to step backwards through all of
+// them. The entries are stored in a circular arena that is allocated up front.
+typedef struct RewindBuffer {
+  uint8 *arena;
+  size_t arena_size, write_pos;
+  RewindEntry *entries;
+  uint32 first, count;
+  ByteArray head, cur;
+  uint8 *tmp;
+  RewindEntry head_info;
+  bool has_head;
+  uint32 frames_since_capture;
+} RewindBuffer;
+
+static RewindBuffer g_rewind;
+
+static void RewindBuffer_Reset(RewindBuffer *rb) {
+  rb->write_pos = 0;
+  rb->first = rb->count = 0;
+  rb->has_head = false;
+  rb->frames_since_capture = 0;
+}
+
+static void RewindBuffer_DropOldest(RewindBuffer *rb) {
+  rb->first = (rb->first + 1) % kRewind_MaxEntries;
+  rb->count--;
+}
+
+// Finds |need| contiguous bytes for a new entry, throwing away the oldest entries.
+static bool RewindBuffer_Alloc(RewindBuffer *rb, size_t need) {
+  if (need > rb->arena_size)
+    return false;
+  if (rb->count == kRewind_MaxEntries)
+    RewindBuffer_DropOldest(rb);
+  for (;;) {
+    if (rb->count == 0) {
+      if (rb->write_pos + need > rb->arena_size)
+        rb->write_pos = 0;
+      return true;
+    }
+    size_t tail = rb->entries[rb->first].offset;
+    if (tail < rb->write_pos) {
+      // Free space is at the end and the start of the arena
+      if (rb->write_pos + need <= rb->arena_size)
+        return true;
+      if (need <= tail) {
+        rb->write_pos = 0;
+        return true;
+      }
+    } else if (rb->write_pos + need <= tail) {
+      return true;
+    }
+    RewindBuffer_DropOldest(rb);
+  }
+}
+
+void ZeldaRewindInit(size_t memory_budget) {
+  RewindBuffer *rb = &g_rewind;
+  if (memory_budget == 0)
+    return;
+  rb->arena_size = memory_budget < kRewind_MinMemory ? kRewind_MinMemory : memory_budget;
+  rb->arena = malloc(rb->arena_size);
+  rb->entries = malloc(kRewind_MaxEntries * sizeof(RewindEntry));
+  if (!rb->arena || !rb->entries)
+    Die("Unable to allocate memory for rewind");
+  RewindBuffer_Reset(rb);
+}
+
+// Call once per frame, takes a snapshot every kRewind_Interval frames.
+void ZeldaRewindCapture() {
+  RewindBuffer *rb = &g_rewind;
+  if (!rb->arena || ++rb->frames_since_capture < kRewind_Interval)
+    return;
+  rb->frames_since_capture = 0;
+  rb->cur.size = 0;
+  ZeldaApuLock();
+  SaveSnesState(&saveFunc, &rb->cur);
+  uint8 timer_cycles = g_zenv.player->timer_cycles;
+  ZeldaApuUnlock();
+  if (!rb->tmp && !(rb->tmp = malloc(rb->cur.size)))
+    Die("Unable to allocate memory for rewind");
+  if (rb->has_head && rb->head.size == rb->cur.size &&
+      RewindBuffer_Alloc(rb, StateCodec_MaxCompressedSize(rb->cur.size))) {
+    RewindEntry *e = &rb->entries[(rb->first + rb->count++) % kRewind_MaxEntries];
+    *e = rb->head_info;
+    e->offset = (uint32)rb->write_pos;
+    e->size = (uint32)StateCodec_CompressBuffer(rb->arena + rb->write_pos, rb->cur.data, rb->cur.size, rb->head.data, rb->tmp);
+    rb->write_pos += e->size;
+  } else {
+    // Can't link it to the previous snapshots
+    rb->first = rb->count = 0;
+  }
+  ByteArray t = rb->head;
+  rb->head = rb->cur;
+  rb->cur = t;
+  rb->has_head = true;
+  StateRecorder_GetPos(&state_recorder, &rb->head_info.pos);
+  rb->head_info.timer_cycles = timer_cycles;
+}
+
+// Goes back to the previous snapshot. Returns false when there are no more.
+bool ZeldaRewindStep() {
+  RewindBuffer *rb = &g_rewind;
+  if (!rb->has_head)
+    return false;
+  // If frames were run since the last snapshot, go back to it first.
+  if (rb->frames_since_capture == 0) {
+    if (rb->count == 0)
+      return false;
+    RewindEntry *e = &rb->entries[(rb->first + --rb->count) % kRewind_MaxEntries];
+    ByteArray_Resize(&rb->cur, rb->head.size);
+    if (!StateCodec_Decompress(rb->cur.data, rb->arena + e->offset, e->size, rb->head.data, rb->head.size))
+      Die("Corrupt rewind buffer");
+    ByteArray t = rb->head;
+    rb->head = rb->cur;
+    rb->cur = t;
+    rb->head_info = *e;
+    rb->write_pos = e->offset;
+  }
+  rb->frames_since_capture = 0;
+  LoadFuncState state = { rb->head.data, rb->head.data + rb->head.size };
+  ZeldaApuLock();
+  LoadSnesState(&loadFunc, &state);
+  g_zenv.player->timer_cycles = rb->head_info.timer_cycles;
+  ZeldaApuUnlock();
+  assert(state.p == state.pend);
+  StateRecorder_SetPos(&state_recorder, &rb->head_info.pos);
+  return true;
+}
+
 static const char *const kReferenceSaves[] = {
   "Chapter 1 - Zelda's Rescue.sav",
   "Chapter 2 - After Eastern Palace.sav",
@@ -805,15 +1452,75 @@ void SaveLoadSlot(int cmd, int which) {
     printf("*** %s slot %d\n",
       cmd == kSaveLoad_Save ? "Saving" : cmd == kSaveLoad_Load ? "Loading" : "Replaying", which);
 
-    if (cmd != kSaveLoad_Save)
-      StateRecorder_Load(&state_recorder, f, cmd == kSaveLoad_Replay);
-    else
+    if (cmd != kSaveLoad_Save) {
+      if (StateRecorder_Load(&state_recorder, f, cmd == kSaveLoad_Replay))
+        RewindBuffer_Reset(&g_rewind);
+      else
+        fprintf(stderr, "Save file %s is corrupt\n", name);
+    } else
       StateRecorder_Save(&state_recorder, f);
 
     fclose(f);
   }
 }
 
+bool ZeldaLoadReplay(const char *filename) {
+  FILE *f = fopen(filename, "rb");
+  if (!f)
+    return false;
+  bool ok = StateRecorder_Load(&state_recorder, f, true);
+  if (ok)
+    RewindBuffer_Reset(&g_rewind);
+  fclose(f);
+  return ok;
+}
+
+bool ZeldaIsReplaying() {
+  return state_recorder.replay_mode;
+}
+
+uint32 ZeldaGetReplayFrame() {
+  StateRecorder *sr = &state_recorder;
+  return sr->replay_mode ? sr->replay_frame_counter : sr->total_frames;
+}
+
+// Runs the recorded inputs up until |frame| as fast as possible. Nothing is
+// rendered and the spc player only runs its state machine without generating
+// samples. Starts from the closest keyframe before |frame| when that saves time,
+// seeking backwards without one restarts the replay from the beginning.
+void StateRecorder_SeekToFrame(StateRecorder *sr, uint32 frame) {
+  uint32 cur = ZeldaGetReplayFrame();
+  size_t n;
+  StateRecorderKeyframe *kf = StateRecorder_GetKeyframes(sr, &n);
+  while (n && kf[n - 1].frame > frame)
+    n--;
+  if (n && (frame < cur || kf[n - 1].frame > cur))
+    StateRecorder_LoadKeyframe(sr, &kf[n - 1]);
+  else if (frame < cur)
+    StateRecorder_RestartReplay(sr);
+  // Only take the apu lock one frame at a time, so the audio thread can
+  // keep going in between.
+  while (sr->replay_mode && sr->replay_frame_counter < frame) {
+    ZeldaRunFrame(0);
+    ZeldaSkipAudioFrame();
+    ZeldaDiscardUnusedAudioFrames();
+  }
+}
+
+void ZeldaSeekReplay(uint32 frame) {
+  StateRecorder_SeekToFrame(&state_recorder, frame);
+  // The seeked frames aren't captured, so take a snapshot right at the
+  // target. Rewinding then steps over the whole seek at once.
+  if (g_rewind.arena) {
+    g_rewind.frames_since_capture = kRewind_Interval - 1;
+    ZeldaRewindCapture();
+  }
+}
+
+void ZeldaSetReplayKeyframeInterval(uint32 frames) {
+  g_replay_keyframe_interval = frames;
+}
+
 typedef struct StateRecoderMultiPatch {
   uint32 count;
   uint32 addr;
@@ -857,10 +1564,12 @@ void PatchCommand(char c) {
     StateRecoderMultiPatch_Patch(&mp, 0xf361, rupees >> 8);  // link_rupees_goal
   } else if (c == 'k') {
     StateRecorder_ClearKeyLog(&state_recorder);
+    RewindBuffer_Reset(&g_rewind);
   } else if (c == 'o') {
     StateRecoderMultiPatch_Patch(&mp, 0xf36f, 1);
   } else if (c == 'l') {
     StateRecorder_StopReplay(&state_recorder);
+    RewindBuffer_Reset(&g_rewind);
   } else if (c == 'E') {
     StateRecoderMultiPatch_Patch(&mp, 0x37f, g_ram[0x37f] ^ 1);
   }
@@ -13,7 +13,17 @@
 
 struct Snes;
 struct Dsp;
+struct ZeldaRtlState;
+struct ZeldaAudioState;
 
+typedef struct PrepOamCoordsRet {
+  uint16 x, y;
+  uint8 r4;
+  uint8 flags;
+} PrepOamCoordsRet;
+
+// Everything that belongs to one running game. Several of them can run in
+// the same process, each on its own thread.
 typedef struct ZeldaEnv {
   uint8 *ram;
   uint8 *sram;
@@ -25,9 +35,29 @@ typedef struct ZeldaEnv {
   MemBlk dialogue_blk;
   MemBlk dialogue_font_blk;
   uint8 dialogue_flags;
+
+  uint32 wanted_features;
+  struct ZeldaRtlState *rtl;
+  struct ZeldaAudioState *audio;
+  // Game code state that isn't part of the snes ram
+  bool link_moved_camera;
+  PrepOamCoordsRet ending_coords;
+
+  uint8 ram_buf[0x20000];
 } ZeldaEnv;
-extern ZeldaEnv g_zenv;
-extern int frame_ctr_dbg;
+
+// The game that runs on the calling thread. All threads start out with the
+// main game, the one that main.c shows.
+extern THREAD_LOCAL ZeldaEnv *g_zenv_cur;
+#define g_zenv (*g_zenv_cur)
+#define g_ram (g_zenv.ram_buf)
+#define g_wanted_zelda_features (g_zenv.wanted_features)
+
+// Creates and initializes another game, like ZeldaInitialize does for the
+// main one. Doesn't change the current game.
+ZeldaEnv *ZeldaEnv_Create();
+void ZeldaEnv_Destroy(ZeldaEnv *env);
+static inline void ZeldaEnv_MakeCurrent(ZeldaEnv *env) { g_zenv_cur = env; }
 
 typedef void PlayerHandlerFunc();
 typedef void HandlerFuncK(int k);
@@ -39,6 +69,8 @@ uint8_t zelda_read_apui00();
 uint8_t zelda_apu_read(uint32_t adr);
 void zelda_ppu_write(uint32_t adr, uint8_t val);
 void zelda_ppu_write_word(uint32_t adr, uint16_t val);
+// Call after writing to g_zenv.vram directly, so the renderer knows it changed
+void ZeldaMarkVramDirty(uint32 addr, uint32 num_words);
 
 
 // 512x480 32-bit pixels. Returns true if we instead draw 1024x960
@@ -49,10 +81,14 @@ const char *GetSaveDir(void);
 void ZeldaInitialize();
 void ZeldaReset(bool preserve_sram);
 void ZeldaDrawPpuFrame(uint8 *pixel_buffer, size_t pitch, uint32 render_flags);
+// The thread pool is shared, so only one game at a time should render with threads.
+void ZeldaSetRenderThreads(int num_threads);
 void ZeldaRunFrameInternal(uint16 input, int run_what);
 bool ZeldaRunFrame(int input_state);
 void LoadSongBank(const uint8 *p);
 void ZeldaApuLock();
+// Returns false instead of waiting if another thread has the lock.
+bool ZeldaApuTryLock();
 void ZeldaApuUnlock();
 bool ZeldaIsPlayingMusicTrack(uint8 track);
 uint8 ZeldaGetEntranceMusicTrack(int track);
@@ -68,6 +104,18 @@ enum {
 };
 
 void SaveLoadSlot(int cmd, int which);
+bool ZeldaLoadReplay(const char *filename);
+bool ZeldaIsReplaying();
+// Current frame of the replay, or the total number of recorded frames when not replaying.
+uint32 ZeldaGetReplayFrame();
+// Fast forwards or rewinds the replay to |frame| without rendering, see StateRecorder_SeekToFrame.
+void ZeldaSeekReplay(uint32 frame);
+// Store a snapshot every |frames| frames while replaying, to make seeking faster. 0 disables.
+void ZeldaSetReplayKeyframeInterval(uint32 frames);
+// Keeps recent snapshots in |memory_budget| bytes so the game can be rewound. 0 disables.
+void ZeldaRewindInit(size_t memory_budget);
+void ZeldaRewindCapture();
+bool ZeldaRewindStep();
 void ZeldaWriteSram();
 void ZeldaReadSram();
 